@@ -0,0 +1,287 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct BenchSettings {
+    // 计时前丢弃的重复次数
+    int warmup = 1;
+    int repetitions = 7;
+    // 每次重复至少运行的时间(秒)，据此确定迭代次数
+    double minTime = 0.1;
+    // 只运行名字中包含filter的测试
+    std::string filter;
+    // 非空时把结果写成JSON
+    std::string jsonPath;
+
+    // 端到端地渲染内置场景，而不是运行微基准
+    bool scenes = false;
+    int sceneWidth = 160;
+    int sceneSpp = 32;
+    std::string integrator = "path";
+    std::string sampler = "independent";
+    // nee和mis均匀地选择光源，不建光源树
+    bool uniformLights = false;
+    // path和nee在漫反射顶点按学到的分布引导方向
+    bool guide = false;
+    // 参考图像的样本数和存放的目录
+    int referenceSpp = 1024;
+    std::string referenceDir = ".scene_refs";
+    // 扩展性测试的线程数，为空时取1和所有核
+    std::vector<int> threadCounts;
+};
+
+inline void PrintBenchUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --warmup N     untimed repetitions (default 1)\n"
+              << "  --reps N       timed repetitions (default 7)\n"
+              << "  --min-time S   seconds per repetition (default 0.1)\n"
+              << "  --filter TEXT  only run benchmarks whose name has TEXT\n"
+              << "  --json FILE    also write the results to FILE as JSON\n"
+              << "Scene benchmarks:\n"
+              << "  --scenes       render scenes 1-9 instead (filter: scene3)\n"
+              << "  --width N      image width (default 160)\n"
+              << "  --spp N        samples per pixel (default 32)\n"
+              << "  --integrator I path, nee or mis (default path)\n"
+              << "  --sampler NAME independent, sobol, halton or bluenoise\n"
+              << "  --uniform-lights pick lights uniformly (no light tree)\n"
+              << "  --guide        path or nee with online path guiding\n"
+              << "  --ref-spp N    samples of the references (default 1024)\n"
+              << "  --ref-dir DIR  where references are kept (.scene_refs)\n"
+              << "  --threads LIST thread counts to compare, e.g. 1,2,4\n";
+}
+
+inline bool ParseBenchOptions(int argc, char* argv[],
+                              BenchSettings& settings) {
+    for (int n = 1; n < argc; n++) {
+        const char* arg = argv[n];
+        const char* value = n + 1 < argc ? argv[n + 1] : nullptr;
+        if (std::strcmp(arg, "--scenes") == 0) {
+            settings.scenes = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--uniform-lights") == 0) {
+            settings.uniformLights = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--guide") == 0) {
+            settings.guide = true;
+            continue;
+        }
+        if (value == nullptr) {
+            PrintBenchUsage(argv[0]);
+            return false;
+        }
+        if (std::strcmp(arg, "--warmup") == 0) {
+            settings.warmup = std::max(0, std::atoi(value));
+        } else if (std::strcmp(arg, "--reps") == 0) {
+            settings.repetitions = std::max(1, std::atoi(value));
+        } else if (std::strcmp(arg, "--min-time") == 0) {
+            settings.minTime = std::atof(value);
+        } else if (std::strcmp(arg, "--filter") == 0) {
+            settings.filter = value;
+        } else if (std::strcmp(arg, "--json") == 0) {
+            settings.jsonPath = value;
+        } else if (std::strcmp(arg, "--width") == 0) {
+            settings.sceneWidth = std::max(2, std::atoi(value));
+        } else if (std::strcmp(arg, "--spp") == 0) {
+            settings.sceneSpp = std::max(1, std::atoi(value));
+        } else if (std::strcmp(arg, "--integrator") == 0) {
+            settings.integrator = value;
+        } else if (std::strcmp(arg, "--sampler") == 0) {
+            settings.sampler = value;
+        } else if (std::strcmp(arg, "--ref-spp") == 0) {
+            settings.referenceSpp = std::max(1, std::atoi(value));
+        } else if (std::strcmp(arg, "--ref-dir") == 0) {
+            settings.referenceDir = value;
+        } else if (std::strcmp(arg, "--threads") == 0) {
+            settings.threadCounts.clear();
+            for (const char* p = value; *p != '\0';) {
+                settings.threadCounts.push_back(std::max(1, std::atoi(p)));
+                p = std::strchr(p, ',');
+                if (p == nullptr) break;
+                p++;
+            }
+        } else {
+            PrintBenchUsage(argv[0]);
+            return false;
+        }
+        n++;
+    }
+    return true;
+}
+
+// 写进JSON的编译器版本，__VERSION__只有GCC和Clang定义
+inline std::string CompilerVersion() {
+#if defined(__VERSION__)
+    return __VERSION__;
+#elif defined(_MSC_FULL_VER)
+    return "MSVC " + std::to_string(_MSC_FULL_VER);
+#else
+    return "unknown";
+#endif
+}
+
+// 写出加了引号的JSON字符串，转义引号和反斜杠
+inline void WriteJsonString(std::ostream& out, const std::string& s) {
+    out << '"';
+    for (auto c : s) {
+        if (c == '"' || c == '\\') out << '\\';
+        out << c;
+    }
+    out << '"';
+}
+
+struct BenchResult {
+    std::string name;
+    // 一次操作是什么："ray"的结果同时换算成Mrays/s
+    std::string unit;
+    size_t iterations;
+    // 每次重复的ns/op
+    std::vector<double> samples;
+    double min, median, mean, stddev, max;
+    double checksum;
+
+    double MRaysPerSecond() const { return unit == "ray" ? 1e3 / median : 0; }
+};
+
+// Runs kernels, each a function that performs n operations and returns a
+// checksum of its results so the work cannot be optimized away. The
+// iteration count is doubled until one call takes minTime; then warmup
+// calls are discarded and repetitions calls are timed.
+class BenchmarkSuite {
+   private:
+    BenchSettings settings_;
+    std::vector<BenchResult> results_;
+
+    using Clock = std::chrono::steady_clock;
+
+    static double seconds(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    static void summarize(BenchResult& result) {
+        auto sorted = result.samples;
+        std::sort(sorted.begin(), sorted.end());
+        auto n = sorted.size();
+        result.min = sorted.front();
+        result.max = sorted.back();
+        result.median = n % 2 == 1 ? sorted[n / 2]
+                                   : 0.5 * (sorted[n / 2 - 1] + sorted[n / 2]);
+        auto sum = 0.0;
+        for (auto s : sorted) sum += s;
+        result.mean = sum / n;
+        auto squares = 0.0;
+        for (auto s : sorted) squares += (s - result.mean) * (s - result.mean);
+        result.stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0;
+    }
+
+    static void print(const BenchResult& result) {
+        std::cout << std::left << std::setw(36) << result.name << std::right
+                  << std::fixed << std::setprecision(2) << std::setw(10)
+                  << result.median << " ns/" << std::left << std::setw(7)
+                  << result.unit << std::right << " ±" << std::setw(5)
+                  << std::setprecision(1)
+                  << 100 * result.stddev / result.mean << "%";
+        if (result.unit == "ray") {
+            std::cout << std::setw(9) << std::setprecision(2)
+                      << result.MRaysPerSecond() << " Mrays/s";
+        }
+        std::cout << '\n';
+    }
+
+   public:
+    explicit BenchmarkSuite(const BenchSettings& settings)
+        : settings_(settings) {}
+
+    const std::vector<BenchResult>& Results() const { return results_; }
+
+    void Section(const std::string& title) {
+        std::cout << '\n' << title << '\n';
+    }
+
+    void Run(const std::string& name, const std::string& unit,
+             const std::function<double(size_t)>& kernel) {
+        if (name.find(settings_.filter) == std::string::npos) return;
+
+        // 校准的同时也起到了预热的作用
+        size_t iterations = 1;
+        auto checksum = 0.0;
+        while (true) {
+            auto start = Clock::now();
+            checksum = kernel(iterations);
+            if (seconds(start) >= settings_.minTime || iterations >= 1u << 30) {
+                break;
+            }
+            iterations *= 2;
+        }
+        for (int w = 0; w < settings_.warmup; w++) kernel(iterations);
+
+        BenchResult result;
+        result.name = name;
+        result.unit = unit;
+        result.iterations = iterations;
+        result.checksum = checksum;
+        for (int r = 0; r < settings_.repetitions; r++) {
+            auto start = Clock::now();
+            result.checksum += kernel(iterations);
+            result.samples.push_back(1e9 * seconds(start) / iterations);
+        }
+        summarize(result);
+        print(result);
+        results_.push_back(result);
+    }
+
+    // {"context": {...}, "benchmarks": [{"name": ..., "ns_per_op": {...}}]}
+    void WriteJson(std::ostream& out) const {
+        out << "{\n  \"context\": {\"compiler\": ";
+        WriteJsonString(out, CompilerVersion());
+#ifdef NDEBUG
+        out << ", \"assertions\": false";
+#else
+        out << ", \"assertions\": true";
+#endif
+        out << ", \"warmup\": " << settings_.warmup
+            << ", \"repetitions\": " << settings_.repetitions
+            << ", \"min_time\": " << settings_.minTime << "},\n"
+            << "  \"benchmarks\": [";
+        out << std::setprecision(6) << std::defaultfloat;
+        for (size_t i = 0; i < results_.size(); i++) {
+            const auto& r = results_[i];
+            out << (i == 0 ? "\n" : ",\n") << "    {\"name\": ";
+            WriteJsonString(out, r.name);
+            out << ", \"unit\": ";
+            WriteJsonString(out, r.unit);
+            out << ", \"iterations\": " << r.iterations
+                << ", \"ns_per_op\": {\"min\": " << r.min
+                << ", \"median\": " << r.median << ", \"mean\": " << r.mean
+                << ", \"stddev\": " << r.stddev << ", \"max\": " << r.max
+                << "}, \"samples\": [";
+            for (size_t s = 0; s < r.samples.size(); s++) {
+                out << (s == 0 ? "" : ", ") << r.samples[s];
+            }
+            out << "]";
+            if (r.unit == "ray") {
+                out << ", \"mrays_per_s\": " << r.MRaysPerSecond();
+            }
+            out << ", \"checksum\": " << r.checksum << "}";
+        }
+        out << "\n  ]\n}\n";
+    }
+
+    bool WriteJson(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out) return false;
+        WriteJson(out);
+        return static_cast<bool>(out);
+    }
+};
@@ -0,0 +1,469 @@
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "fast_math.hpp"
+#include "harness.hpp"
+#include "light_tree.hpp"
+#include "scene_bench.hpp"
+#include "scenes.hpp"
+
+// 输入数据的个数，取2的幂以便用&循环取用
+const size_t inputCount = 1 << 14;
+
+// 场景相机在随机像素位置生成的主光线
+std::vector<Ray> CameraRays(const Scene& scene, size_t count) {
+    auto camera = scene.MakeCamera(scene.ImageHeight(scene.imageWidth));
+    std::vector<Ray> rays(count);
+    for (auto& r : rays) r = camera.GetRay(RandomDouble(), RandomDouble());
+    return rays;
+}
+
+// 主光线的命中点按余弦分布反弹一次得到的次级光线，BVH遍历时更不连贯
+std::vector<Ray> BounceRays(const Hittable& world,
+                            const std::vector<Ray>& primary) {
+    std::vector<Ray> rays;
+    for (const auto& r : primary) {
+        HitRecord rec;
+        if (!world.Hit(r, 0, infinity, rec)) continue;
+        rec.Resolve(r);
+        rays.push_back(
+            rec.SpawnRay(rec.normal + RandomUnitVector(), r.Time()));
+    }
+    // 补足到inputCount
+    for (size_t i = 0; rays.size() < primary.size(); i++) {
+        rays.push_back(rays[i]);
+    }
+    return rays;
+}
+
+std::vector<Point3> HitPoints(const Hittable& world,
+                              const std::vector<Ray>& rays) {
+    std::vector<Point3> points;
+    for (const auto& r : rays) {
+        HitRecord rec;
+        if (!world.Hit(r, 0, infinity, rec)) continue;
+        rec.Resolve(r);
+        points.push_back(rec.p);
+    }
+    for (size_t i = 0; points.size() < rays.size(); i++) {
+        points.push_back(points[i]);
+    }
+    return points;
+}
+
+// 第一个交点的t之和
+double TraceRays(const Hittable& world, const std::vector<Ray>& rays,
+                 size_t n) {
+    auto sum = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        HitRecord rec;
+        if (world.Hit(rays[i & (rays.size() - 1)], 0, infinity, rec)) {
+            sum += rec.t;
+        }
+    }
+    return sum;
+}
+
+// 被挡住的光线数，任意一个交点就可以结束遍历
+double OccludedRays(const Hittable& world, const std::vector<Ray>& rays,
+                    size_t n) {
+    auto occluded = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        occluded += world.Occluded(rays[i & (rays.size() - 1)], 0, infinity);
+    }
+    return occluded;
+}
+
+// 近似和libm在inputs上的最大绝对误差
+template <class Fast, class Exact>
+double MaxError(const std::vector<double>& inputs, Fast fast, Exact exact) {
+    auto error = 0.0;
+    for (auto x : inputs) {
+        error = std::max(error, std::fabs(fast(x) - exact(x)));
+    }
+    return error;
+}
+
+// 打印一项精度检查，误差超过界时返回false
+bool CheckAccuracy(const std::string& name, double error, double bound) {
+    auto ok = error <= bound;
+    std::cout << std::left << std::setw(36) << name << std::right
+              << std::scientific << std::setprecision(2) << std::setw(10)
+              << error << " max error, bound " << bound
+              << (ok ? "" : "  FAILED") << '\n'
+              << std::defaultfloat;
+    return ok;
+}
+
+// 在[lo, hi]内均匀分布的count个点，加上两端
+std::vector<double> Uniform(double lo, double hi, size_t count) {
+    std::vector<double> values{lo, hi};
+    while (values.size() < count) values.push_back(RandomDouble(lo, hi));
+    return values;
+}
+
+// f依次作用在inputs上，结果加起来
+template <class F>
+std::function<double(size_t)> EachInput(const std::vector<double>& inputs,
+                                        F f) {
+    return [&inputs, f](size_t n) {
+        auto sum = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            sum += f(inputs[i & (inputCount - 1)]);
+        }
+        return sum;
+    };
+}
+
+// Accuracy of every approximation in fast_math.hpp against libm, then the
+// cost of each next to its libm counterpart. Returns whether all errors
+// are within their bounds.
+bool BenchFastMath(BenchmarkSuite& suite) {
+    suite.Section("Fast math accuracy (vs libm)");
+    // 棋盘格纹理的参数是10倍的坐标，这里覆盖到|x| = 1e4
+    auto angles = Uniform(-1e4, 1e4, 1 << 20);
+    auto small = Uniform(-2 * pi, 2 * pi, 1 << 20);
+    angles.insert(angles.end(), small.begin(), small.end());
+    auto cosines = Uniform(-1, 1, 1 << 20);
+    // 0到1的随机数，和介质里采样距离时一样，再加上很大的范围
+    auto logInputs = Uniform(0, 1, 1 << 20);
+    for (int e = -1000; e <= 1000; e++) logInputs.push_back(std::pow(2.0, e));
+    for (int i = 0; i < 1 << 16; i++) {
+        logInputs.push_back(std::exp(RandomDouble(-700, 700)));
+    }
+    // atan2的y、x两两组合，包括坐标轴和带符号的0
+    std::vector<double> coords = Uniform(-1, 1, 1 << 10);
+    coords.push_back(0.0);
+    coords.push_back(-0.0);
+
+    auto ok = true;
+    auto sinError = MaxError(
+        angles, [](double x) { return FastSin(x); },
+        [](double x) { return std::sin(x); });
+    ok &= CheckAccuracy("FastSin", sinError, fastSinMaxError);
+    auto acosError = MaxError(
+        cosines, [](double x) { return FastAcos(x); },
+        [](double x) { return std::acos(x); });
+    ok &= CheckAccuracy("FastAcos", acosError, fastAcosMaxError);
+    auto atanError = 0.0;
+    for (auto y : coords) {
+        atanError = std::max(
+            atanError,
+            MaxError(
+                coords, [y](double x) { return FastAtan2(y, x); },
+                [y](double x) { return std::atan2(y, x); }));
+    }
+    ok &= CheckAccuracy("FastAtan2", atanError, fastAtan2MaxError);
+    auto logError = MaxError(
+        logInputs, [](double x) { return FastLog(x); },
+        [](double x) { return std::log(x); });
+    ok &= CheckAccuracy("FastLog", logError, fastLogMaxError);
+#ifdef RTW_FAST_MATH_SSE
+    auto sin4Error = 0.0;
+    for (size_t i = 0; i + 4 <= angles.size(); i += 4) {
+        alignas(16) float x[4], s[4];
+        for (int lane = 0; lane < 4; lane++) {
+            x[lane] = static_cast<float>(angles[i + lane]);
+        }
+        _mm_store_ps(s, FastSin4(_mm_load_ps(x)));
+        for (int lane = 0; lane < 4; lane++) {
+            sin4Error = std::max(
+                sin4Error, std::fabs(s[lane] - std::sin(double(x[lane]))));
+        }
+    }
+    ok &= CheckAccuracy("FastSin4", sin4Error, fastSin4MaxError);
+#endif
+
+    suite.Section("Fast math cost");
+    angles.resize(inputCount);
+    cosines.resize(inputCount);
+    logInputs.resize(inputCount);
+    suite.Run("Math/sin", "op", EachInput(angles, [](double x) {
+                  return std::sin(x);
+              }));
+    suite.Run("Math/FastSin", "op", EachInput(angles, [](double x) {
+                  return FastSin(x);
+              }));
+#ifdef RTW_FAST_MATH_SSE
+    std::vector<float> floatAngles(angles.begin(), angles.end());
+    suite.Run("Math/FastSin4", "op", [&](size_t n) {
+        auto sum = _mm_setzero_ps();
+        for (size_t i = 0; i < n; i += 4) {
+            auto x = _mm_loadu_ps(&floatAngles[i & (inputCount - 1)]);
+            sum = _mm_add_ps(sum, FastSin4(x));
+        }
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, sum);
+        return static_cast<double>(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+    });
+#endif
+    suite.Run("Math/acos", "op", EachInput(cosines, [](double x) {
+                  return std::acos(x);
+              }));
+    suite.Run("Math/FastAcos", "op", EachInput(cosines, [](double x) {
+                  return FastAcos(x);
+              }));
+    suite.Run("Math/atan2", "op", [&](size_t n) {
+        auto sum = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            sum += std::atan2(cosines[i & (inputCount - 1)],
+                              cosines[(i + 1) & (inputCount - 1)]);
+        }
+        return sum;
+    });
+    suite.Run("Math/FastAtan2", "op", [&](size_t n) {
+        auto sum = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            sum += FastAtan2(cosines[i & (inputCount - 1)],
+                             cosines[(i + 1) & (inputCount - 1)]);
+        }
+        return sum;
+    });
+    suite.Run("Math/log", "op", EachInput(logInputs, [](double x) {
+                  return std::log(x);
+              }));
+    suite.Run("Math/FastLog", "op", EachInput(logInputs, [](double x) {
+                  return FastLog(x);
+              }));
+    suite.Run("Math/pow(x, 5)", "op", EachInput(cosines, [](double x) {
+                  return std::pow(x, 5);
+              }));
+    suite.Run("Math/Pow5", "op", EachInput(cosines, [](double x) {
+                  return Pow5(x);
+              }));
+    return ok;
+}
+
+// Cost of choosing a light at the first hits of scene 9 (thousands of
+// emissive spheres), uniformly and with the light tree, for a growing
+// prefix of its lights.
+void BenchLightSelection(BenchmarkSuite& suite) {
+    suite.Section("Light selection (scene 9 first hits)");
+    MaterialTable::Scope materials;
+    auto scene = LoadScene(9);
+    LightList all;
+    scene.world.CollectLights(all);
+    auto rays = CameraRays(scene, inputCount);
+    std::vector<HitRecord> hits;
+    for (const auto& r : rays) {
+        HitRecord rec;
+        if (!scene.world.Hit(r, 0, infinity, rec)) continue;
+        rec.Resolve(r);
+        hits.push_back(rec);
+    }
+    for (size_t i = 0; hits.size() < rays.size(); i++) {
+        hits.push_back(hits[i]);
+    }
+
+    for (size_t count : {size_t(64), size_t(512), all.size()}) {
+        LightList lights;
+        for (size_t i = 0; i < count; i++) {
+            lights.add(all.lights[i], all.primitives[i]);
+        }
+        auto suffix = "/" + std::to_string(count);
+        auto select = [&](size_t n) {
+            auto sum = 0.0;
+            for (size_t i = 0; i < n; i++) {
+                const auto& rec = hits[i & (inputCount - 1)];
+                double pmf = 0;
+                SelectLight(lights, rec.p, rec.normal, RandomDouble(), pmf);
+                sum += pmf;
+            }
+            return sum;
+        };
+        suite.Run("SelectLight/uniform" + suffix, "op", select);
+        suite.Run("LightTree::Build" + suffix, "tree", [&](size_t n) {
+            auto sum = 0.0;
+            for (size_t i = 0; i < n; i++) {
+                sum += LightTree::Build(lights)->NodeCount();
+            }
+            return sum;
+        });
+        BuildLightTree(lights);
+        suite.Run("SelectLight/tree" + suffix, "op", select);
+        suite.Run("SelectLightPmf/tree" + suffix, "op", [&](size_t n) {
+            auto sum = 0.0;
+            for (size_t i = 0; i < n; i++) {
+                const auto& rec = hits[i & (inputCount - 1)];
+                sum += SelectLightPmf(lights, rec.p, rec.normal,
+                                      lights.primitives[i % count]);
+            }
+            return sum;
+        });
+    }
+}
+
+void BenchShading(BenchmarkSuite& suite, const char* name,
+                  std::shared_ptr<Material> mat) {
+    std::vector<HitRecord> hits(1024);
+    std::vector<Ray> rays(hits.size());
+    for (size_t i = 0; i < hits.size(); i++) {
+        auto& rec = hits[i];
+        rec.p = Vec3::Random(-10, 10);
+        rays[i] = Ray(Point3{0, 0, 0}, rec.p, RandomDouble());
+        rec.SetFaceNormal(rays[i], UnitVector(Vec3::Random(-1, 1)));
+        rec.u = RandomDouble();
+        rec.v = RandomDouble();
+        rec.t = 1;
+        rec.matPtr = mat;
+    }
+
+    // 每次弹射的着色开销：Emitted + Scatter
+    suite.Run(std::string("Shading/") + name, "bounce", [&](size_t n) {
+        Color sum{0, 0, 0};
+        for (size_t i = 0; i < n; i++) {
+            const auto& rec = hits[i & (hits.size() - 1)];
+            const auto& r = rays[i & (rays.size() - 1)];
+            Ray scattered;
+            Color attenuation;
+            sum += rec.matPtr->Emitted(rec.u, rec.v, rec.p);
+            if (rec.matPtr->Scatter(r, rec, attenuation, scattered)) {
+                sum += attenuation * scattered.Direction();
+            }
+        }
+        return sum.X() + sum.Y() + sum.Z();
+    });
+}
+
+int main(int argc, char* argv[]) {
+    BenchSettings settings;
+    if (!ParseBenchOptions(argc, argv, settings)) {
+        return 1;
+    }
+    if (settings.scenes) {
+        SceneBenchmark scenes(settings);
+        if (!scenes.Run()) return 1;
+        if (!settings.jsonPath.empty()) {
+            std::ofstream json(settings.jsonPath);
+            scenes.WriteJson(json);
+            if (!json) {
+                std::cerr << "Could not write " << settings.jsonPath << '\n';
+                return 1;
+            }
+        }
+        return 0;
+    }
+    BenchmarkSuite suite(settings);
+
+    // 输入取自内置场景：随机球(1)、Perlin球(3)和最终场景(8)
+    MaterialTable::Scope materials;
+    auto random = LoadScene(1);
+    auto perlin = LoadScene(3);
+    auto finalScene = LoadScene(8);
+    auto randomRays = CameraRays(random, inputCount);
+
+    suite.Section("Primitives (scene 1 camera rays)");
+    std::vector<AABB> boxes;
+    std::vector<const Sphere*> spheres;
+    for (const auto& object : random.world.objects) {
+        AABB box;
+        if (object->BoundingBox(0, 1, box)) boxes.push_back(box);
+        auto sphere = dynamic_cast<const Sphere*>(object.get());
+        if (sphere != nullptr) spheres.push_back(sphere);
+    }
+    // 每条光线依次和场景里的下一个图元求交，和线性遍历时一样
+    suite.Run("AABB::Hit", "ray", [&](size_t n) {
+        auto hits = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            hits += boxes[i % boxes.size()].Hit(
+                randomRays[i & (inputCount - 1)], 0, infinity);
+        }
+        return hits;
+    });
+    suite.Run("Sphere::Hit", "ray", [&](size_t n) {
+        auto sum = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            HitRecord rec;
+            if (spheres[i % spheres.size()]->Hit(
+                    randomRays[i & (inputCount - 1)], 0, infinity, rec)) {
+                sum += rec.t;
+            }
+        }
+        return sum;
+    });
+
+    suite.Section("BVH traversal (first hit)");
+    BVHNode randomBVH(random.world, 0, 1);
+    BVHNode finalBVH(finalScene.world, 0, 1);
+    auto randomBounces = BounceRays(randomBVH, randomRays);
+    auto finalRays = CameraRays(finalScene, inputCount);
+    auto finalBounces = BounceRays(finalBVH, finalRays);
+    suite.Run("BVHNode::Hit/scene1/camera", "ray", [&](size_t n) {
+        return TraceRays(randomBVH, randomRays, n);
+    });
+    suite.Run("BVHNode::Hit/scene1/bounce", "ray", [&](size_t n) {
+        return TraceRays(randomBVH, randomBounces, n);
+    });
+    suite.Run("BVHNode::Hit/scene8/camera", "ray", [&](size_t n) {
+        return TraceRays(finalBVH, finalRays, n);
+    });
+    suite.Run("BVHNode::Hit/scene8/bounce", "ray", [&](size_t n) {
+        return TraceRays(finalBVH, finalBounces, n);
+    });
+
+    suite.Section("BVH traversal (any hit)");
+    suite.Run("BVHNode::Occluded/scene1/bounce", "ray", [&](size_t n) {
+        return OccludedRays(randomBVH, randomBounces, n);
+    });
+    suite.Run("BVHNode::Occluded/scene8/bounce", "ray", [&](size_t n) {
+        return OccludedRays(finalBVH, finalBounces, n);
+    });
+
+    suite.Section("Sampling and textures");
+    // Perlin球场景里相机看到的点
+    auto noisePoints =
+        HitPoints(perlin.world, CameraRays(perlin, inputCount));
+    Perlin noise;
+    suite.Run("Perlin::Turb", "op", [&](size_t n) {
+        auto sum = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            sum += noise.Turb(noisePoints[i & (inputCount - 1)]);
+        }
+        return sum;
+    });
+    suite.Run("RandomInUnitSphere", "op", [&](size_t n) {
+        Vec3 sum{0, 0, 0};
+        for (size_t i = 0; i < n; i++) sum += RandomInUnitSphere();
+        return sum.X() + sum.Y() + sum.Z();
+    });
+    // 场景1的相机有景深和运动模糊的快门时间
+    auto camera = random.MakeCamera(random.ImageHeight(random.imageWidth));
+    suite.Run("Camera::GetRay", "ray", [&](size_t n) {
+        auto sum = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            auto r = camera.GetRay(RandomDouble(), RandomDouble());
+            sum += r.Direction().X() + r.Time();
+        }
+        return sum;
+    });
+
+    suite.Section("Shading cost per bounce");
+    auto checker = std::make_shared<CheckerTexture>(Color(0.2, 0.3, 0.1),
+                                                    Color(0.9, 0.9, 0.9));
+    auto noiseTexture = std::make_shared<NoiseTexture>(4);
+    BenchShading(suite, "Lambertian(solid)",
+                 MakeMaterial<Lambertian>(Color(0.4, 0.2, 0.1)));
+    BenchShading(suite, "Lambertian(checker)",
+                 MakeMaterial<Lambertian>(checker));
+    BenchShading(suite, "Lambertian(noise)",
+                 MakeMaterial<Lambertian>(noiseTexture));
+    BenchShading(suite, "Metal",
+                 MakeMaterial<Metal>(Color(0.7, 0.6, 0.5), 0.3));
+    BenchShading(suite, "Dielectric", MakeMaterial<Dielectric>(1.5));
+    BenchShading(suite, "DiffuseLight",
+                 MakeMaterial<DiffuseLight>(Color(7, 7, 7)));
+    BenchShading(suite, "Isotropic",
+                 MakeMaterial<Isotropic>(Color(1, 1, 1)));
+
+    BenchLightSelection(suite);
+
+    auto accurate = BenchFastMath(suite);
+
+    if (!settings.jsonPath.empty() && !suite.WriteJson(settings.jsonPath)) {
+        std::cerr << "Could not write " << settings.jsonPath << '\n';
+        return 1;
+    }
+    return accurate ? 0 : 1;
+}
@@ -0,0 +1,535 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/resource.h>
+#include <sys/stat.h>
+#endif
+
+#include "harness.hpp"
+#include "integrator.hpp"
+#include "progressive.hpp"
+#include "scenes.hpp"
+
+// Counts every query from the top of the scene, Hit or Occluded, as one
+// ray. Counts are thread-local, so counting does not change how rendering
+// scales with threads; Count() adds up those of all threads.
+class RayCounter : public Hittable {
+   private:
+    const Hittable& world_;
+
+    struct Local;
+
+    struct Registry {
+        std::mutex mutex;
+        uint64_t exited = 0;
+        std::vector<Local*> live;
+    };
+
+    struct Local {
+        uint64_t rays = 0;
+        Local() {
+            auto& r = registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.live.push_back(this);
+        }
+        ~Local() {
+            auto& r = registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.exited += rays;
+            r.live.erase(std::find(r.live.begin(), r.live.end(), this));
+        }
+    };
+
+    static Registry& registry() {
+        static Registry r;
+        return r;
+    }
+
+    static Local& local() {
+        static thread_local Local counter;
+        return counter;
+    }
+
+   public:
+    explicit RayCounter(const Hittable& world) : world_(world) {}
+
+    virtual bool Hit(const Ray& r, Real tMin, Real tMax,
+                     HitRecord& rec) const override {
+        local().rays++;
+        return world_.Hit(r, tMin, tMax, rec);
+    }
+
+    virtual bool Occluded(const Ray& r, Real tMin, Real tMax) const override {
+        local().rays++;
+        return world_.Occluded(r, tMin, tMax);
+    }
+
+    virtual bool BoundingBox(double time0, double time1,
+                             AABB& outputBox) const override {
+        return world_.BoundingBox(time0, time1, outputBox);
+    }
+
+    // ParallelFor返回时它的线程都已做完，在并行循环之间调用
+    static void Reset() {
+        auto& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.exited = 0;
+        for (auto l : r.live) l->rays = 0;
+    }
+    static uint64_t Count() {
+        auto& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        auto count = r.exited;
+        for (auto l : r.live) count += l->rays;
+        return count;
+    }
+};
+
+// 进程到目前为止的最大常驻内存，拿不到时为0
+inline uint64_t PeakRssBytes() {
+#ifndef _WIN32
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+        return usage.ru_maxrss;
+#else
+        return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+    }
+#endif
+    return 0;
+}
+
+// 参考图像存成PFM：线性的平均辐亮度，从最下面一行开始
+inline bool WriteReference(const std::string& path,
+                           const std::vector<Color>& image, int width,
+                           int height) {
+    std::ofstream out(path, std::ios::binary);
+    out << "PF\n" << width << ' ' << height << "\n-1.0\n";
+    for (int row = height - 1; row >= 0; row--) {
+        for (int i = 0; i < width; i++) {
+            const auto& c = image[static_cast<size_t>(row) * width + i];
+            float rgb[3] = {static_cast<float>(c.X()),
+                            static_cast<float>(c.Y()),
+                            static_cast<float>(c.Z())};
+            out.write(reinterpret_cast<const char*>(rgb), sizeof(rgb));
+        }
+    }
+    return static_cast<bool>(out);
+}
+
+inline bool ReadReference(const std::string& path, std::vector<Color>& image,
+                          int width, int height) {
+    std::ifstream in(path, std::ios::binary);
+    std::string magic;
+    int w = 0, h = 0;
+    double scale = 0;
+    if (!(in >> magic >> w >> h >> scale) || magic != "PF" || w != width ||
+        h != height || scale >= 0) {
+        return false;
+    }
+    in.get();
+    image.assign(static_cast<size_t>(width) * height, Color{0, 0, 0});
+    for (int row = height - 1; row >= 0; row--) {
+        for (int i = 0; i < width; i++) {
+            float rgb[3];
+            in.read(reinterpret_cast<char*>(rgb), sizeof(rgb));
+            image[static_cast<size_t>(row) * width + i] =
+                Color(rgb[0], rgb[1], rgb[2]);
+        }
+    }
+    return static_cast<bool>(in);
+}
+
+// RMSE of the displayed image, i.e. after dividing by the sample count,
+// gamma 2 and clamping to [0, 1] like WriteColor, so a few bright
+// fireflies do not dominate the error. reference is already averaged.
+inline double DisplayRmse(const std::vector<Color>& sum, int samples,
+                          const std::vector<Color>& reference) {
+    auto display = [](double c) {
+        return Clamp(std::sqrt(std::max(c, 0.0)), 0, 1);
+    };
+    auto squares = 0.0;
+    for (size_t p = 0; p < sum.size(); p++) {
+        for (int c = 0; c < 3; c++) {
+            auto d = display(sum[p][c] / samples) - display(reference[p][c]);
+            squares += d * d;
+        }
+    }
+    return std::sqrt(squares / (3 * sum.size()));
+}
+
+struct ConvergencePoint {
+    int samples;
+    double seconds;
+    double rmse;
+};
+
+struct ScalingPoint {
+    int threads;
+    double seconds;
+    // 相对于列表里第一个线程数的加速比除以线程数之比
+    double efficiency;
+};
+
+struct SceneBenchResult {
+    int scene;
+    int width, height;
+    double loadSeconds, bvhSeconds, lightTreeSeconds;
+    double traceSeconds;
+    uint64_t rays;
+    double rmse;
+    // 场景自己的内存：arena预留的字节加上图像
+    uint64_t sceneBytes;
+    // 跑完这个场景时整个进程的最大常驻内存，包括之前的场景，不是逐场景的
+    uint64_t processPeakRssBytes;
+    std::vector<ConvergencePoint> convergence;
+    std::vector<ScalingPoint> scaling;
+
+    double MRaysPerSecond() const { return rays / traceSeconds / 1e6; }
+    // 时间乘以MSE的倒数，越大越好：同样的时间误差更小，或同样的误差更快
+    double Efficiency() const { return 1 / (rmse * rmse * traceSeconds); }
+};
+
+// Renders every built-in scene through a BVH over its whole world, with the
+// integrator and settings of BenchSettings, and measures:
+//   - the time to build the scene and its BVH, and the scene's memory
+//   - trace time, rays and Mrays/s at the final sample count
+//   - RMSE against a high-spp reference after 1, 2, 4, ... samples, i.e.
+//     the time-to-quality curve, and 1 / (MSE * time) at the end. With
+//     --guide the passes of GuidingPasses() are rendered instead, and each
+//     point is the RMSE of the passes so far combined by PassCombiner
+//   - the time of the same render with each of the thread counts
+// References are rendered with MIS the first time they are needed and kept
+// as PFM files in referenceDir. They use samples from referenceFirstSample
+// on, disjoint from the measured ones: with the same sampler the measured
+// render would otherwise be a prefix of the reference, and the error would
+// come out too low.
+class SceneBenchmark {
+   private:
+    static const int referenceFirstSample = 1 << 20;
+
+    BenchSettings settings_;
+    std::vector<SceneBenchResult> results_;
+
+    using Clock = std::chrono::steady_clock;
+
+    static double seconds(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    int maxThreads() const {
+        return *std::max_element(settings_.threadCounts.begin(),
+                                 settings_.threadCounts.end());
+    }
+
+    // samples[first, first + count)加到image上
+    static void renderSamples(const ProgressiveRenderer& renderer, int width,
+                              int height, const std::string& sampler,
+                              int first, int count, int threadCount,
+                              std::vector<Color>& image) {
+        ParallelFor(height, 1, threadCount, [&](size_t begin, size_t end) {
+            auto s = MakeSampler(sampler);
+            for (auto row = begin; row < end; row++) {
+                renderer.AccumulateRow(row, first, count, *s,
+                                       &image[row * width]);
+            }
+        });
+    }
+
+    RadianceFunction radiance(const std::string& integrator,
+                              const Hittable& world, const Color& background,
+                              const LightList& lights,
+                              PathGuide* guide = nullptr) const {
+        const int maxDepth = 50;
+        // 引导的路径追踪不做直接光照采样
+        static const LightList noLights;
+        return [integrator, &world, background, &lights, guide](
+                   const Ray& r, Sampler& sampler) {
+            if (guide != nullptr) {
+                return RayColorGuided(r, background, world,
+                                      integrator == "nee" ? lights : noLights,
+                                      *guide, sampler, maxDepth);
+            }
+            if (integrator == "mis") {
+                return RayColorMIS(r, background, world, lights, sampler,
+                                   maxDepth);
+            }
+            if (integrator == "nee") {
+                return RayColorNEE(r, background, world, lights, sampler,
+                                   maxDepth);
+            }
+            return RayColor(r, background, world, maxDepth);
+        };
+    }
+
+    bool reference(int id, const Scene& scene, const Camera& camera,
+                   const Hittable& world, const LightList& lights, int width,
+                   int height, std::vector<Color>& image) const {
+        auto path = settings_.referenceDir + "/scene" + std::to_string(id) +
+                    "_" + std::to_string(width) + "x" +
+                    std::to_string(height) + "_" +
+                    std::to_string(settings_.referenceSpp) + "spp_from" +
+                    std::to_string(referenceFirstSample) + ".pfm";
+        if (ReadReference(path, image, width, height)) return true;
+
+        std::cout << "  rendering the " << settings_.referenceSpp
+                  << " spp reference " << path << std::flush;
+        auto start = Clock::now();
+        ProgressiveRenderer renderer(
+            camera, radiance("mis", world, scene.background, lights),
+            settings_.sampler, width, height, 1);
+        image.assign(static_cast<size_t>(width) * height, Color{0, 0, 0});
+        renderSamples(renderer, width, height, settings_.sampler,
+                      referenceFirstSample, settings_.referenceSpp,
+                      maxThreads(), image);
+        for (auto& c : image) c /= settings_.referenceSpp;
+        std::cout << " (" << std::fixed << std::setprecision(1)
+                  << seconds(start) << "s)\n";
+#ifdef _WIN32
+        _mkdir(settings_.referenceDir.c_str());
+#else
+        mkdir(settings_.referenceDir.c_str(), 0755);
+#endif
+        if (!WriteReference(path, image, width, height)) {
+            std::cerr << "Could not write " << path << '\n';
+            return false;
+        }
+        return true;
+    }
+
+    bool run(int id) {
+        SceneBenchResult result;
+        result.scene = id;
+
+        SceneArena arena;
+        SceneArena::Scope scope(arena);
+        MaterialTable::Scope materials;
+        auto start = Clock::now();
+        auto scene = LoadScene(id);
+        result.loadSeconds = seconds(start);
+        start = Clock::now();
+        BVHNode bvh(scene.world, 0, 1);
+        result.bvhSeconds = seconds(start);
+        LightList lights;
+        scene.world.CollectLights(lights);
+        start = Clock::now();
+        if (!settings_.uniformLights) BuildLightTree(lights);
+        result.lightTreeSeconds = seconds(start);
+
+        result.width = settings_.sceneWidth;
+        result.height = scene.ImageHeight(result.width);
+        auto width = result.width, height = result.height;
+        auto camera = scene.MakeCamera(height);
+
+        std::vector<Color> ref;
+        if (!reference(id, scene, camera, bvh, lights, width, height, ref)) {
+            return false;
+        }
+
+        std::unique_ptr<PathGuide> guide;
+        AABB bounds;
+        if (settings_.guide && bvh.BoundingBox(0, 1, bounds)) {
+            guide.reset(new PathGuide(bounds));
+        }
+        RayCounter counter(bvh);
+        ProgressiveRenderer renderer(
+            camera,
+            radiance(settings_.integrator, counter, scene.background, lights,
+                     guide.get()),
+            settings_.sampler, width, height, 1);
+
+        // 样本数每次翻倍，误差曲线上的时间是累计的渲染时间
+        std::vector<Color> image(static_cast<size_t>(width) * height,
+                                 Color{0, 0, 0});
+        RayCounter::Reset();
+        auto traceSeconds = 0.0;
+        if (guide != nullptr) {
+            // 每一遍分两半渲染，交给PassCombiner
+            PassCombiner combiner;
+            std::vector<Color> half(image.size());
+            auto done = 0;
+            auto passes = GuidingPasses(settings_.sceneSpp);
+            for (size_t pass = 0; pass < passes.size(); pass++) {
+                auto last = pass + 1 == passes.size();
+                auto n1 = passes[pass] / 2, n2 = passes[pass] - n1;
+                guide->SetTraining(!last);
+                std::fill(half.begin(), half.end(), Color{0, 0, 0});
+                std::fill(image.begin(), image.end(), Color{0, 0, 0});
+                start = Clock::now();
+                renderSamples(renderer, width, height, settings_.sampler,
+                              done, n1, maxThreads(), half);
+                renderSamples(renderer, width, height, settings_.sampler,
+                              done + n1, n2, maxThreads(), image);
+                if (!last) guide->Refine();
+                traceSeconds += seconds(start);
+                done += passes[pass];
+                if (n1 > 0) combiner.Add(half, n1, image, n2);
+                auto rmse = combiner.Empty()
+                                ? DisplayRmse(image, n2, ref)
+                                : DisplayRmse(combiner.Image(), 1, ref);
+                result.convergence.push_back(
+                    ConvergencePoint{done, traceSeconds, rmse});
+            }
+        } else {
+            for (int done = 0; done < settings_.sceneSpp;) {
+                auto count =
+                    std::min(std::max(done, 1), settings_.sceneSpp - done);
+                start = Clock::now();
+                renderSamples(renderer, width, height, settings_.sampler,
+                              done, count, maxThreads(), image);
+                traceSeconds += seconds(start);
+                done += count;
+                result.convergence.push_back(ConvergencePoint{
+                    done, traceSeconds, DisplayRmse(image, done, ref)});
+            }
+        }
+        result.traceSeconds = traceSeconds;
+        result.rays = RayCounter::Count();
+        result.rmse = result.convergence.back().rmse;
+        result.sceneBytes =
+            arena.BytesReserved() + image.size() * sizeof(Color);
+
+        if (settings_.threadCounts.size() > 1) {
+            for (auto threads : settings_.threadCounts) {
+                std::fill(image.begin(), image.end(), Color{0, 0, 0});
+                start = Clock::now();
+                renderSamples(renderer, width, height, settings_.sampler, 0,
+                              settings_.sceneSpp, threads, image);
+                auto time = seconds(start);
+                auto base = result.scaling.empty()
+                                ? ScalingPoint{threads, time, 1}
+                                : result.scaling.front();
+                result.scaling.push_back(ScalingPoint{
+                    threads, time,
+                    base.seconds * base.threads / (time * threads)});
+            }
+        }
+        result.processPeakRssBytes = PeakRssBytes();
+
+        print(result);
+        results_.push_back(result);
+        return true;
+    }
+
+    static void print(const SceneBenchResult& r) {
+        std::cout << std::fixed << "scene " << r.scene << ' ' << std::setw(4)
+                  << r.width << 'x' << std::setw(4) << std::left << r.height
+                  << std::right << std::setprecision(3) << std::setw(8)
+                  << r.loadSeconds + r.bvhSeconds + r.lightTreeSeconds
+                  << std::setw(9)
+                  << r.traceSeconds << std::setprecision(2) << std::setw(8)
+                  << r.MRaysPerSecond() << std::setprecision(4)
+                  << std::setw(9) << r.rmse << std::setprecision(0)
+                  << std::setw(11) << r.Efficiency() << std::setw(8)
+                  << r.sceneBytes / 1024 << std::setw(8)
+                  << r.processPeakRssBytes / (1024 * 1024);
+        for (const auto& s : r.scaling) {
+            std::cout << "  " << s.threads << ':' << std::setprecision(2)
+                      << s.efficiency;
+        }
+        std::cout << '\n' << std::defaultfloat;
+    }
+
+   public:
+    explicit SceneBenchmark(const BenchSettings& settings)
+        : settings_(settings) {
+        if (settings_.threadCounts.empty()) {
+            settings_.threadCounts.push_back(1);
+            if (DefaultThreadCount() > 1) {
+                settings_.threadCounts.push_back(DefaultThreadCount());
+            }
+        }
+    }
+
+    // 依次跑场景1到9，名字"scene<N>"不含filter的跳过
+    bool Run() {
+        if (settings_.integrator != "path" && settings_.integrator != "nee" &&
+            settings_.integrator != "mis") {
+            std::cerr << "Unknown integrator " << settings_.integrator << '\n';
+            return false;
+        }
+        if (settings_.guide && settings_.integrator == "mis") {
+            std::cerr << "--guide works with path and nee\n";
+            return false;
+        }
+        if (MakeSampler(settings_.sampler) == nullptr) {
+            std::cerr << "Unknown sampler " << settings_.sampler << '\n';
+            return false;
+        }
+        std::cout << settings_.integrator
+                  << (settings_.uniformLights ? " (uniform lights)" : "")
+                  << (settings_.guide ? " (guided)" : "")
+                  << ", " << settings_.sceneSpp
+                  << " spp, reference " << settings_.referenceSpp
+                  << " spp\n"
+                  << "scene   size      build    trace  Mrays/s     RMSE"
+                  << "  1/(MSE*s)  scene KB proc MB  scaling\n";
+        for (int id = 1; id <= 9; id++) {
+            auto name = "scene" + std::to_string(id);
+            if (name.find(settings_.filter) == std::string::npos) continue;
+            if (!run(id)) return false;
+        }
+        return true;
+    }
+
+    void WriteJson(std::ostream& out) const {
+        out << "{\n  \"context\": {\"compiler\": ";
+        WriteJsonString(out, CompilerVersion());
+        out << ", \"integrator\": \"" << settings_.integrator
+            << "\", \"sampler\": \"" << settings_.sampler
+            << "\", \"light_selection\": \""
+            << (settings_.uniformLights ? "uniform" : "tree")
+            << "\", \"guided\": " << (settings_.guide ? "true" : "false")
+            << ", \"width\": " << settings_.sceneWidth
+            << ", \"spp\": " << settings_.sceneSpp
+            << ", \"reference_spp\": " << settings_.referenceSpp << "},\n"
+            << "  \"scenes\": [";
+        out << std::setprecision(6);
+        for (size_t i = 0; i < results_.size(); i++) {
+            const auto& r = results_[i];
+            out << (i == 0 ? "\n" : ",\n") << "    {\"scene\": " << r.scene
+                << ", \"width\": " << r.width << ", \"height\": " << r.height
+                << ", \"load_seconds\": " << r.loadSeconds
+                << ", \"bvh_seconds\": " << r.bvhSeconds
+                << ", \"light_tree_seconds\": " << r.lightTreeSeconds
+                << ", \"trace_seconds\": " << r.traceSeconds
+                << ", \"rays\": " << r.rays
+                << ", \"mrays_per_s\": " << r.MRaysPerSecond()
+                << ", \"rmse\": " << r.rmse
+                << ", \"efficiency\": " << r.Efficiency()
+                << ", \"scene_bytes\": " << r.sceneBytes
+                << ", \"process_peak_rss_bytes\": " << r.processPeakRssBytes
+                << ",\n     \"convergence\": [";
+            for (size_t c = 0; c < r.convergence.size(); c++) {
+                const auto& p = r.convergence[c];
+                out << (c == 0 ? "" : ", ") << "{\"spp\": " << p.samples
+                    << ", \"seconds\": " << p.seconds
+                    << ", \"rmse\": " << p.rmse << "}";
+            }
+            out << "],\n     \"scaling\": [";
+            for (size_t s = 0; s < r.scaling.size(); s++) {
+                const auto& p = r.scaling[s];
+                out << (s == 0 ? "" : ", ") << "{\"threads\": " << p.threads
+                    << ", \"seconds\": " << p.seconds
+                    << ", \"efficiency\": " << p.efficiency << "}";
+            }
+            out << "]}";
+        }
+        out << "\n  ]\n}\n";
+    }
+};
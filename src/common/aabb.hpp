@@ -13,7 +13,12 @@ class AABB {
     Point3 Min() const { return minimum; }
     Point3 Max() const { return maximum; }
 
-    bool Hit(const Ray& r, double tMin, double tMax) const {
+    Real SurfaceArea() const {
+        auto d = maximum - minimum;
+        return 2 * (d.X() * d.Y() + d.Y() * d.Z() + d.Z() * d.X());
+    }
+
+    bool Hit(const Ray& r, Real tMin, Real tMax) const {
         for (int a = 0; a < 3; a++) {
             auto invD = 1.0f / r.Direction()[a];
             auto t0 = (minimum[a] - r.Origin()[a]) * invD;
@@ -22,6 +27,8 @@ class AABB {
             if (invD < 0.0f) {
                 std::swap(t0, t1);
             }
+            // 放大出口的t以覆盖舍入误差，不会漏掉恰好擦过盒子边缘的光线
+            t1 *= 1 + 2 * Gamma(3);
             tMin = t0 > tMin ? t0 : tMin;
             tMax = t1 < tMax ? t1 : tMax;
             if (tMax <= tMin) {
@@ -33,11 +40,11 @@ class AABB {
 };
 
 AABB SurroundingBox(const AABB& box0, const AABB& box1) {
-    Point3 small{fmin(box0.Min().X(), box1.Min().X()),
+    Point3 small(fmin(box0.Min().X(), box1.Min().X()),
                  fmin(box0.Min().Y(), box1.Min().Y()),
-                 fmin(box0.Min().Z(), box1.Min().Z())};
-    Point3 big{fmax(box0.Max().X(), box1.Max().X()),
+                 fmin(box0.Min().Z(), box1.Min().Z()));
+    Point3 big(fmax(box0.Max().X(), box1.Max().X()),
                fmax(box0.Max().Y(), box1.Max().Y()),
-               fmax(box0.Max().Z(), box1.Max().Z())};
+               fmax(box0.Max().Z(), box1.Max().Z()));
     return AABB{small, big};
 }
\ No newline at end of file
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <typeindex>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+// 场景对象的内存池
+// 每种类型一个池，同类对象(连同shared_ptr的控制块)在内存中连续存放，
+// 场景销毁时整块释放，而不是逐个delete
+class SceneArena {
+   private:
+    struct Pool {
+        std::vector<char*> blocks;
+        size_t offset = 0;
+        size_t blockSize = 0;
+        size_t objectCount = 0;
+        size_t bytesUsed = 0;
+    };
+
+    std::map<std::type_index, Pool> pools_;
+    size_t blockSize_;
+    size_t bytesReserved_ = 0;
+
+    static SceneArena*& current() {
+        static thread_local SceneArena* arena = nullptr;
+        return arena;
+    }
+
+   public:
+    // Installs an arena as the target of MakeShared for the current thread
+    // until the scope ends.
+    class Scope {
+       private:
+        SceneArena* previous_;
+
+       public:
+        explicit Scope(SceneArena& arena) : previous_(current()) {
+            current() = &arena;
+        }
+        ~Scope() { current() = previous_; }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    explicit SceneArena(size_t blockSize = 64 * 1024) : blockSize_(blockSize) {}
+
+    ~SceneArena() {
+        for (auto& entry : pools_) {
+            for (auto block : entry.second.blocks) {
+                delete[] block;
+            }
+        }
+    }
+
+    SceneArena(const SceneArena&) = delete;
+    SceneArena& operator=(const SceneArena&) = delete;
+
+    static SceneArena* Current() { return current(); }
+
+    void* Allocate(std::type_index type, size_t bytes, size_t alignment) {
+        auto& pool = pools_[type];
+        size_t start = (pool.offset + alignment - 1) & ~(alignment - 1);
+
+        if (pool.blocks.empty() || start + bytes > pool.blockSize) {
+            // 块大小从4KB开始倍增，只有少量对象的类型不会占用整块内存
+            pool.blockSize = pool.blocks.empty()
+                                 ? 4096
+                                 : std::min(pool.blockSize * 2, blockSize_);
+            // Oversized objects get a block of their own.
+            auto size = std::max(bytes, pool.blockSize);
+            pool.blocks.push_back(new char[size]);
+            bytesReserved_ += size;
+            start = 0;
+        }
+
+        pool.offset = start + bytes;
+        pool.objectCount++;
+        pool.bytesUsed += bytes;
+        return pool.blocks.back() + start;
+    }
+
+    size_t BytesReserved() const { return bytesReserved_; }
+
+    size_t BytesUsed() const {
+        size_t total = 0;
+        for (const auto& entry : pools_) {
+            total += entry.second.bytesUsed;
+        }
+        return total;
+    }
+
+    size_t ObjectCount() const {
+        size_t total = 0;
+        for (const auto& entry : pools_) {
+            total += entry.second.objectCount;
+        }
+        return total;
+    }
+
+    size_t PoolCount() const { return pools_.size(); }
+};
+
+// 配合std::allocate_shared使用，释放是空操作，内存由SceneArena统一回收
+template <class T>
+class ArenaAllocator {
+   public:
+    using value_type = T;
+
+    SceneArena* arena;
+
+    explicit ArenaAllocator(SceneArena* a) : arena(a) {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(
+            arena->Allocate(typeid(T), n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n) {}
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.arena == b.arena;
+}
+
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.arena != b.arena;
+}
+
+// Drop-in replacement for std::make_shared: allocates from the current
+// thread's SceneArena if one is installed, otherwise from the heap.
+template <class T, class... Args>
+std::shared_ptr<T> MakeShared(Args&&... args) {
+    auto arena = SceneArena::Current();
+    if (arena == nullptr) {
+        return std::make_shared<T>(std::forward<Args>(args)...);
+    }
+    return std::allocate_shared<T>(ArenaAllocator<T>(arena),
+                                   std::forward<Args>(args)...);
+}
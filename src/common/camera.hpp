@@ -1,6 +1,7 @@
 #pragma once
 
 #include "rtweekend.hpp"
+#include "sampler.hpp"
 
 class Camera {
    private:
@@ -12,6 +13,9 @@ class Camera {
     double lensRadius_;
     // shutter open/close times
     double time0_, time1_;
+    double viewportHeight_;
+    // 单个像素对应的光线锥张角
+    double pixelSpread_ = 0;
 
    public:
     Camera(Point3 lookfrom, Point3 lookat, Vec3 vup,
@@ -35,17 +39,40 @@ class Camera {
         lowerLeftCorner_ =
             origin_ - horizontal_ / 2 - vertical_ / 2 - focusDist * w_;
 
+        viewportHeight_ = viewportHeight;
         lensRadius_ = aperture / 2;
         time0_ = time0;
         time1_ = time1;
     }
 
+    // Sets the ray cone spread of camera rays to the angle of one pixel.
+    void SetImageHeight(int imageHeight) {
+        pixelSpread_ = viewportHeight_ / imageHeight;
+    }
+
     Ray GetRay(double s, double t) const {
         Vec3 rd = lensRadius_ * RandomInUnitDisk();
         Vec3 offset = u_ * rd.X() + v_ * rd.Y();
-        return Ray(origin_ + offset,
-                   lowerLeftCorner_ + s * horizontal_ + t * vertical_ -
-                       origin_ - offset,
-                   RandomDouble(time0_, time1_));
+        Ray r(origin_ + offset,
+              lowerLeftCorner_ + s * horizontal_ + t * vertical_ - origin_ -
+                  offset,
+              RandomDouble(time0_, time1_));
+        r.spread = pixelSpread_;
+        return r;
+    }
+
+    // 镜头上的点和快门时间取自sampler的第2～4维，像素内的位置由调用者
+    // 从第0～1维取得
+    Ray GetRay(double s, double t, Sampler& sampler) const {
+        auto lens = sampler.Get2D();
+        Vec3 rd = lensRadius_ * SampleUnitDisk(lens.x, lens.y);
+        Vec3 offset = u_ * rd.X() + v_ * rd.Y();
+        auto time = time0_ + (time1_ - time0_) * sampler.Get1D();
+        Ray r(origin_ + offset,
+              lowerLeftCorner_ + s * horizontal_ + t * vertical_ - origin_ -
+                  offset,
+              time);
+        r.spread = pixelSpread_;
+        return r;
     }
 };
\ No newline at end of file
@@ -2,22 +2,24 @@
 
 #include <iostream>
 
-#include "vec3.hpp"
+#include "rtweekend.hpp"
 
-void WriteColor(std::ostream& out, Color pixelColor, int samplesPerPixel) {
-    auto r = pixelColor.X();
-    auto g = pixelColor.Y();
-    auto b = pixelColor.Z();
+// One color component as a [0,255] value: divide by the number of samples
+// and gamma-correct for gamma=2.0.
+inline int ColorByte(double component, double scale) {
+    return static_cast<int>(255.999 *
+                            Clamp(sqrt(scale * component), 0.0, 0.999));
+}
+
+inline double Luminance(const Color& c) {
+    return 0.2126 * c.X() + 0.7152 * c.Y() + 0.0722 * c.Z();
+}
 
-    // Divide the color by the number of samples and gamma-correct for
-    // gamma=2.0.
+void WriteColor(std::ostream& out, Color pixelColor, int samplesPerPixel) {
     auto scale = 1.0 / samplesPerPixel;
-    r = sqrt(scale * r);
-    g = sqrt(scale * g);
-    b = sqrt(scale * b);
 
     // Write the translated [0,255] value of each color component.
-    out << static_cast<int>(255.999 * Clamp(r, 0.0, 0.999)) << ' '
-        << static_cast<int>(255.999 * Clamp(g, 0.0, 0.999)) << ' '
-        << static_cast<int>(255.999 * Clamp(b, 0.0, 0.999)) << '\n';
+    out << ColorByte(pixelColor.X(), scale) << ' '
+        << ColorByte(pixelColor.Y(), scale) << ' '
+        << ColorByte(pixelColor.Z(), scale) << '\n';
 }
\ No newline at end of file
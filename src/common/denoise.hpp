@@ -0,0 +1,285 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "color.hpp"
+#include "parallel.hpp"
+#include "rtweekend.hpp"
+
+// 首次命中点的特征，按输出顺序(从上到下)存放，每个像素是若干样本的平均
+struct FeatureBuffers {
+    std::vector<Color> albedo;
+    // 世界空间法线，没有命中时为0
+    std::vector<Vec3> normal;
+    // 到相机的距离，没有命中时为0
+    std::vector<double> depth;
+
+    void Resize(size_t n) {
+        albedo.assign(n, Color{0, 0, 0});
+        normal.assign(n, Vec3{0, 0, 0});
+        depth.assign(n, 0);
+    }
+};
+
+// 写出特征图：albedo按颜色做gamma校正，法线映射到[0,1]，深度按最大值归一化
+inline void WriteFeatures(const std::string& prefix,
+                          const FeatureBuffers& features, int width,
+                          int height) {
+    auto header = [&](std::ofstream& out) {
+        out << "P3\n" << width << ' ' << height << "\n255\n";
+    };
+    auto linear = [](std::ofstream& out, const Color& c) {
+        for (int k = 0; k < 3; k++) {
+            out << static_cast<int>(255.999 * Clamp(c[k], 0.0, 0.999))
+                << (k < 2 ? ' ' : '\n');
+        }
+    };
+
+    std::ofstream albedo(prefix + "_albedo.ppm");
+    header(albedo);
+    for (const auto& a : features.albedo) WriteColor(albedo, a, 1);
+
+    std::ofstream normal(prefix + "_normal.ppm");
+    header(normal);
+    for (const auto& n : features.normal) {
+        linear(normal, 0.5 * (n + Vec3{1, 1, 1}));
+    }
+
+    auto maxDepth = 0.0;
+    for (auto z : features.depth) maxDepth = std::max(maxDepth, z);
+    std::ofstream depth(prefix + "_depth.ppm");
+    header(depth);
+    for (auto z : features.depth) {
+        auto d = maxDepth > 0 ? z / maxDepth : 0;
+        linear(depth, Color(d, d, d));
+    }
+}
+
+struct DenoiseSettings {
+    // 5次迭代的滤波半径是2 * (1 + 2 + 4 + 8 + 16) = 62个像素
+    int iterations = 5;
+    // 亮度差按局部标准差的倍数衡量
+    double sigmaLuminance = 4;
+    // 法线权重是max(0, n_p·n_q)^sigmaNormal
+    double sigmaNormal = 128;
+    // 深度差按屏幕空间深度梯度的倍数衡量
+    double sigmaDepth = 1;
+    // 反照率差的平方的尺度
+    double sigmaAlbedo = 0.01;
+};
+
+// Edge-avoiding à-trous wavelet filter in the style of SVGF (Schied et
+// al. 2017). Each pass is a 5x5 B-spline kernel whose taps are 2^i pixels
+// apart, weighted by how similar the neighbour is in normal, depth (relative
+// to the local depth gradient) and luminance (relative to the local standard
+// deviation, estimated spatially and filtered along with the color). Color
+// is divided by the first-hit albedo before filtering and multiplied back
+// afterwards, so texture detail never gets blurred. Each pass runs over
+// 32x32 tiles in parallel.
+//
+// image holds per-pixel averages (not sums) in output order.
+class Denoiser {
+   private:
+    static const int tileSize = 32;
+
+    const FeatureBuffers& features_;
+    int width_, height_;
+    int threadCount_;
+    DenoiseSettings settings_;
+
+    // 归一化的平均法线
+    std::vector<Vec3> normal_;
+    std::vector<char> hit_;
+    std::vector<double> depthGradient_;
+    std::vector<Color> color_, nextColor_;
+    std::vector<double> variance_, nextVariance_;
+
+    size_t index(int x, int y) const {
+        return static_cast<size_t>(y) * width_ + x;
+    }
+
+    double depth(int x, int y) const {
+        x = std::min(std::max(x, 0), width_ - 1);
+        y = std::min(std::max(y, 0), height_ - 1);
+        return features_.depth[index(x, y)];
+    }
+
+    // 每个像素取一遍tile，body(x, y)处理一个像素
+    template <class Body>
+    void forEachPixel(const Body& body) {
+        auto tilesX = (width_ + tileSize - 1) / tileSize;
+        auto tilesY = (height_ + tileSize - 1) / tileSize;
+        auto tileCount = static_cast<size_t>(tilesX) * tilesY;
+        ParallelFor(tileCount, 1, threadCount_, [&](size_t begin, size_t end) {
+            for (auto tile = begin; tile < end; tile++) {
+                auto x0 = static_cast<int>(tile % tilesX) * tileSize;
+                auto y0 = static_cast<int>(tile / tilesX) * tileSize;
+                auto x1 = std::min(x0 + tileSize, width_);
+                auto y1 = std::min(y0 + tileSize, height_);
+                for (int y = y0; y < y1; y++) {
+                    for (int x = x0; x < x1; x++) body(x, y);
+                }
+            }
+        });
+    }
+
+    // 几何上的相似程度(法线夹角、深度差和反照率差)的对数，和亮度项加在一起
+    // 只算一次exp
+    double geometryExponent(size_t p, size_t q, double pixels) const {
+        // 没有命中的像素只和没有命中的像素混合
+        if (hit_[p] != hit_[q]) return -infinity;
+        auto exponent = 0.0;
+        if (hit_[p]) {
+            auto cosine = Dot(normal_[p], normal_[q]);
+            if (cosine <= 0) return -infinity;
+            exponent += settings_.sigmaNormal * log(cosine);
+        }
+        auto dz = fabs(features_.depth[p] - features_.depth[q]);
+        auto scale = settings_.sigmaDepth * depthGradient_[p] * pixels +
+                     1e-3 * features_.depth[p] + 1e-9;
+        // 反照率不同说明是不同的表面(比如光源和旁边的天花板)
+        auto da = (features_.albedo[p] - features_.albedo[q]).LengthSquared();
+        return exponent - dz / scale - da / settings_.sigmaAlbedo;
+    }
+
+    void prepareNormal(int x, int y) {
+        auto p = index(x, y);
+        auto length = features_.normal[p].Length();
+        hit_[p] = length > 0;
+        normal_[p] = hit_[p] ? features_.normal[p] / length : Vec3{0, 0, 0};
+    }
+
+    void estimateGradient(int x, int y) {
+        auto gx = fabs(depth(x + 1, y) - depth(x - 1, y));
+        auto gy = fabs(depth(x, y + 1) - depth(x, y - 1));
+        depthGradient_[index(x, y)] = 0.5 * fmax(gx, gy);
+    }
+
+    // 没有逐像素的样本方差，用7x7邻域内几何相似的像素估计亮度的方差
+    void estimateVariance(int x, int y) {
+        auto p = index(x, y);
+        double sum = 0, sumSquared = 0, weightSum = 0;
+        for (int qy = std::max(y - 3, 0); qy <= std::min(y + 3, height_ - 1);
+             qy++) {
+            for (int qx = std::max(x - 3, 0);
+                 qx <= std::min(x + 3, width_ - 1); qx++) {
+                auto q = index(qx, qy);
+                auto pixels = std::max(std::abs(qx - x), std::abs(qy - y));
+                auto w = exp(geometryExponent(p, q, pixels));
+                auto l = Luminance(color_[q]);
+                sum += w * l;
+                sumSquared += w * l * l;
+                weightSum += w;
+            }
+        }
+        auto mean = sum / weightSum;
+        variance_[p] = fmax(sumSquared / weightSum - mean * mean, 0.0);
+    }
+
+    // 3x3高斯模糊后的方差，让边缘停止函数更稳定
+    double blurredVariance(int x, int y) const {
+        static const double kernel[2] = {0.5, 0.25};
+        double sum = 0, weightSum = 0;
+        for (int dy = -1; dy <= 1; dy++) {
+            auto qy = y + dy;
+            if (qy < 0 || qy >= height_) continue;
+            for (int dx = -1; dx <= 1; dx++) {
+                auto qx = x + dx;
+                if (qx < 0 || qx >= width_) continue;
+                auto w = kernel[std::abs(dx)] * kernel[std::abs(dy)];
+                sum += w * variance_[index(qx, qy)];
+                weightSum += w;
+            }
+        }
+        return sum / weightSum;
+    }
+
+    void filterPixel(int x, int y, int step) {
+        static const double kernel[3] = {3.0 / 8, 1.0 / 4, 1.0 / 16};
+        auto p = index(x, y);
+        auto luminanceP = Luminance(color_[p]);
+        auto sigma =
+            settings_.sigmaLuminance * sqrt(blurredVariance(x, y)) + 1e-6;
+
+        Color sum{0, 0, 0};
+        double varianceSum = 0, weightSum = 0;
+        for (int dy = -2; dy <= 2; dy++) {
+            auto qy = y + dy * step;
+            if (qy < 0 || qy >= height_) continue;
+            for (int dx = -2; dx <= 2; dx++) {
+                auto qx = x + dx * step;
+                if (qx < 0 || qx >= width_) continue;
+                auto q = index(qx, qy);
+
+                auto pixels = step * std::max(std::abs(dx), std::abs(dy));
+                auto dl = fabs(Luminance(color_[q]) - luminanceP);
+                auto w = kernel[std::abs(dx)] * kernel[std::abs(dy)] *
+                         exp(geometryExponent(p, q, pixels) - dl / sigma);
+                sum += w * color_[q];
+                varianceSum += w * w * variance_[q];
+                weightSum += w;
+            }
+        }
+        // 中心像素的权重总是大于0
+        nextColor_[p] = sum / weightSum;
+        nextVariance_[p] = varianceSum / (weightSum * weightSum);
+    }
+
+   public:
+    Denoiser(const FeatureBuffers& features, int width, int height,
+             int threadCount,
+             const DenoiseSettings& settings = DenoiseSettings())
+        : features_(features),
+          width_(width),
+          height_(height),
+          threadCount_(threadCount),
+          settings_(settings) {}
+
+    void Run(std::vector<Color>& image) {
+        auto n = image.size();
+
+        // 去掉反照率，只对光照部分滤波；反照率接近0的分量不做除法
+        std::vector<Color> demodulate(n);
+        color_.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            for (int k = 0; k < 3; k++) {
+                auto a = features_.albedo[i][k];
+                demodulate[i][k] = a > 0.01 ? a : 1;
+                color_[i][k] = image[i][k] / demodulate[i][k];
+            }
+        }
+
+        normal_.resize(n);
+        hit_.resize(n);
+        forEachPixel([&](int x, int y) { prepareNormal(x, y); });
+        depthGradient_.resize(n);
+        forEachPixel([&](int x, int y) { estimateGradient(x, y); });
+        variance_.resize(n);
+        forEachPixel([&](int x, int y) { estimateVariance(x, y); });
+
+        nextColor_.resize(n);
+        nextVariance_.resize(n);
+        for (int pass = 0; pass < settings_.iterations; pass++) {
+            auto step = 1 << pass;
+            forEachPixel([&](int x, int y) { filterPixel(x, y, step); });
+            color_.swap(nextColor_);
+            variance_.swap(nextVariance_);
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            for (int k = 0; k < 3; k++) {
+                image[i][k] = color_[i][k] * demodulate[i][k];
+            }
+        }
+    }
+};
+
+inline void Denoise(std::vector<Color>& image, const FeatureBuffers& features,
+                    int width, int height, int threadCount,
+                    const DenoiseSettings& settings = DenoiseSettings()) {
+    Denoiser(features, width, height, threadCount, settings).Run(image);
+}
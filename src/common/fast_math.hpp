@@ -0,0 +1,178 @@
+#pragma once
+
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RTW_FAST_MATH_SSE 1
+#endif
+
+// Polynomial approximations of the libm functions on the shading hot path.
+// Each comes with the bound on its absolute error over the stated domain;
+// the benchmark checks every bound against libm before timing them. The
+// renderer only uses them when the build defines RTW_FAST_MATH, through
+// Sin(), Acos(), Atan2(), Log() and SinProduct() at the end of this file.
+
+const double fastSinMaxError = 1e-9;
+const double fastAcosMaxError = 5e-8;
+const double fastAtan2MaxError = 5e-8;
+const double fastLogMaxError = 1e-9;
+const double fastSin4MaxError = 4e-7;
+
+// 把x舍入到最近的整数，|x| < 2^51
+inline double RoundToInteger(double x) {
+    const double magic = 6755399441055744.0;  // 1.5 * 2^52
+    return (x + magic) - magic;
+}
+
+// sin(x) for |x| < 1e6. With x = k*pi + r and |r| <= pi/2, sin(x) is
+// (-1)^k sin(r). pi is split into three parts of 26 bits (Cody-Waite), so
+// k*pi is subtracted exactly; sin(r) is its Taylor polynomial of degree 13,
+// whose truncation error is below 7e-10 on [-pi/2, pi/2].
+inline double FastSin(double x) {
+    const double piA = 3.1415926218032837;
+    const double piB = 3.1786509424591713e-08;
+    const double piC = 1.2246467991473532e-16;
+    auto k = RoundToInteger(x * 0.31830988618379067154);
+    auto r = ((x - k * piA) - k * piB) - k * piC;
+    auto r2 = r * r;
+    auto p = 1.0 / 6227020800;
+    p = p * r2 - 1.0 / 39916800;
+    p = p * r2 + 1.0 / 362880;
+    p = p * r2 - 1.0 / 5040;
+    p = p * r2 + 1.0 / 120;
+    p = p * r2 - 1.0 / 6;
+    auto s = r + r * r2 * p;
+    return static_cast<int64_t>(k) & 1 ? -s : s;
+}
+
+// acos(x) for |x| <= 1: Abramowitz and Stegun 4.4.46 on [0, 1], whose own
+// error bound is 2e-8, and acos(x) = pi - acos(-x) for negative x.
+inline double FastAcos(double x) {
+    auto a = std::fabs(x);
+    auto p = -0.0012624911;
+    p = p * a + 0.0066700901;
+    p = p * a - 0.0170881256;
+    p = p * a + 0.0308918810;
+    p = p * a - 0.0501743046;
+    p = p * a + 0.0889789874;
+    p = p * a - 0.2145988016;
+    p = p * a + 1.5707963050;
+    auto r = std::sqrt(1 - a) * p;
+    return x < 0 ? 3.14159265358979323846 - r : r;
+}
+
+// atan2(y, x) with the quadrant rules of libm, also for signed zeros. The
+// smaller of |x|, |y| over the larger gives z in [0, 1], and atan(z) is
+// Abramowitz and Stegun 4.4.49 (error bound 2e-8).
+inline double FastAtan2(double y, double x) {
+    auto ax = std::fabs(x);
+    auto ay = std::fabs(y);
+    auto big = ax > ay ? ax : ay;
+    auto small = ax > ay ? ay : ax;
+    auto z = big > 0 ? small / big : 0.0;
+    auto z2 = z * z;
+    auto p = 0.0028662257;
+    p = p * z2 - 0.0161657367;
+    p = p * z2 + 0.0429096138;
+    p = p * z2 - 0.0752896400;
+    p = p * z2 + 0.1065626393;
+    p = p * z2 - 0.1420889944;
+    p = p * z2 + 0.1999355085;
+    p = p * z2 - 0.3333314528;
+    auto a = z + z * z2 * p;
+    if (ay > ax) a = 1.57079632679489661923 - a;
+    if (std::signbit(x)) a = 3.14159265358979323846 - a;
+    return std::signbit(y) ? -a : a;
+}
+
+// log(x) for normal positive x; anything else (0, subnormals, negative
+// numbers, NaN) goes to libm. x = 2^e * m with m in [sqrt(1/2), sqrt(2)),
+// and log(m) = 2 atanh(s) with s = (m - 1) / (m + 1), |s| < 0.172, whose
+// series up to s^9 is within 7e-10.
+inline double FastLog(double x) {
+    if (!(x >= DBL_MIN) || x > DBL_MAX) return std::log(x);
+    uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    auto exponent = static_cast<int>(bits >> 52) - 1023;
+    bits = (bits & 0x000fffffffffffffull) | 0x3ff0000000000000ull;
+    double m;
+    std::memcpy(&m, &bits, sizeof(m));
+    if (m > 1.41421356237309504880) {
+        m *= 0.5;
+        exponent++;
+    }
+    auto s = (m - 1) / (m + 1);
+    auto s2 = s * s;
+    auto p = 1.0 / 9;
+    p = p * s2 + 1.0 / 7;
+    p = p * s2 + 1.0 / 5;
+    p = p * s2 + 1.0 / 3;
+    auto logM = 2 * s + 2 * s * s2 * p;
+    return exponent * 0.69314718055994530942 + logM;
+}
+
+// x^5, exact up to rounding; pow() does not special-case integer powers
+inline double Pow5(double x) {
+    auto x2 = x * x;
+    return x2 * x2 * x;
+}
+
+#ifdef RTW_FAST_MATH_SSE
+// FastSin of four floats at once, for |x| < 1e5. pi is split into parts of
+// 8, 9, 9 and 24 bits so k*pi stays exact for |k| < 2^15; the polynomial
+// has degree 11. The bound is relative to sin of the float input.
+inline __m128 FastSin4(__m128 x) {
+    auto k = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.318309886f)));
+    auto kf = _mm_cvtepi32_ps(k);
+    auto r = _mm_sub_ps(x, _mm_mul_ps(kf, _mm_set1_ps(3.140625f)));
+    r = _mm_sub_ps(r, _mm_mul_ps(kf, _mm_set1_ps(0.0009670257568359375f)));
+    r = _mm_sub_ps(r, _mm_mul_ps(kf, _mm_set1_ps(6.2771141529083251953e-07f)));
+    r = _mm_sub_ps(r, _mm_mul_ps(kf, _mm_set1_ps(1.2154201256553420762e-10f)));
+    auto r2 = _mm_mul_ps(r, r);
+    auto p = _mm_set1_ps(-1.0f / 39916800);
+    p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(1.0f / 362880));
+    p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(-1.0f / 5040));
+    p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(1.0f / 120));
+    p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(-1.0f / 6));
+    auto s = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, r2), p));
+    // k为奇数时翻转符号位
+    auto sign = _mm_castsi128_ps(_mm_slli_epi32(k, 31));
+    return _mm_xor_ps(s, sign);
+}
+#endif
+
+// 热路径上用的版本，由RTW_FAST_MATH选择
+#ifdef RTW_FAST_MATH
+inline double Sin(double x) { return FastSin(x); }
+inline double Acos(double x) { return FastAcos(x); }
+inline double Atan2(double y, double x) { return FastAtan2(y, x); }
+#else
+inline double Sin(double x) { return std::sin(x); }
+inline double Acos(double x) { return std::acos(x); }
+inline double Atan2(double y, double x) { return std::atan2(y, x); }
+#endif
+
+// glibc的log比FastLog还快(见benchmark的Math/log)，所以不随RTW_FAST_MATH
+// 切换；换到libm较慢的平台时只需要改这里
+inline double Log(double x) { return std::log(x); }
+
+// sin(x) * sin(y) * sin(z), e.g. for a 3D checker pattern, which only
+// needs the sign; with RTW_FAST_MATH and SSE2 the three sines are one
+// FastSin4 call
+inline double SinProduct(double x, double y, double z) {
+#if defined(RTW_FAST_MATH) && defined(RTW_FAST_MATH_SSE)
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, FastSin4(_mm_set_ps(0, static_cast<float>(z),
+                                            static_cast<float>(y),
+                                            static_cast<float>(x))));
+    return static_cast<double>(lanes[0]) * lanes[1] * lanes[2];
+#else
+    return Sin(x) * Sin(y) * Sin(z);
+#endif
+}
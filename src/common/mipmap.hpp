@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "rtweekend.hpp"
+
+// 带mip链的RGBA8图像，每一层按8x8的tile存放
+// 一个tile是256字节，双线性插值的4个texel基本都落在同一个tile里
+class MipImage {
+   public:
+    static const int tileSize = 8;
+    static const int texelsPerTile = tileSize * tileSize;
+
+    struct Level {
+        int width, height;
+        int tilesX;
+        size_t offset;  // texel offset of the level in texels_
+    };
+
+   private:
+    std::vector<Level> levels_;
+    // texels_指向storage_，或者指向keepAlive_持有的外部内存(比如mmap的缓存文件)
+    std::vector<uint32_t> storage_;
+    std::shared_ptr<const void> keepAlive_;
+    const uint32_t* texels_ = nullptr;
+    size_t texelCount_ = 0;
+
+    static uint32_t pack(int r, int g, int b) {
+        return static_cast<uint32_t>(r) | (static_cast<uint32_t>(g) << 8) |
+               (static_cast<uint32_t>(b) << 16) | 0xff000000u;
+    }
+
+    size_t index(const Level& level, int x, int y) const {
+        auto tile = (y / tileSize) * level.tilesX + x / tileSize;
+        return level.offset + tile * texelsPerTile +
+               (y % tileSize) * tileSize + x % tileSize;
+    }
+
+    void addLevel(int width, int height) {
+        Level level;
+        level.width = width;
+        level.height = height;
+        level.tilesX = (width + tileSize - 1) / tileSize;
+        auto tilesY = (height + tileSize - 1) / tileSize;
+        level.offset = storage_.size();
+        levels_.push_back(level);
+        storage_.resize(storage_.size() +
+                        static_cast<size_t>(level.tilesX) * tilesY *
+                            texelsPerTile);
+        texels_ = storage_.data();
+        texelCount_ = storage_.size();
+    }
+
+    void set(int l, int x, int y, uint32_t texel) {
+        storage_[index(levels_[l], x, y)] = texel;
+    }
+
+   public:
+    MipImage() {}
+
+    // Builds the tiled pyramid from a tightly packed 8-bit RGB scanline
+    // image. Each level is a 2x2 box filter of the one above.
+    MipImage(const unsigned char* rgb, int width, int height) {
+        addLevel(width, height);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                auto pixel = rgb + 3 * (static_cast<size_t>(y) * width + x);
+                set(0, x, y, pack(pixel[0], pixel[1], pixel[2]));
+            }
+        }
+
+        while (width > 1 || height > 1) {
+            auto l = static_cast<int>(levels_.size());
+            auto w = std::max(1, width / 2);
+            auto h = std::max(1, height / 2);
+            addLevel(w, h);
+            for (int y = 0; y < h; y++) {
+                for (int x = 0; x < w; x++) {
+                    int sum[3] = {0, 0, 0};
+                    for (int dy = 0; dy < 2; dy++) {
+                        for (int dx = 0; dx < 2; dx++) {
+                            auto sx = std::min(2 * x + dx, width - 1);
+                            auto sy = std::min(2 * y + dy, height - 1);
+                            auto t = Texel(l - 1, sx, sy);
+                            for (int c = 0; c < 3; c++) {
+                                sum[c] += (t >> (8 * c)) & 0xff;
+                            }
+                        }
+                    }
+                    set(l, x, y,
+                        pack((sum[0] + 2) / 4, (sum[1] + 2) / 4,
+                             (sum[2] + 2) / 4));
+                }
+            }
+            width = w;
+            height = h;
+        }
+    }
+
+    // Wraps texels that live elsewhere; keepAlive owns that memory.
+    MipImage(std::vector<Level> levels, const uint32_t* texels,
+             size_t texelCount, std::shared_ptr<const void> keepAlive)
+        : levels_(std::move(levels)),
+          keepAlive_(std::move(keepAlive)),
+          texels_(texels),
+          texelCount_(texelCount) {}
+
+    // texels_ may point into storage_, so copies would dangle
+    MipImage(const MipImage&) = delete;
+    MipImage& operator=(const MipImage&) = delete;
+    MipImage(MipImage&&) = default;
+    MipImage& operator=(MipImage&&) = default;
+
+    bool Empty() const { return levels_.empty(); }
+    int Width() const { return levels_.empty() ? 0 : levels_[0].width; }
+    int Height() const { return levels_.empty() ? 0 : levels_[0].height; }
+    int LevelCount() const { return static_cast<int>(levels_.size()); }
+    const std::vector<Level>& Levels() const { return levels_; }
+    const uint32_t* Texels() const { return texels_; }
+    size_t TexelCount() const { return texelCount_; }
+
+    uint32_t Texel(int l, int x, int y) const {
+        return texels_[index(levels_[l], x, y)];
+    }
+
+    // Bilinear lookup in level l; (x, y) are in [0,1] image coordinates
+    // with y pointing down.
+    Color Bilinear(int l, double x, double y) const {
+        const auto& level = levels_[l];
+        auto fx = x * level.width - 0.5;
+        auto fy = y * level.height - 0.5;
+        auto x0 = static_cast<int>(floor(fx));
+        auto y0 = static_cast<int>(floor(fy));
+        auto tx = fx - x0;
+        auto ty = fy - y0;
+
+        auto cx0 = std::min(std::max(x0, 0), level.width - 1);
+        auto cx1 = std::min(std::max(x0 + 1, 0), level.width - 1);
+        auto cy0 = std::min(std::max(y0, 0), level.height - 1);
+        auto cy1 = std::min(std::max(y0 + 1, 0), level.height - 1);
+
+        uint32_t t[4] = {Texel(l, cx0, cy0), Texel(l, cx1, cy0),
+                         Texel(l, cx0, cy1), Texel(l, cx1, cy1)};
+        double w[4] = {(1 - tx) * (1 - ty), tx * (1 - ty), (1 - tx) * ty,
+                       tx * ty};
+
+        double c[3] = {0, 0, 0};
+        for (int i = 0; i < 4; i++) {
+            for (int k = 0; k < 3; k++) {
+                c[k] += w[i] * ((t[i] >> (8 * k)) & 0xff);
+            }
+        }
+        const auto colorScale = 1.0 / 255.0;
+        return Color(colorScale * c[0], colorScale * c[1], colorScale * c[2]);
+    }
+
+    // Trilinear lookup: footprint is the width of the lookup region in
+    // [0,1] image units, and selects the pair of levels to blend.
+    Color Trilinear(double x, double y, double footprint) const {
+        auto texels = footprint * std::max(Width(), Height());
+        if (texels <= 1) {
+            return Bilinear(0, x, y);
+        }
+
+        auto lod = std::log2(texels);
+        auto maxLevel = LevelCount() - 1;
+        if (lod >= maxLevel) {
+            return Bilinear(maxLevel, x, y);
+        }
+
+        auto l = static_cast<int>(lod);
+        auto t = lod - l;
+        return (1 - t) * Bilinear(l, x, y) + t * Bilinear(l + 1, x, y);
+    }
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "rtweekend.hpp"
+
+// 以w为z轴的正交基，用于把局部坐标系里采样的方向转到世界坐标
+class ONB {
+   public:
+    Vec3 axis[3];
+
+    ONB() {}
+    explicit ONB(const Vec3& n) { BuildFromW(n); }
+
+    Vec3 U() const { return axis[0]; }
+    Vec3 V() const { return axis[1]; }
+    Vec3 W() const { return axis[2]; }
+
+    Vec3 Local(double a, double b, double c) const {
+        return a * U() + b * V() + c * W();
+    }
+
+    Vec3 Local(const Vec3& a) const {
+        return a.X() * U() + a.Y() * V() + a.Z() * W();
+    }
+
+    void BuildFromW(const Vec3& n) {
+        axis[2] = UnitVector(n);
+        Vec3 a = (fabs(W().X()) > 0.9) ? Vec3(0, 1, 0) : Vec3(1, 0, 0);
+        axis[1] = UnitVector(Cross(W(), a));
+        axis[0] = Cross(W(), V());
+    }
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+inline int DefaultThreadCount() {
+    auto n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : static_cast<int>(n);
+}
+
+// Worker threads shared by every ParallelFor of the process, so that a
+// parallel loop (one stage of a wavefront bounce, say) does not pay for
+// starting and joining threads. Threads are started the first time a loop
+// asks for them and then wait for the next loop; they never exit, so
+// thread-local state lives as long as the process.
+class WorkerPool {
+   private:
+    struct Loop {
+        const std::function<void()>* work;
+        // 还可以加入的工作线程数和正在运行work的线程数
+        int helpersWanted;
+        int running;
+    };
+
+    std::mutex mutex_;
+    std::condition_variable loopReady_, loopDone_;
+    std::deque<Loop*> loops_;
+    std::vector<std::thread> threads_;
+
+    WorkerPool() {}
+
+    void workerMain() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            loopReady_.wait(lock, [&]() { return !loops_.empty(); });
+            auto loop = loops_.front();
+            if (--loop->helpersWanted == 0) loops_.pop_front();
+            loop->running++;
+            lock.unlock();
+            (*loop->work)();
+            lock.lock();
+            if (--loop->running == 0) loopDone_.notify_all();
+        }
+    }
+
+   public:
+    // 故意不析构：工作线程一直在等待，进程退出时直接结束。这样线程局部的
+    // 统计也不会在别的静态对象析构之后才合并
+    static WorkerPool& Instance() {
+        static auto pool = new WorkerPool;
+        return *pool;
+    }
+
+    // Runs work on the calling thread and on up to helpers pool threads at
+    // once, and returns when all of them have returned. work must stop by
+    // itself once there is nothing left to do, as ParallelFor's does.
+    void Run(int helpers, const std::function<void()>& work) {
+        Loop loop{&work, helpers, 0};
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            while (static_cast<int>(threads_.size()) < helpers) {
+                threads_.emplace_back(&WorkerPool::workerMain, this);
+            }
+            loops_.push_back(&loop);
+        }
+        loopReady_.notify_all();
+        work();
+
+        // 调用线程做完时所有块都已经领走，还没来的工作线程不再需要
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto queued = std::find(loops_.begin(), loops_.end(), &loop);
+        if (queued != loops_.end()) loops_.erase(queued);
+        loopDone_.wait(lock, [&]() { return loop.running == 0; });
+    }
+};
+
+// 把[0, count)切成grain大小的块，由threadCount个线程动态领取
+// body(begin, end)处理一个块，调用线程自己也参与工作，其余线程来自
+// WorkerPool
+template <class Body>
+void ParallelFor(size_t count, size_t grain, int threadCount,
+                 const Body& body) {
+    if (count == 0) return;
+    grain = std::max<size_t>(grain, 1);
+    auto chunks = (count + grain - 1) / grain;
+    auto workers = std::min<size_t>(std::max(threadCount, 1), chunks);
+
+    if (workers <= 1) {
+        body(size_t(0), count);
+        return;
+    }
+
+    std::atomic<size_t> next{0};
+    std::function<void()> work = [&]() {
+        while (true) {
+            auto chunk = next++;
+            if (chunk >= chunks) return;
+            auto begin = chunk * grain;
+            body(begin, std::min(begin + grain, count));
+        }
+    };
+    WorkerPool::Instance().Run(static_cast<int>(workers) - 1, work);
+}
@@ -1,83 +1,145 @@
 #pragma once
 
+#include <random>
+
 #include "rtweekend.hpp"
 
-class Perlin {
-   private:
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RTW_PERLIN_SSE 1
+#endif
+
+// 所有Perlin实例共用的梯度和置换表，单精度，梯度按分量分开存放
+struct PerlinTables {
     static const int pointCount = 256;
-    Vec3* ranvec;
-    int* permX;
-    int* permY;
-    int* permZ;
-
-    static int* perlinGeneratePerm() {
-        auto p = new int[pointCount];
-        for (int i = 0; i < Perlin::pointCount; i++) {
-            p[i] = i;
-        }
-        permute(p, pointCount);
-        return p;
+
+    float gradX[pointCount];
+    float gradY[pointCount];
+    float gradZ[pointCount];
+    unsigned char permX[pointCount];
+    unsigned char permY[pointCount];
+    unsigned char permZ[pointCount];
+
+    static const PerlinTables& Get() {
+        static const PerlinTables tables;
+        return tables;
     }
 
-    static void permute(int* p, int n) {
-        for (int i = n - 1; i > 0; i--) {
-            int target = RandomInt(0, i);
-            std::swap(p[i], p[target]);
+   private:
+    PerlinTables() {
+        // 使用独立的固定种子生成器，不影响场景的随机序列
+        std::mt19937 generator(20211015);
+        std::uniform_real_distribution<double> distribution(-1.0, 1.0);
+
+        for (int i = 0; i < pointCount; i++) {
+            Vec3 g;
+            do {
+                g = Vec3(distribution(generator), distribution(generator),
+                         distribution(generator));
+            } while (g.LengthSquared() < 1e-6);
+            g = UnitVector(g);
+            gradX[i] = static_cast<float>(g.X());
+            gradY[i] = static_cast<float>(g.Y());
+            gradZ[i] = static_cast<float>(g.Z());
         }
-    }
 
-    static double perlinInterp(Vec3 c[2][2][2], double u, double v, double w) {
-        auto uu = u * u * (3 - 2 * u);
-        auto vv = v * v * (3 - 2 * v);
-        auto ww = w * w * (3 - 2 * w);
-        auto accum = 0.0;
-        for (int i = 0; i < 2; i++)
-            for (int j = 0; j < 2; j++)
-                for (int k = 0; k < 2; k++) {
-                    Vec3 weight_v{u - i, v - j, w - k};
-                    accum += (i * uu + (1 - i) * (1 - uu)) *
-                             (j * vv + (1 - j) * (1 - vv)) *
-                             (k * ww + (1 - k) * (1 - ww)) *
-                             Dot(c[i][j][k], weight_v);
-                }
-        return accum;
+        generatePerm(permX, generator);
+        generatePerm(permY, generator);
+        generatePerm(permZ, generator);
     }
 
-   public:
-    Perlin() {
-        ranvec = new Vec3[pointCount];
-        for (int i = 0; i < pointCount; ++i) {
-            ranvec[i] = UnitVector(Vec3::Random(-1, 1));
+    static void generatePerm(unsigned char* p, std::mt19937& generator) {
+        for (int i = 0; i < pointCount; i++) {
+            p[i] = static_cast<unsigned char>(i);
+        }
+        for (int i = pointCount - 1; i > 0; i--) {
+            std::uniform_int_distribution<int> target(0, i);
+            std::swap(p[i], p[target(generator)]);
         }
-
-        permX = perlinGeneratePerm();
-        permY = perlinGeneratePerm();
-        permZ = perlinGeneratePerm();
     }
+};
 
-    ~Perlin() {
-        delete[] ranvec;
-        delete[] permX;
-        delete[] permY;
-        delete[] permZ;
+class Perlin {
+   private:
+    const PerlinTables* tables_;
+
+    // 没有SSE4.1时floor是函数调用
+    static int fastFloor(double x) {
+        auto i = static_cast<int>(x);
+        return x < i ? i - 1 : i;
     }
 
-    double Noise(const Point3& p) const {
-        auto u = p.X() - floor(p.X());
-        auto v = p.Y() - floor(p.Y());
-        auto w = p.Z() - floor(p.Z());
-
-        auto i = static_cast<int>(floor(p.X()));
-        auto j = static_cast<int>(floor(p.Y()));
-        auto k = static_cast<int>(floor(p.Z()));
-        Vec3 c[2][2][2];
+    // 8个角点的梯度按(di, dj, dk) = 4 * di + 2 * dj + dk的顺序排列
+    void gatherCorners(int i, int j, int k, float gx[8], float gy[8],
+                       float gz[8]) const {
+        const auto& t = *tables_;
         for (int di = 0; di < 2; di++)
             for (int dj = 0; dj < 2; dj++)
-                for (int dk = 0; dk < 2; dk++)
-                    c[di][dj][dk] =
-                        ranvec[permX[(i + di) & 255] ^ permY[(j + dj) & 255] ^
-                               permZ[(k + dk) & 255]];
-        return perlinInterp(c, u, v, w);
+                for (int dk = 0; dk < 2; dk++) {
+                    auto g = t.permX[(i + di) & 255] ^ t.permY[(j + dj) & 255] ^
+                             t.permZ[(k + dk) & 255];
+                    auto lane = 4 * di + 2 * dj + dk;
+                    gx[lane] = t.gradX[g];
+                    gy[lane] = t.gradY[g];
+                    gz[lane] = t.gradZ[g];
+                }
+    }
+
+   public:
+    Perlin() : tables_(&PerlinTables::Get()) {}
+
+    double Noise(const Point3& p) const {
+        auto i = fastFloor(p.X());
+        auto j = fastFloor(p.Y());
+        auto k = fastFloor(p.Z());
+        auto u = static_cast<float>(p.X() - i);
+        auto v = static_cast<float>(p.Y() - j);
+        auto w = static_cast<float>(p.Z() - k);
+
+        alignas(16) float gx[8], gy[8], gz[8];
+        gatherCorners(i, j, k, gx, gy, gz);
+
+        // Hermitian smoothing
+        auto uu = u * u * (3 - 2 * u);
+        auto vv = v * v * (3 - 2 * v);
+        auto ww = w * w * (3 - 2 * w);
+
+#ifdef RTW_PERLIN_SSE
+        // 一次处理4个角点：di固定，(dj, dk)依次为00, 01, 10, 11
+        const __m128 dj = _mm_set_ps(1, 1, 0, 0);
+        const __m128 dk = _mm_set_ps(1, 0, 1, 0);
+        auto vy = _mm_sub_ps(_mm_set1_ps(v), dj);
+        auto vz = _mm_sub_ps(_mm_set1_ps(w), dk);
+        auto wy = _mm_set_ps(vv, vv, 1 - vv, 1 - vv);
+        auto wz = _mm_set_ps(ww, 1 - ww, ww, 1 - ww);
+        auto wyz = _mm_mul_ps(wy, wz);
+
+        __m128 accum = _mm_setzero_ps();
+        for (int di = 0; di < 2; di++) {
+            auto vx = _mm_sub_ps(_mm_set1_ps(u), _mm_set1_ps(float(di)));
+            auto dot = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(_mm_load_ps(gx + 4 * di), vx),
+                           _mm_mul_ps(_mm_load_ps(gy + 4 * di), vy)),
+                _mm_mul_ps(_mm_load_ps(gz + 4 * di), vz));
+            auto wx = _mm_set1_ps(di ? uu : 1 - uu);
+            accum = _mm_add_ps(accum, _mm_mul_ps(_mm_mul_ps(wx, wyz), dot));
+        }
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, accum);
+        return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#else
+        float accum = 0;
+        for (int lane = 0; lane < 8; lane++) {
+            int di = lane >> 2, dj = (lane >> 1) & 1, dk = lane & 1;
+            auto weight = (di ? uu : 1 - uu) * (dj ? vv : 1 - vv) *
+                          (dk ? ww : 1 - ww);
+            accum += weight *
+                     (gx[lane] * (u - di) + gy[lane] * (v - dj) +
+                      gz[lane] * (w - dk));
+        }
+        return accum;
+#endif
     }
 
     double Turb(const Point3& p, int depth = 7) const {
@@ -92,4 +154,4 @@ class Perlin {
         }
         return fabs(accum);
     }
-};
\ No newline at end of file
+};
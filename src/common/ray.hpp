@@ -6,15 +6,36 @@ class Ray {
    public:
     Point3 origin;
     Vec3 dir;
-    double time;
+    Real time;
+    // 光线锥：起点处的宽度和每单位距离的扩张量，用于估计纹理查询的范围
+    Real width = 0;
+    Real spread = 0;
 
     Ray() {}
-    Ray(const Point3& origin, const Vec3& dir, double tm = 0.0)
+    Ray(const Point3& origin, const Vec3& dir, Real tm = 0.0)
         : origin(origin), dir(dir), time(tm) {}
 
     Point3 Origin() const { return origin; }
     Vec3 Direction() const { return dir; }
-    double Time() const { return time; }
+    Real Time() const { return time; }
 
-    Point3 at(double t) const { return origin + t * dir; }
-};
\ No newline at end of file
+    Point3 at(Real t) const { return origin + t * dir; }
+};
+
+// Origin for a ray leaving a surface point p in direction w. p is only
+// known to lie within pError (per component) of the true surface, so it is
+// pushed along the normal n, to the side w points to, by the projection of
+// that error box onto n. The offset also covers the rounding of p + offset
+// itself (at least one ulp of p), so the new origin is strictly off the
+// surface. A ray starting there cannot hit the surface it leaves at t > 0,
+// at any scene scale, so tracing can start at t = 0 instead of at a fixed
+// epsilon.
+inline Point3 OffsetRayOrigin(const Point3& p, const Vec3& pError,
+                              const Vec3& n, const Vec3& w) {
+    // 分量为0时(比如y = 0的地面)相对误差也是0，这时用一个很小的绝对偏移，
+    // 而不是推到非规格化数上：非规格化数参与运算非常慢
+    auto d = Dot(Abs(n), pError + Gamma(2) * Abs(p)) + machineEpsilon;
+    Vec3 offset = d * n;
+    if (Dot(w, n) < 0) offset = -offset;
+    return p + offset;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "color.hpp"
+
+// Writes the rows of a P3 image from its own thread, so the render threads
+// never wait for formatting or disk I/O. Rows can be submitted in any
+// order but are written top to bottom. Submit blocks while a row is more
+// than `window` rows ahead of the writer, which bounds the memory of the
+// whole image to about window + render threads rows. The row the writer
+// waits for is always allowed in, so as long as rows are handed out in
+// order (ParallelFor does) this cannot deadlock.
+class RowWriter {
+   private:
+    std::ostream& out_;
+    int width_, height_;
+    int samplesPerPixel_;
+    size_t window_;
+
+    std::mutex mutex_;
+    std::condition_variable rowReady_;
+    std::condition_variable rowWritten_;
+    std::map<size_t, std::vector<Color>> pending_;
+    // 写线程正在等待或正在写的行
+    size_t next_ = 0;
+    std::thread thread_;
+
+    // 和WriteColor的输出相同。整行拼成一个字符串再写出，比逐个<<整数
+    // 快得多，在很大的图像上格式化本身就是可观的开销
+    void formatRow(const std::vector<Color>& pixels, std::string& text) const {
+        static const auto numbers = []() {
+            std::vector<std::string> numbers(256);
+            for (int n = 0; n < 256; n++) numbers[n] = std::to_string(n);
+            return numbers;
+        }();
+        auto scale = 1.0 / samplesPerPixel_;
+        text.clear();
+        for (const auto& pixelColor : pixels) {
+            text += numbers[ColorByte(pixelColor.X(), scale)];
+            text += ' ';
+            text += numbers[ColorByte(pixelColor.Y(), scale)];
+            text += ' ';
+            text += numbers[ColorByte(pixelColor.Z(), scale)];
+            text += '\n';
+        }
+    }
+
+    void run() {
+        std::string text;
+        out_ << "P3\n" << width_ << ' ' << height_ << "\n255\n";
+        for (size_t row = 0; row < static_cast<size_t>(height_); row++) {
+            std::vector<Color> pixels;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                rowReady_.wait(lock, [&]() { return pending_.count(row); });
+                pixels.swap(pending_[row]);
+                pending_.erase(row);
+            }
+            std::cerr << "\rScanlines remaining: " << height_ - 1 - row << ' '
+                      << std::flush;
+            formatRow(pixels, text);
+            out_.write(text.data(), text.size());
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                next_ = row + 1;
+            }
+            rowWritten_.notify_all();
+        }
+        out_.flush();
+        std::cerr << "\n";
+    }
+
+   public:
+    RowWriter(std::ostream& out, int width, int height, int samplesPerPixel,
+              size_t window)
+        : out_(out),
+          width_(width),
+          height_(height),
+          samplesPerPixel_(samplesPerPixel),
+          window_(std::max<size_t>(window, 1)),
+          thread_(&RowWriter::run, this) {}
+
+    ~RowWriter() { Finish(); }
+
+    // row从0(最上面一行)开始，pixels是这一行所有样本的和
+    void Submit(size_t row, std::vector<Color>&& pixels) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            rowWritten_.wait(lock, [&]() { return row < next_ + window_; });
+            pending_[row] = std::move(pixels);
+        }
+        rowReady_.notify_one();
+    }
+
+    // 等所有行写完；之后可以检查输出流的状态
+    void Finish() {
+        if (thread_.joinable()) thread_.join();
+    }
+};
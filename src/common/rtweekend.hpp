@@ -1,14 +1,32 @@
 #pragma once
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <limits>
 #include <memory>
 #include <random>
 
+// 几何计算(Vec3、Ray、AABB、求交)使用的浮点类型，用RTW_USE_FLOAT切换到单精度
+#ifdef RTW_USE_FLOAT
+using Real = float;
+#else
+using Real = double;
+#endif
+
 // Constants
 
-const double infinity = std::numeric_limits<double>::infinity();
+const Real infinity = std::numeric_limits<Real>::infinity();
 const double pi = 3.1415926535897932385;
+// 小于1的最大的double，重新缩放后的随机数不能到达1
+const double oneMinusEpsilon = 1 - std::numeric_limits<double>::epsilon() / 2;
+
+// Bound on the relative rounding error of one Real operation, and of a
+// chain of n of them: (1 + e)^n - 1 <= n * e / (1 - n * e).
+constexpr Real machineEpsilon = std::numeric_limits<Real>::epsilon() * 0.5;
+
+constexpr Real Gamma(int n) {
+    return n * machineEpsilon / (1 - n * machineEpsilon);
+}
 
 // Utility Functions
 
@@ -16,11 +34,41 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
+// SplitMix64：状态只有64位，设种子没有开销，可以每个样本设一次
+class RandomEngine {
+   public:
+    using result_type = uint64_t;
+
+    explicit RandomEngine(uint64_t seed = 0) : state_(seed) {}
+    void Seed(uint64_t seed) { state_ = seed; }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return ~result_type(0); }
+
+    result_type operator()() {
+        auto z = (state_ += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+   private:
+    uint64_t state_;
+};
+
+inline RandomEngine& RandomGenerator() {
+    static thread_local RandomEngine generator;
+    return generator;
+}
+
+// Restarts the calling thread's random numbers from seed. Renderers call
+// it per pixel sample (or per path and bounce), so what a pixel gets does
+// not depend on which thread renders it or what that thread did before.
+inline void SeedRandom(uint64_t seed) { RandomGenerator().Seed(seed); }
+
 inline double RandomDouble() {
     // Returns a random real in [0,1).
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
-    return distribution(generator);
+    return (RandomGenerator()() >> 11) * (1.0 / 9007199254740992.0);
 }
 
 inline double RandomDouble(double min, double max) {
@@ -40,5 +88,6 @@ inline double Clamp(double x, double min, double max) {
 }
 
 // Common Headers
+#include "arena.hpp"
 #include "ray.hpp"
 #include "vec3.hpp"
\ No newline at end of file
@@ -0,0 +1,355 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rtweekend.hpp"
+
+struct Point2 {
+    double x, y;
+};
+
+// 32位整数的哈希(lowbias32)
+inline uint32_t HashUInt(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+inline uint32_t HashCombine(uint32_t seed, uint32_t v) {
+    return HashUInt(seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+inline uint32_t ReverseBits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// 把32位定点数转成[0,1)的double
+inline double UIntToUnit(uint32_t x) { return x * (1.0 / 4294967296.0); }
+
+// Hash-based Owen scrambling (Burley 2020): a random permutation of the
+// binary digits in which each bit is flipped depending on all higher bits.
+inline uint32_t OwenScramble(uint32_t x, uint32_t seed) {
+    x = ReverseBits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return ReverseBits(x);
+}
+
+// 前两维Sobol序列：第0维是van der Corput，第1维的生成矩阵是Pascal矩阵
+inline uint32_t Sobol(uint32_t index, int dimension) {
+    if (dimension == 0) return ReverseBits(index);
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+        if (index & 1) result ^= v;
+    }
+    return result;
+}
+
+// Source of the random numbers for one camera sample. Every sample uses
+// the same dimension layout, so that dimension d is always drawn for the
+// same decision: the pixel jitter, lens and shutter time come first, then
+// every bounce starts at a fixed offset (NextBounce()) and draws the
+// material sample, followed by the light selection and light point, and
+// with path guiding the choice between the material and the guide and
+// the guided direction.
+class Sampler {
+   public:
+    // pixel (2) + lens (2) + time (1)
+    static const int cameraDimensions = 5;
+    // material (2 + 1) + light selection (1) + light point (2) +
+    // guiding (1 + 2)
+    static const int bounceDimensions = 9;
+
+    virtual ~Sampler() {}
+
+    void StartPixelSample(int x, int y, int sampleIndex) {
+        x_ = x;
+        y_ = y;
+        pixelSeed_ = HashCombine(HashUInt(static_cast<uint32_t>(x)),
+                                 static_cast<uint32_t>(y));
+        index_ = static_cast<uint32_t>(sampleIndex);
+        dimension_ = 0;
+        bounce_ = 0;
+        // 材质和介质直接用RandomDouble()，也让它们只取决于这个样本
+        SeedRandom(static_cast<uint64_t>(pixelSeed_) << 32 | index_);
+    }
+
+    void NextBounce() {
+        dimension_ = cameraDimensions + bounceDimensions * bounce_++;
+    }
+
+    double Get1D() { return generate1D(dimension_++); }
+
+    Point2 Get2D() {
+        auto p = generate2D(dimension_);
+        dimension_ += 2;
+        return p;
+    }
+
+   protected:
+    int x_ = 0, y_ = 0;
+    uint32_t pixelSeed_ = 0;
+    uint32_t index_ = 0;
+
+    virtual double generate1D(int dimension) = 0;
+    virtual Point2 generate2D(int dimension) = 0;
+
+   private:
+    int dimension_ = 0;
+    int bounce_ = 0;
+};
+
+// 原来的做法：每个维度都是独立的伪随机数
+class IndependentSampler : public Sampler {
+   protected:
+    virtual double generate1D(int dimension) override {
+        return RandomDouble();
+    }
+    virtual Point2 generate2D(int dimension) override {
+        auto x = RandomDouble();
+        return Point2{x, RandomDouble()};
+    }
+};
+
+// Owen-scrambled Sobol points with padding: every 1D or 2D dimension is
+// drawn from the first one or two Sobol dimensions, which are well
+// distributed in any power-of-two prefix, with the sample order shuffled
+// and the digits scrambled independently per pixel and per dimension.
+class SobolSampler : public Sampler {
+   protected:
+    uint32_t dimensionSeed(int dimension) const {
+        return HashCombine(pixelSeed_, static_cast<uint32_t>(dimension));
+    }
+
+    // 打乱样本的顺序，不同维度之间不再相关
+    uint32_t shuffledIndex(uint32_t seed) const {
+        return OwenScramble(index_, HashCombine(seed, 0x5bd1e995u));
+    }
+
+    virtual double generate1D(int dimension) override {
+        auto seed = dimensionSeed(dimension);
+        auto i = shuffledIndex(seed);
+        return UIntToUnit(OwenScramble(Sobol(i, 0), HashCombine(seed, 1)));
+    }
+
+    virtual Point2 generate2D(int dimension) override {
+        auto seed = dimensionSeed(dimension);
+        auto i = shuffledIndex(seed);
+        return Point2{
+            UIntToUnit(OwenScramble(Sobol(i, 0), HashCombine(seed, 1))),
+            UIntToUnit(OwenScramble(Sobol(i, 1), HashCombine(seed, 2)))};
+    }
+};
+
+// Halton sequence, one prime base per dimension, with the digits of each
+// dimension linearly scrambled per pixel (Matoušek: digit d of position j
+// becomes a_j * d + b_j mod base). This decorrelates neighbouring pixels
+// and breaks up the correlation between dimensions with large bases.
+// Dimensions past the prime table reuse its bases with a different
+// scramble.
+class HaltonSampler : public Sampler {
+   private:
+    static int prime(int n) {
+        static const int primes[] = {
+            2,   3,   5,   7,   11,  13,  17,  19,  23,  29,  31,  37,  41,
+            43,  47,  53,  59,  61,  67,  71,  73,  79,  83,  89,  97,  101,
+            103, 107, 109, 113, 127, 131, 137, 139, 149, 151, 157, 163, 167,
+            173, 179, 181, 191, 193, 197, 199, 211, 223, 227, 229, 233, 239,
+            241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311};
+        const int count = sizeof(primes) / sizeof(primes[0]);
+        return primes[n % count];
+    }
+
+    // 每一位数字做一次随机的线性置换(模base)，置换只取决于位数
+    double scrambledRadicalInverse(int dimension) const {
+        auto base = static_cast<uint32_t>(prime(dimension));
+        auto seed = HashCombine(pixelSeed_, static_cast<uint32_t>(dimension));
+        auto invBase = 1.0 / base;
+        auto factor = invBase;
+        auto index = index_;
+        auto result = 0.0;
+        for (uint32_t digit = 0; factor > 1e-10; digit++) {
+            auto d = index % base;
+            index /= base;
+            auto h = HashCombine(seed, digit);
+            auto scale = 1 + (h >> 16) % (base - 1);
+            auto shift = (h & 0xffff) % base;
+            result += ((scale * d + shift) % base) * factor;
+            factor *= invBase;
+        }
+        return fmin(result, 1 - 1e-12);
+    }
+
+   protected:
+    virtual double generate1D(int dimension) override {
+        return scrambledRadicalInverse(dimension);
+    }
+
+    virtual Point2 generate2D(int dimension) override {
+        return Point2{scrambledRadicalInverse(dimension),
+                      scrambledRadicalInverse(dimension + 1)};
+    }
+};
+
+// 64x64的蓝噪声阈值图(void-and-cluster)，每个值是[0, 4096)的排名
+class BlueNoiseMask {
+   public:
+    static const int size = 64;
+    static const int count = size * size;
+
+    static const BlueNoiseMask& Get() {
+        static const BlueNoiseMask mask;
+        return mask;
+    }
+
+    // 像素(x, y)的阈值，落在(0, 1)内
+    double Value(int x, int y) const {
+        auto i = (y & (size - 1)) * size + (x & (size - 1));
+        return (rank_[i] + 0.5) / count;
+    }
+
+   private:
+    std::vector<int> rank_;
+    // 环绕距离对应的高斯能量
+    std::vector<double> kernel_;
+    std::vector<double> energy_;
+    std::vector<char> pattern_;
+
+    void toggle(int i, bool on) {
+        pattern_[i] = on;
+        auto sign = on ? 1.0 : -1.0;
+        auto x = i % size, y = i / size;
+        for (int j = 0; j < count; j++) {
+            auto dx = (j % size - x) & (size - 1);
+            auto dy = (j / size - y) & (size - 1);
+            energy_[j] += sign * kernel_[dy * size + dx];
+        }
+    }
+
+    // 能量最高的1(最紧的簇)或者能量最低的0(最大的空洞)
+    int extreme(bool ones) const {
+        int best = -1;
+        for (int i = 0; i < count; i++) {
+            if (pattern_[i] != ones) continue;
+            if (best < 0 || (ones ? energy_[i] > energy_[best]
+                                  : energy_[i] < energy_[best])) {
+                best = i;
+            }
+        }
+        return best;
+    }
+
+    BlueNoiseMask()
+        : rank_(count), kernel_(count), energy_(count), pattern_(count) {
+        const double sigma = 1.5;
+        for (int dy = 0; dy < size; dy++) {
+            for (int dx = 0; dx < size; dx++) {
+                auto ex = std::min(dx, size - dx);
+                auto ey = std::min(dy, size - dy);
+                kernel_[dy * size + dx] =
+                    exp(-(ex * ex + ey * ey) / (2 * sigma * sigma));
+            }
+        }
+
+        // 初始图案：固定种子随机选出约1/10的点，再反复把最紧的簇
+        // 移到最大的空洞，直到稳定
+        std::mt19937 generator(20211114);
+        const int initialOnes = count / 10;
+        for (int placed = 0; placed < initialOnes;) {
+            auto i = static_cast<int>(generator() % count);
+            if (pattern_[i]) continue;
+            toggle(i, true);
+            placed++;
+        }
+        for (int iteration = 0; iteration < count; iteration++) {
+            auto cluster = extreme(true);
+            toggle(cluster, false);
+            auto hole = extreme(false);
+            toggle(hole, true);
+            if (hole == cluster) break;
+        }
+        auto initial = pattern_;
+        auto initialEnergy = energy_;
+
+        // 阶段1：依次去掉最紧的簇，排名从initialOnes - 1往下
+        for (int r = initialOnes - 1; r >= 0; r--) {
+            auto cluster = extreme(true);
+            toggle(cluster, false);
+            rank_[cluster] = r;
+        }
+
+        // 阶段2和3：从初始图案出发依次填最大的空洞
+        pattern_ = initial;
+        energy_ = initialEnergy;
+        for (int r = initialOnes; r < count; r++) {
+            auto hole = extreme(false);
+            toggle(hole, true);
+            rank_[hole] = r;
+        }
+    }
+};
+
+// Owen-scrambled Sobol points shared by all pixels (scrambled per
+// dimension only), each pixel shifted toroidally by a blue-noise mask
+// value (Georgiev and Fajardo 2016). The error of neighbouring pixels is
+// then negatively correlated, so what noise remains is high-frequency and
+// looks finer at the same RMSE. Each dimension offsets the mask so that
+// dimensions stay decorrelated.
+class BlueNoiseSampler : public SobolSampler {
+   private:
+    double shift(int dimension) const {
+        auto h = HashUInt(static_cast<uint32_t>(dimension) + 0x68bc21ebu);
+        return BlueNoiseMask::Get().Value(x_ + static_cast<int>(h & 63),
+                                          y_ + static_cast<int>(h >> 6 & 63));
+    }
+
+    static double wrap(double x) { return x >= 1 ? x - 1 : x; }
+
+    uint32_t sharedSeed(int dimension) const {
+        return HashUInt(static_cast<uint32_t>(dimension) * 0x9e3779b9u + 1);
+    }
+
+   protected:
+    virtual double generate1D(int dimension) override {
+        auto seed = sharedSeed(dimension);
+        auto i = OwenScramble(index_, HashCombine(seed, 0x5bd1e995u));
+        auto x = UIntToUnit(OwenScramble(Sobol(i, 0), HashCombine(seed, 1)));
+        return wrap(x + shift(dimension));
+    }
+
+    virtual Point2 generate2D(int dimension) override {
+        auto seed = sharedSeed(dimension);
+        auto i = OwenScramble(index_, HashCombine(seed, 0x5bd1e995u));
+        auto x = UIntToUnit(OwenScramble(Sobol(i, 0), HashCombine(seed, 1)));
+        auto y = UIntToUnit(OwenScramble(Sobol(i, 1), HashCombine(seed, 2)));
+        return Point2{wrap(x + shift(dimension)),
+                      wrap(y + shift(dimension + 1))};
+    }
+};
+
+// 按名字创建采样器，名字未知时返回空
+inline std::unique_ptr<Sampler> MakeSampler(const std::string& name) {
+    if (name == "independent") {
+        return std::unique_ptr<Sampler>(new IndependentSampler());
+    }
+    if (name == "sobol") return std::unique_ptr<Sampler>(new SobolSampler());
+    if (name == "halton") return std::unique_ptr<Sampler>(new HaltonSampler());
+    if (name == "bluenoise") {
+        return std::unique_ptr<Sampler>(new BlueNoiseSampler());
+    }
+    return nullptr;
+}
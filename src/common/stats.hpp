@@ -0,0 +1,183 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+// 求交统计按图元类型分开计数
+enum class PrimitiveType : unsigned char {
+    Sphere,
+    MovingSphere,
+    Rect,
+    Medium,
+    Count
+};
+
+// Counters of one thread, or the sum over all threads. Depth is counted the
+// way the integrators count it: the number of bounces a ray still has left.
+struct TraceStats {
+    static const int maxDepth = 64;
+    static const int primitiveTypes = static_cast<int>(PrimitiveType::Count);
+
+    uint64_t raysByDepth[maxDepth + 1] = {};
+    uint64_t shadowRays = 0;
+    uint64_t bvhNodes = 0;
+    uint64_t primitiveTests[primitiveTypes] = {};
+    uint64_t mediumScatters = 0;
+    uint64_t depthTerminated = 0;
+    // 访问的BVH节点数加上图元测试数，作为逐像素的遍历开销
+    uint64_t traversalCost = 0;
+
+    void Add(const TraceStats& other) {
+        for (int d = 0; d <= maxDepth; d++) {
+            raysByDepth[d] += other.raysByDepth[d];
+        }
+        shadowRays += other.shadowRays;
+        bvhNodes += other.bvhNodes;
+        for (int p = 0; p < primitiveTypes; p++) {
+            primitiveTests[p] += other.primitiveTests[p];
+        }
+        mediumScatters += other.mediumScatters;
+        depthTerminated += other.depthTerminated;
+        traversalCost += other.traversalCost;
+    }
+
+    void RecordRay(int depth) {
+        raysByDepth[depth < 0 ? 0 : depth > maxDepth ? maxDepth : depth]++;
+    }
+
+    void RecordPrimitive(PrimitiveType type) {
+        primitiveTests[static_cast<int>(type)]++;
+        traversalCost++;
+    }
+
+    void RecordNode() {
+        bvhNodes++;
+        traversalCost++;
+    }
+
+    // renderDepth是渲染时的最大深度，用于把剩余深度换算成弹射次数
+    void Print(std::ostream& out, int renderDepth) const {
+        static const char* primitiveNames[primitiveTypes] = {
+            "sphere", "moving sphere", "rect", "medium"};
+
+        uint64_t rays = 0;
+        for (auto n : raysByDepth) rays += n;
+        out << "Rays traced:         " << rays << " (+" << shadowRays
+            << " shadow)\n";
+        for (int d = maxDepth; d >= 0; d--) {
+            if (raysByDepth[d] == 0) continue;
+            out << "  bounce " << std::setw(2) << renderDepth - d << ":       "
+                << raysByDepth[d] << '\n';
+        }
+        out << "BVH nodes visited:   " << bvhNodes;
+        if (rays + shadowRays > 0) {
+            out << " (" << std::fixed << std::setprecision(1)
+                << static_cast<double>(bvhNodes) / (rays + shadowRays)
+                << " per ray)";
+        }
+        out << '\n' << "Primitive tests:\n";
+        for (int p = 0; p < primitiveTypes; p++) {
+            out << "  " << std::left << std::setw(18) << primitiveNames[p]
+                << std::right << primitiveTests[p] << '\n';
+        }
+        out << "Medium scatterings:  " << mediumScatters << '\n'
+            << "Paths cut at depth:  " << depthTerminated << '\n';
+    }
+};
+
+// Thread-local counters. Collect() adds up the counters of every thread
+// that has counted anything, plus those merged in by threads that have
+// exited. ParallelFor returns only after its threads have finished the
+// loop, so between parallel loops Collect() sees everything.
+class Stats {
+   private:
+    struct Local;
+
+    struct Global {
+        std::mutex mutex;
+        TraceStats exited;
+        std::vector<const Local*> live;
+    };
+
+    struct Local {
+        TraceStats stats;
+        Local() {
+            auto& global = globalStats();
+            std::lock_guard<std::mutex> lock(global.mutex);
+            global.live.push_back(this);
+        }
+        ~Local() {
+            auto& global = globalStats();
+            std::lock_guard<std::mutex> lock(global.mutex);
+            global.exited.Add(stats);
+            global.live.erase(
+                std::find(global.live.begin(), global.live.end(), this));
+        }
+    };
+
+    static Global& globalStats() {
+        static Global global;
+        return global;
+    }
+
+    static Local& local() {
+        static thread_local Local local;
+        return local;
+    }
+
+   public:
+    static TraceStats& Thread() { return local().stats; }
+
+    // 所有线程的统计，只在没有并行循环运行时调用
+    static TraceStats Collect() {
+        auto& global = globalStats();
+        std::lock_guard<std::mutex> lock(global.mutex);
+        auto total = global.exited;
+        for (auto l : global.live) total.Add(l->stats);
+        return total;
+    }
+};
+
+// 统计只在定义了RTW_STATS时编译进来，否则这些宏什么也不做
+#ifdef RTW_STATS
+#define RTW_STAT_RAY(depth) Stats::Thread().RecordRay(depth)
+#define RTW_STAT_SHADOW_RAY() Stats::Thread().shadowRays++
+#define RTW_STAT_NODE() Stats::Thread().RecordNode()
+#define RTW_STAT_PRIMITIVE(type) Stats::Thread().RecordPrimitive(type)
+#define RTW_STAT_MEDIUM_SCATTER() Stats::Thread().mediumScatters++
+#define RTW_STAT_DEPTH_TERMINATED() Stats::Thread().depthTerminated++
+#else
+#define RTW_STAT_RAY(depth) ((void)0)
+#define RTW_STAT_SHADOW_RAY() ((void)0)
+#define RTW_STAT_NODE() ((void)0)
+#define RTW_STAT_PRIMITIVE(type) ((void)0)
+#define RTW_STAT_MEDIUM_SCATTER() ((void)0)
+#define RTW_STAT_DEPTH_TERMINATED() ((void)0)
+#endif
+
+// Writes the per-pixel traversal cost as a black-red-yellow-white heatmap.
+// A few pixels (glass, fog) are usually far more expensive than the rest,
+// so white is the 99th percentile rather than the maximum; returns that
+// value.
+inline double WriteHeatmap(std::ostream& out, const std::vector<double>& cost,
+                           int width, int height) {
+    auto sorted = cost;
+    std::sort(sorted.begin(), sorted.end());
+    auto scale = sorted.empty() ? 0 : sorted[sorted.size() * 99 / 100];
+
+    out << "P3\n" << width << ' ' << height << "\n255\n";
+    for (auto c : cost) {
+        auto x = scale > 0 ? c / scale : 0;
+        auto channel = [&](double start) {
+            auto v = (x - start) * 3;
+            return static_cast<int>(255.999 * (v < 0 ? 0 : v > 1 ? 1 : v));
+        };
+        out << channel(0) << ' ' << channel(1.0 / 3) << ' ' << channel(2.0 / 3)
+            << '\n';
+    }
+    return scale;
+}
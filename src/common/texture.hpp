@@ -2,13 +2,26 @@
 
 #include <iostream>
 
+#include "fast_math.hpp"
+#include "mipmap.hpp"
 #include "perlin.hpp"
-#include "rtw_std_image.hpp"
 #include "rtweekend.hpp"
+#include "texture_cache.hpp"
 
 class Texture {
    public:
     virtual Color Value(double u, double v, const Point3& p) const = 0;
+
+    // Value averaged over a footprint of the given width in uv space.
+    // Textures without prefiltered data just point sample.
+    virtual Color FilteredValue(double u, double v, const Point3& p,
+                                double footprint) const {
+        return Value(u, v, p);
+    }
+
+    // Whether Value depends on (u, v); solid and procedural textures only
+    // look at p.
+    virtual bool NeedsUV() const { return true; }
 };
 
 class SolidColor : public Texture {
@@ -19,11 +32,13 @@ class SolidColor : public Texture {
     SolidColor() {}
     SolidColor(Color c) : colorValue(c) {}
     SolidColor(double red, double green, double blue)
-        : colorValue(Color{red, green, blue}) {}
+        : colorValue(Color(red, green, blue)) {}
 
     virtual Color Value(double u, double v, const Point3& p) const override {
         return colorValue;
     };
+
+    virtual bool NeedsUV() const override { return false; }
 };
 
 class CheckerTexture : public Texture {
@@ -36,17 +51,31 @@ class CheckerTexture : public Texture {
                    std::shared_ptr<Texture> _even)
         : odd(_odd), even(_even) {}
     CheckerTexture(Color c1, Color c2)
-        : even(std::make_shared<SolidColor>(c1)),
-          odd(std::make_shared<SolidColor>(c2)) {}
+        : even(MakeShared<SolidColor>(c1)),
+          odd(MakeShared<SolidColor>(c2)) {}
 
     virtual Color Value(double u, double v, const Point3& p) const override {
-        auto sines = sin(10 * p.X()) * sin(10 * p.Y()) * sin(10 * p.Z());
+        auto sines = SinProduct(10 * p.X(), 10 * p.Y(), 10 * p.Z());
         if (sines < 0) {
             return odd->Value(u, v, p);
         } else {
             return even->Value(u, v, p);
         }
     }
+
+    virtual Color FilteredValue(double u, double v, const Point3& p,
+                                double footprint) const override {
+        auto sines = SinProduct(10 * p.X(), 10 * p.Y(), 10 * p.Z());
+        if (sines < 0) {
+            return odd->FilteredValue(u, v, p, footprint);
+        } else {
+            return even->FilteredValue(u, v, p, footprint);
+        }
+    }
+
+    virtual bool NeedsUV() const override {
+        return odd->NeedsUV() || even->NeedsUV();
+    }
 };
 
 class NoiseTexture : public Texture {
@@ -60,42 +89,38 @@ class NoiseTexture : public Texture {
 
     virtual Color Value(double u, double v, const Point3& p) const override {
         return Color{1, 1, 1} * 0.5 *
-               (1 + sin(scale_ * p.Z() + 10 * noise_.Turb(p)));
+               (1 + Sin(scale_ * p.Z() + 10 * noise_.Turb(p)));
     }
+
+    virtual bool NeedsUV() const override { return false; }
 };
 
 class ImageTexture : public Texture {
    private:
-    unsigned char* data_;
-    int width_, height_;
-    int bytesPerScaline_;
+    std::shared_ptr<const MipImage> image_;
 
    public:
     const static int bytesPerPixel = 3;
 
-    ImageTexture()
-        : data_(nullptr), width_(0), height_(0), bytesPerScaline_(0) {}
-
-    ImageTexture(const char* filename) {
-        auto componentsPerPixel = bytesPerPixel;
+    ImageTexture() {}
 
-        data_ = stbi_load(filename, &width_, &height_, &componentsPerPixel,
-                          componentsPerPixel);
-
-        if (!data_) {
+    // 通过TextureRegistry加载，同一张图片只解码一次，所有实例共享
+    ImageTexture(const char* filename)
+        : image_(TextureRegistry::Instance().Load(filename)) {
+        if (image_ == nullptr) {
             std::cerr << "ERROR: Could not load texture image file '"
                       << filename << "'.\n";
-            width_ = height_ = 0;
         }
-
-        bytesPerScaline_ = bytesPerPixel * width_;
     }
 
-    ~ImageTexture() { delete data_; }
-
     virtual Color Value(double u, double v, const Point3& p) const override {
+        return FilteredValue(u, v, p, 0);
+    }
+
+    virtual Color FilteredValue(double u, double v, const Point3& p,
+                                double footprint) const override {
         // If we have no texture data, then return solid cyan as a debugging aid
-        if (data_ == nullptr) {
+        if (image_ == nullptr) {
             return Color{0, 1, 1};
         }
 
@@ -103,17 +128,6 @@ class ImageTexture : public Texture {
         u = Clamp(u, 0.0, 1.0);
         v = 1.0 - Clamp(v, 0.0, 1.0);  // Flip V to image coordinates
 
-        auto i = static_cast<int>(u * width_);
-        auto j = static_cast<int>(v * height_);
-
-        // Clamp integer mapping, since actual coordinates should be less
-        // than 1.0
-        if (i >= width_) i = width_ - 1;
-        if (j >= height_) j = height_ - 1;
-
-        const auto colorScale = 1.0 / 255.0;
-        auto pixel = data_ + j * bytesPerScaline_ + i * bytesPerPixel;
-        return Color{colorScale * pixel[0], colorScale * pixel[1],
-                     colorScale * pixel[2]};
+        return image_->Trilinear(u, v, footprint);
     }
 };
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mipmap.hpp"
+#include "rtw_std_image.hpp"
+
+// 只读映射整个文件，Windows上退化为读入内存
+class MappedFile {
+   private:
+    const void* data_ = nullptr;
+    size_t size_ = 0;
+    std::vector<char> buffer_;
+
+   public:
+    explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return;
+        buffer_.assign(std::istreambuf_iterator<char>(in),
+                       std::istreambuf_iterator<char>());
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+#else
+        auto fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            auto p = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                data_ = p;
+                size_ = info.st_size;
+            }
+        }
+        close(fd);
+#endif
+    }
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (data_ != nullptr) munmap(const_cast<void*>(data_), size_);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const unsigned char* Data() const {
+        return static_cast<const unsigned char*>(data_);
+    }
+    size_t Size() const { return size_; }
+};
+
+// Process-wide registry of decoded images. Loads are deduplicated by path
+// and by content hash, and every decoded mip pyramid is also written to a
+// binary cache directory so later runs can mmap it instead of decoding the
+// JPEG/PNG again.
+//
+// The cache directory is $RTW_TEXTURE_CACHE, or ".texture_cache" in the
+// working directory; set RTW_TEXTURE_CACHE to an empty string to disable it.
+class TextureRegistry {
+   private:
+    // 缓存文件格式：头部 + Level数组 + texel数据，texel按8字节对齐
+    struct CacheHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t levelCount;
+        uint64_t texelCount;
+    };
+
+    struct CacheLevel {
+        int32_t width, height, tilesX, pad;
+        uint64_t offset;
+    };
+
+    static const uint32_t cacheVersion = 1;
+    // 2^64的边长也只有64层，再多一定是坏文件
+    static const uint32_t maxLevels = 64;
+
+    std::mutex mutex_;
+    std::map<std::string, std::shared_ptr<const MipImage>> byPath_;
+    std::map<uint64_t, std::shared_ptr<const MipImage>> byHash_;
+    std::string cacheDir_;
+
+    TextureRegistry() {
+        auto dir = std::getenv("RTW_TEXTURE_CACHE");
+        cacheDir_ = dir != nullptr ? dir : ".texture_cache";
+    }
+
+    // FNV-1a
+    static uint64_t hashBytes(const std::vector<unsigned char>& bytes) {
+        uint64_t hash = 14695981039346656037ull;
+        for (auto b : bytes) {
+            hash ^= b;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    std::string cachePath(uint64_t hash) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%016llx.mip",
+                      static_cast<unsigned long long>(hash));
+        return cacheDir_ + name;
+    }
+
+    // 一层的尺寸和tile数一致，并且它的texel整个落在texelCount之内
+    static bool validLevel(const CacheLevel& level, uint64_t texelCount) {
+        const int tileSize = MipImage::tileSize;
+        if (level.width <= 0 || level.height <= 0 ||
+            level.tilesX != (level.width - 1) / tileSize + 1) {
+            return false;
+        }
+        auto tilesY = static_cast<uint64_t>((level.height - 1) / tileSize + 1);
+        auto size = static_cast<uint64_t>(level.tilesX) * tilesY *
+                    MipImage::texelsPerTile;
+        return level.offset <= texelCount && size <= texelCount - level.offset;
+    }
+
+    std::shared_ptr<const MipImage> loadCached(uint64_t hash) const {
+        if (cacheDir_.empty()) return nullptr;
+
+        auto file = std::make_shared<MappedFile>(cachePath(hash));
+        if (file->Size() < sizeof(CacheHeader)) return nullptr;
+
+        CacheHeader header;
+        std::memcpy(&header, file->Data(), sizeof(header));
+        if (std::memcmp(header.magic, "RTWMIP\0\0", 8) != 0 ||
+            header.version != cacheVersion) {
+            return nullptr;
+        }
+
+        // 文件可能被截断或者损坏，所有大小和偏移都要和映射的长度对上，
+        // 任何一项不对都返回null，让调用者重新解码
+        if (header.levelCount == 0 || header.levelCount > maxLevels) {
+            return nullptr;
+        }
+        auto levelsSize = header.levelCount * sizeof(CacheLevel);
+        auto texelStart = sizeof(CacheHeader) + levelsSize;
+        if (file->Size() < texelStart ||
+            header.texelCount > (file->Size() - texelStart) / 4) {
+            return nullptr;
+        }
+
+        std::vector<MipImage::Level> levels(header.levelCount);
+        for (uint32_t l = 0; l < header.levelCount; l++) {
+            CacheLevel cl;
+            std::memcpy(&cl,
+                        file->Data() + sizeof(CacheHeader) +
+                            l * sizeof(CacheLevel),
+                        sizeof(cl));
+            if (!validLevel(cl, header.texelCount)) return nullptr;
+            levels[l] = MipImage::Level{cl.width, cl.height, cl.tilesX,
+                                        static_cast<size_t>(cl.offset)};
+        }
+
+        auto texels =
+            reinterpret_cast<const uint32_t*>(file->Data() + texelStart);
+        return std::make_shared<MipImage>(std::move(levels), texels,
+                                          header.texelCount, file);
+    }
+
+    void storeCached(uint64_t hash, const MipImage& image) const {
+        if (cacheDir_.empty()) return;
+#ifdef _WIN32
+        _mkdir(cacheDir_.c_str());
+#else
+        mkdir(cacheDir_.c_str(), 0755);
+#endif
+        // 先写临时文件再改名，其他进程不会读到写了一半的缓存
+        auto path = cachePath(hash);
+        auto temp = path + ".tmp";
+        std::ofstream out(temp, std::ios::binary);
+        if (!out) return;
+
+        CacheHeader header;
+        std::memcpy(header.magic, "RTWMIP\0\0", 8);
+        header.version = cacheVersion;
+        header.levelCount = static_cast<uint32_t>(image.LevelCount());
+        header.texelCount = image.TexelCount();
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (const auto& level : image.Levels()) {
+            CacheLevel cl{level.width, level.height, level.tilesX, 0,
+                          level.offset};
+            out.write(reinterpret_cast<const char*>(&cl), sizeof(cl));
+        }
+        out.write(reinterpret_cast<const char*>(image.Texels()),
+                  image.TexelCount() * 4);
+        out.close();
+
+        if (!out || std::rename(temp.c_str(), path.c_str()) != 0) {
+            std::remove(temp.c_str());
+        }
+    }
+
+   public:
+    static TextureRegistry& Instance() {
+        static TextureRegistry registry;
+        return registry;
+    }
+
+    // Returns the shared, immutable mip pyramid of an image file, or null
+    // if it cannot be read.
+    std::shared_ptr<const MipImage> Load(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto known = byPath_.find(path);
+        if (known != byPath_.end()) return known->second;
+
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return nullptr;
+        std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(in)),
+                                         std::istreambuf_iterator<char>());
+
+        // 同样内容的不同路径共享一份数据
+        auto hash = hashBytes(bytes);
+        auto same = byHash_.find(hash);
+        if (same != byHash_.end()) {
+            byPath_[path] = same->second;
+            return same->second;
+        }
+
+        auto image = loadCached(hash);
+        if (image == nullptr) {
+            int width, height, components;
+            auto data = stbi_load_from_memory(
+                bytes.data(), static_cast<int>(bytes.size()), &width, &height,
+                &components, 3);
+            if (data == nullptr) return nullptr;
+            auto decoded = std::make_shared<MipImage>(data, width, height);
+            stbi_image_free(data);
+            storeCached(hash, *decoded);
+            image = decoded;
+        }
+
+        byPath_[path] = image;
+        byHash_[hash] = image;
+        return image;
+    }
+
+    size_t ImageCount() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return byHash_.size();
+    }
+};
@@ -5,18 +5,18 @@
 
 class Vec3 {
    public:
-    double e[3];
+    Real e[3];
 
     Vec3() : e{0, 0, 0} {}
-    Vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+    Vec3(Real e0, Real e1, Real e2) : e{e0, e1, e2} {}
 
-    double X() const { return e[0]; }
-    double Y() const { return e[1]; }
-    double Z() const { return e[2]; }
+    Real X() const { return e[0]; }
+    Real Y() const { return e[1]; }
+    Real Z() const { return e[2]; }
 
     Vec3 operator-() const { return Vec3(-e[0], -e[1], -e[2]); }
-    double operator[](int i) const { return e[i]; }
-    double &operator[](int i) { return e[i]; }
+    Real operator[](int i) const { return e[i]; }
+    Real &operator[](int i) { return e[i]; }
 
     Vec3 &operator+=(const Vec3 &v) {
         e[0] += v.e[0];
@@ -25,18 +25,18 @@ class Vec3 {
         return *this;
     }
 
-    Vec3 &operator*=(const double t) {
+    Vec3 &operator*=(const Real t) {
         e[0] *= t;
         e[1] *= t;
         e[2] *= t;
         return *this;
     }
 
-    Vec3 &operator/=(const double t) { return *this *= 1 / t; }
+    Vec3 &operator/=(const Real t) { return *this *= 1 / t; }
 
-    double Length() const { return sqrt(LengthSquared()); }
+    Real Length() const { return sqrt(LengthSquared()); }
 
-    double LengthSquared() const {
+    Real LengthSquared() const {
         return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
     }
 
@@ -44,7 +44,7 @@ class Vec3 {
         return Vec3(RandomDouble(), RandomDouble(), RandomDouble());
     }
 
-    inline static Vec3 Random(double min, double max) {
+    inline static Vec3 Random(Real min, Real max) {
         return Vec3(RandomDouble(min, max), RandomDouble(min, max),
                     RandomDouble(min, max));
     }
@@ -78,15 +78,15 @@ inline Vec3 operator*(const Vec3 &u, const Vec3 &v) {
     return Vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
 
-inline Vec3 operator*(double t, const Vec3 &v) {
+inline Vec3 operator*(Real t, const Vec3 &v) {
     return Vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
 }
 
-inline Vec3 operator*(const Vec3 &v, double t) { return t * v; }
+inline Vec3 operator*(const Vec3 &v, Real t) { return t * v; }
 
-inline Vec3 operator/(Vec3 v, double t) { return (1 / t) * v; }
+inline Vec3 operator/(Vec3 v, Real t) { return (1 / t) * v; }
 
-inline double Dot(const Vec3 &u, const Vec3 &v) {
+inline Real Dot(const Vec3 &u, const Vec3 &v) {
     return u.e[0] * v.e[0] + u.e[1] * v.e[1] + u.e[2] * v.e[2];
 }
 
@@ -98,6 +98,10 @@ inline Vec3 Cross(const Vec3 &u, const Vec3 &v) {
 
 inline Vec3 UnitVector(Vec3 v) { return v / v.Length(); }
 
+inline Vec3 Abs(const Vec3 &v) {
+    return Vec3(fabs(v.e[0]), fabs(v.e[1]), fabs(v.e[2]));
+}
+
 Vec3 RandomInUnitSphere() {
     // 在单位半径的球体内随机选择一个点
     // todo 优化效率防止死循环
@@ -122,7 +126,7 @@ Vec3 RandomInHemisphere(const Vec3 &normal) {
 Vec3 Reflect(const Vec3 &v, const Vec3 &n) { return v - 2 * Dot(v, n) * n; }
 
 // 将折射光线拆分成axis-align的两条光线
-Vec3 Refract(const Vec3 &uv, const Vec3 &n, double etaiOverEtat) {
+Vec3 Refract(const Vec3 &uv, const Vec3 &n, Real etaiOverEtat) {
     auto cosTheta = fmin(Dot(-uv, n), 1.0);
     Vec3 rOutPerp = etaiOverEtat * (uv + cosTheta * n);
     Vec3 rOutParallel = -sqrt(fabs(1.0 - rOutPerp.LengthSquared())) * n;
@@ -136,3 +140,46 @@ Vec3 RandomInUnitDisk() {
         return p;
     }
 }
+
+// 以下函数把[0,1)^2内的点映射成方向或圆盘上的点，供低差异序列使用
+
+// 以z轴为法线、按cosθ/π分布的半球方向
+Vec3 SampleCosineDirection(Real r1, Real r2) {
+    auto z = sqrt(1 - r2);
+
+    auto phi = 2 * pi * r1;
+    auto x = cos(phi) * sqrt(r2);
+    auto y = sin(phi) * sqrt(r2);
+
+    return Vec3(x, y, z);
+}
+
+Vec3 RandomCosineDirection() {
+    auto r1 = RandomDouble();
+    return SampleCosineDirection(r1, RandomDouble());
+}
+
+// 单位球面上均匀分布的方向
+Vec3 SampleUnitSphere(Real r1, Real r2) {
+    auto z = 1 - 2 * r2;
+    auto r = sqrt(fmax(0.0, 1 - z * z));
+    auto phi = 2 * pi * r1;
+    return Vec3(r * cos(phi), r * sin(phi), z);
+}
+
+// 单位圆盘上均匀分布的点(同心映射，保持分层)
+Vec3 SampleUnitDisk(Real r1, Real r2) {
+    auto a = 2 * r1 - 1;
+    auto b = 2 * r2 - 1;
+    if (a == 0 && b == 0) return Vec3(0, 0, 0);
+
+    Real r, phi;
+    if (fabs(a) > fabs(b)) {
+        r = a;
+        phi = (pi / 4) * (b / a);
+    } else {
+        r = b;
+        phi = pi / 2 - (pi / 4) * (a / b);
+    }
+    return Vec3(r * cos(phi), r * sin(phi), 0);
+}
@@ -0,0 +1,119 @@
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "options.hpp"
+#include "render_server.hpp"
+
+const char* defaultSocket = "rtw_render.sock";
+
+void PrintServerUsage(const char* program) {
+    std::cerr
+        << "Usage:\n"
+        << "  " << program << " serve [--socket PATH] [--threads N]\n"
+        << "  " << program << " render [--socket PATH] [key=value ...]"
+        << " > image.ppm\n"
+        << "      keys: scene, width, spp, integrator (path, nee, mis, ao),\n"
+        << "            sampler, priority (higher renders first)\n"
+        << "  " << program << " status|shutdown [--socket PATH]\n"
+        << "  " << program << " cancel ID [--socket PATH]\n"
+        << "The socket defaults to " << defaultSocket
+        << " in the working directory.\n";
+}
+
+// 提交一个任务，把每个pass的进度打印到stderr，最后一个pass写成PPM
+int SubmitJob(Connection& server, const std::string& arguments) {
+    if (!server.Send("render" + arguments + "\n")) return 1;
+
+    std::string line, pixels;
+    int width = 0, height = 0;
+    while (server.ReadLine(line)) {
+        std::istringstream in(line);
+        std::string reply;
+        in >> reply;
+        if (reply == "pass") {
+            int id, spp;
+            in >> id >> spp >> width >> height;
+            if (!server.ReadBytes(static_cast<size_t>(width) * height * 3,
+                                  pixels)) {
+                break;
+            }
+            std::cerr << "\rJob " << id << ": " << spp << " spp" << std::flush;
+        } else if (reply == "job") {
+            std::cerr << line << '\n';
+        } else {
+            std::cerr << '\n' << line << '\n';
+            if (reply != "done") return 1;
+            std::cout << "P3\n" << width << ' ' << height << "\n255\n";
+            for (size_t i = 0; i < pixels.size(); i += 3) {
+                std::cout << int(static_cast<unsigned char>(pixels[i])) << ' '
+                          << int(static_cast<unsigned char>(pixels[i + 1]))
+                          << ' '
+                          << int(static_cast<unsigned char>(pixels[i + 2]))
+                          << '\n';
+            }
+            return 0;
+        }
+    }
+    std::cerr << "\nLost the connection to the server\n";
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        PrintServerUsage(argv[0]);
+        return 1;
+    }
+    // 客户端断开后的send返回错误，而不是让整个服务器收到SIGPIPE退出
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::string command = argv[1];
+    std::string socketPath = defaultSocket;
+    int threadCount = DefaultThreadCount();
+    // 其余参数原样转发给服务器
+    std::string arguments;
+    for (int n = 2; n < argc; n++) {
+        if (std::strcmp(argv[n], "--socket") == 0 && n + 1 < argc) {
+            socketPath = argv[++n];
+        } else if (std::strcmp(argv[n], "--threads") == 0 && n + 1 < argc) {
+            threadCount = std::max(1, std::atoi(argv[++n]));
+        } else {
+            arguments += ' ';
+            arguments += argv[n];
+        }
+    }
+
+    if (command == "serve") {
+        RenderServer server(socketPath, threadCount);
+        if (!server.Listen()) return 1;
+        server.Run();
+        std::cerr << "Server stopped\n";
+        return 0;
+    }
+
+    if (command != "render" && command != "status" &&
+        command != "shutdown" && command != "cancel") {
+        PrintServerUsage(argv[0]);
+        return 1;
+    }
+    auto server = Connection::Open(socketPath);
+    if (server == nullptr) {
+        std::cerr << "No server is listening on " << socketPath << '\n';
+        return 1;
+    }
+    if (command == "render") return SubmitJob(*server, arguments);
+
+    if (!server->Send(command + arguments + "\n")) return 1;
+    std::string line;
+    while (server->ReadLine(line)) {
+        std::cout << line << '\n';
+        // status以"end"结束，其他命令只有一行回复
+        if (command != "status" || line == "end") {
+            return line.compare(0, 5, "error") == 0 ? 1 : 0;
+        }
+    }
+    return 1;
+}
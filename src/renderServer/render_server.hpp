@@ -0,0 +1,684 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "integrator.hpp"
+#include "progressive.hpp"
+#include "scenes.hpp"
+
+// 协议：每条命令一行文本，回复也以行为单位
+//   render key=value ...  开始一个任务，回复"job <id>"，然后每个pass发送
+//                         "pass <id> <spp> <width> <height>"加上
+//                         width*height*3字节的RGB，最后是"done <id> <spp>
+//                         <seconds>"、"cancelled <id>"或"error <message>"
+//   cancel <id>           取消任务，回复"ok"或"error ..."
+//   status                缓存的场景和正在进行的任务，以"end"结束
+//   shutdown              取消所有任务并退出，回复"ok"
+// 一个连接同时只有一个任务，收到done或cancelled之后才能发起下一个；
+// 发起任务的连接断开时任务也会被取消
+
+// A connected Unix domain socket. The thread reading commands and the jobs
+// writing results both hold it; it is closed when the last one lets go.
+class Connection {
+   private:
+    int fd_;
+    std::mutex writeMutex_;
+    // 读到的还没有交给调用者的数据，只有一个线程读
+    std::string buffer_;
+
+    bool fill() {
+        char chunk[4096];
+        while (true) {
+            auto n = recv(fd_, chunk, sizeof(chunk), 0);
+            if (n > 0) {
+                buffer_.append(chunk, n);
+                return true;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            return false;
+        }
+    }
+
+   public:
+    explicit Connection(int fd) : fd_(fd) {}
+    ~Connection() { close(fd_); }
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    // Connects to a server; returns null if nobody listens at path.
+    static std::shared_ptr<Connection> Open(const std::string& path) {
+        sockaddr_un address;
+        if (path.size() >= sizeof(address.sun_path)) return nullptr;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        std::strcpy(address.sun_path, path.c_str());
+
+        auto fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return nullptr;
+        if (connect(fd, reinterpret_cast<sockaddr*>(&address),
+                    sizeof(address)) != 0) {
+            close(fd);
+            return nullptr;
+        }
+        return std::make_shared<Connection>(fd);
+    }
+
+    int Fd() const { return fd_; }
+
+    // 一次写出整条消息，多个线程写同一个连接时消息不会交错。
+    // 对方断开或超时时返回false
+    bool Send(const std::string& data) {
+        std::lock_guard<std::mutex> lock(writeMutex_);
+        size_t sent = 0;
+        while (sent < data.size()) {
+            auto n = send(fd_, data.data() + sent, data.size() - sent, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            sent += n;
+        }
+        return true;
+    }
+
+    // 读一行，不含换行符；连接关闭时返回false
+    bool ReadLine(std::string& line) {
+        while (true) {
+            auto end = buffer_.find('\n');
+            if (end != std::string::npos) {
+                line = buffer_.substr(0, end);
+                buffer_.erase(0, end + 1);
+                return true;
+            }
+            if (!fill()) return false;
+        }
+    }
+
+    bool ReadBytes(size_t count, std::string& bytes) {
+        while (buffer_.size() < count) {
+            if (!fill()) return false;
+        }
+        bytes = buffer_.substr(0, count);
+        buffer_.erase(0, count);
+        return true;
+    }
+
+    // 唤醒阻塞在这个连接上的读
+    void Shutdown() { shutdown(fd_, SHUT_RDWR); }
+};
+
+// 一个render命令的参数，0表示使用场景自己的设置
+struct JobRequest {
+    int scene = 8;
+    int width = 0;
+    int spp = 0;
+    // path、nee、mis或ao
+    std::string integrator = "path";
+    std::string sampler = "independent";
+    // 越大越先渲染
+    int priority = 0;
+};
+
+inline bool ParseJobRequest(std::istream& in, JobRequest& request,
+                            std::string& error) {
+    std::string token;
+    while (in >> token) {
+        auto eq = token.find('=');
+        if (eq == std::string::npos) {
+            error = "expected key=value, got " + token;
+            return false;
+        }
+        auto key = token.substr(0, eq);
+        auto value = token.substr(eq + 1);
+        if (key == "scene") {
+            request.scene = std::atoi(value.c_str());
+        } else if (key == "width") {
+            request.width = std::atoi(value.c_str());
+        } else if (key == "spp") {
+            request.spp = std::atoi(value.c_str());
+        } else if (key == "integrator") {
+            request.integrator = value;
+        } else if (key == "sampler") {
+            request.sampler = value;
+        } else if (key == "priority") {
+            request.priority = std::atoi(value.c_str());
+        } else {
+            error = "unknown key " + key;
+            return false;
+        }
+    }
+    if (request.integrator != "path" && request.integrator != "nee" &&
+        request.integrator != "mis" && request.integrator != "ao") {
+        error = "unknown integrator " + request.integrator;
+        return false;
+    }
+    if (MakeSampler(request.sampler) == nullptr) {
+        error = "unknown sampler " + request.sampler;
+        return false;
+    }
+    if (request.width < 0 || request.spp < 0) {
+        error = "width and spp must not be negative";
+        return false;
+    }
+    // LoadScene把其他编号都当成最终场景，每个编号却会在缓存里占一份
+    if (request.scene < 1 || request.scene > 9) {
+        error = "scene must be 1-9";
+        return false;
+    }
+    return true;
+}
+
+// Everything a job needs from a scene, kept between jobs: the objects in
+// their own arena, a BVH over the whole world and the light list with its
+// light tree. Decoded textures are shared process-wide by TextureRegistry
+// anyway.
+struct CachedScene {
+    SceneArena arena;
+    Scene scene;
+    std::shared_ptr<BVHNode> bvh;
+    LightList lights;
+    double loadSeconds = 0;
+};
+
+class SceneCache {
+   private:
+    using Entry = std::shared_future<std::shared_ptr<CachedScene>>;
+
+    std::mutex mutex_;
+    std::map<int, Entry> scenes_;
+
+    static std::shared_ptr<CachedScene> load(int id) {
+        auto start = std::chrono::steady_clock::now();
+        auto cached = std::make_shared<CachedScene>();
+        {
+            SceneArena::Scope scope(cached->arena);
+            MaterialTable::Scope materials;
+            cached->scene = LoadScene(id);
+            cached->bvh = MakeShared<BVHNode>(cached->scene.world, 0, 1);
+            cached->scene.world.CollectLights(cached->lights);
+            BuildLightTree(cached->lights);
+        }
+        std::chrono::duration<double> seconds =
+            std::chrono::steady_clock::now() - start;
+        cached->loadSeconds = seconds.count();
+        std::cerr << "Loaded scene " << id << " in " << seconds.count()
+                  << "s\n";
+        return cached;
+    }
+
+   public:
+    // Loads a scene the first time it is asked for. The first caller loads
+    // it outside the lock, so other jobs and status are not held up; later
+    // callers for the same scene wait for that load instead of starting
+    // another.
+    std::shared_ptr<CachedScene> Get(int id) {
+        std::promise<std::shared_ptr<CachedScene>> loaded;
+        Entry entry;
+        auto loading = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto known = scenes_.find(id);
+            if (known != scenes_.end()) {
+                entry = known->second;
+            } else {
+                entry = loaded.get_future().share();
+                scenes_[id] = entry;
+                loading = true;
+            }
+        }
+        if (loading) loaded.set_value(load(id));
+        return entry.get();
+    }
+
+    void Describe(std::ostream& out) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& entry : scenes_) {
+            out << "scene " << entry.first;
+            if (entry.second.wait_for(std::chrono::seconds(0)) !=
+                std::future_status::ready) {
+                out << " loading\n";
+                continue;
+            }
+            auto cached = entry.second.get();
+            out << " loaded in " << cached->loadSeconds << "s, "
+                << cached->arena.BytesUsed() << " bytes\n";
+        }
+    }
+};
+
+// Worker threads shared by all jobs. Tasks with a higher priority run
+// first and tasks of equal priority in submission order, so the rows of a
+// new urgent job overtake the rows still queued for older ones.
+class RenderPool {
+   private:
+    struct Task {
+        int priority;
+        uint64_t order;
+        std::function<void()> run;
+    };
+
+    struct RunsLater {
+        bool operator()(const Task& a, const Task& b) const {
+            if (a.priority != b.priority) return a.priority < b.priority;
+            return a.order > b.order;
+        }
+    };
+
+    std::mutex mutex_;
+    std::condition_variable taskReady_;
+    std::priority_queue<Task, std::vector<Task>, RunsLater> tasks_;
+    uint64_t nextOrder_ = 0;
+    bool stopping_ = false;
+    std::vector<std::thread> threads_;
+
+    void work() {
+        while (true) {
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                taskReady_.wait(
+                    lock, [&]() { return stopping_ || !tasks_.empty(); });
+                // 停止时先把队列里的任务做完
+                if (tasks_.empty()) return;
+                task = tasks_.top();
+                tasks_.pop();
+            }
+            task.run();
+        }
+    }
+
+   public:
+    explicit RenderPool(int threadCount) {
+        for (int i = 0; i < std::max(threadCount, 1); i++) {
+            threads_.emplace_back(&RenderPool::work, this);
+        }
+    }
+
+    ~RenderPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        taskReady_.notify_all();
+        for (auto& t : threads_) t.join();
+    }
+
+    void Submit(int priority, std::function<void()> run) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.push(Task{priority, nextOrder_++, std::move(run)});
+        }
+        taskReady_.notify_one();
+    }
+
+    int ThreadCount() const { return static_cast<int>(threads_.size()); }
+};
+
+// One render. Each pass hands every row of the image to the RenderPool as
+// a task; whichever row finishes last sends the pass to the client and
+// starts the next one. Passes double in size like the progressive
+// renderer's, so the client gets a first image quickly and the overhead
+// per pass stays small. A cancelled job skips its queued rows.
+class RenderJob : public std::enable_shared_from_this<RenderJob> {
+   private:
+    int id_;
+    JobRequest request_;
+    std::shared_ptr<Connection> client_;
+    std::shared_ptr<CachedScene> scene_;
+    RenderPool& pool_;
+    std::function<void(int)> onFinished_;
+
+    int width_, height_, spp_;
+    Camera camera_;
+    ProgressiveRenderer renderer_;
+    std::chrono::steady_clock::time_point start_;
+
+    // 每个像素所有样本的和，从最上面一行开始
+    std::vector<Color> image_;
+    // 只在pass之间修改：行任务读到的总是当前pass开始时的值。status
+    // 线程也会读，所以是原子的
+    std::atomic<int> samplesDone_{0};
+    std::atomic<int> passSamples_{0};
+    std::atomic<int> rowsLeft_{0};
+    std::atomic<bool> cancelled_{false};
+    std::atomic<bool> finished_{false};
+
+    static RadianceFunction radianceFor(const JobRequest& request,
+                                        const CachedScene& cached) {
+        const auto& world = *cached.bvh;
+        const auto& lights = cached.lights;
+        auto background = cached.scene.background;
+        auto aoDistance =
+            (cached.scene.lookAt - cached.scene.lookFrom).Length() / 10;
+        auto integrator = request.integrator;
+        const int maxDepth = 50;
+        return [&world, &lights, background, aoDistance, integrator,
+                maxDepth](const Ray& r, Sampler& sampler) {
+            if (integrator == "ao") {
+                return AmbientOcclusion(r, background, world, sampler,
+                                        aoDistance, maxDepth);
+            }
+            if (integrator == "mis") {
+                return RayColorMIS(r, background, world, lights, sampler,
+                                   maxDepth);
+            }
+            if (integrator == "nee") {
+                return RayColorNEE(r, background, world, lights, sampler,
+                                   maxDepth);
+            }
+            return RayColor(r, background, world, maxDepth);
+        };
+    }
+
+    void startPass() {
+        passSamples_ = std::min(samplesDone_ == 0 ? 1 : 2 * passSamples_,
+                                spp_ - samplesDone_);
+        rowsLeft_ = height_;
+        auto self = shared_from_this();
+        for (int row = 0; row < height_; row++) {
+            pool_.Submit(request_.priority,
+                         [self, row]() { self->renderRow(row); });
+        }
+    }
+
+    void renderRow(int row) {
+        if (!cancelled_) {
+            auto sampler = MakeSampler(request_.sampler);
+            renderer_.AccumulateRow(row, samplesDone_, passSamples_,
+                                    *sampler, &image_[row * width_]);
+        }
+        if (--rowsLeft_ == 0) finishPass();
+    }
+
+    void finishPass() {
+        if (cancelled_) {
+            finish("cancelled");
+            client_->Send("cancelled " + std::to_string(id_) + "\n");
+            return;
+        }
+        samplesDone_ += passSamples_;
+
+        std::ostringstream header;
+        header << "pass " << id_ << ' ' << samplesDone_ << ' ' << width_
+               << ' ' << height_ << '\n';
+        auto message = header.str();
+        auto scale = 1.0 / samplesDone_;
+        for (const auto& pixelColor : image_) {
+            message += static_cast<char>(ColorByte(pixelColor.X(), scale));
+            message += static_cast<char>(ColorByte(pixelColor.Y(), scale));
+            message += static_cast<char>(ColorByte(pixelColor.Z(), scale));
+        }
+        if (!client_->Send(message)) {
+            finish("client gone");
+            return;
+        }
+
+        if (samplesDone_ < spp_) {
+            startPass();
+            return;
+        }
+        std::chrono::duration<double> seconds =
+            std::chrono::steady_clock::now() - start_;
+        std::ostringstream done;
+        done << "done " << id_ << ' ' << samplesDone_ << ' '
+             << seconds.count() << '\n';
+        finish("done");
+        client_->Send(done.str());
+    }
+
+    // 在发出最后一行之前调用，客户端收到它时连接已经可以发起下一个任务
+    void finish(const char* how) {
+        finished_ = true;
+        std::chrono::duration<double> seconds =
+            std::chrono::steady_clock::now() - start_;
+        std::cerr << "Job " << id_ << ' ' << how << " after "
+                  << seconds.count() << "s, " << samplesDone_ << " spp\n";
+        onFinished_(id_);
+    }
+
+   public:
+    RenderJob(int id, const JobRequest& request,
+              std::shared_ptr<Connection> client,
+              std::shared_ptr<CachedScene> scene, RenderPool& pool,
+              std::function<void(int)> onFinished)
+        : id_(id),
+          request_(request),
+          client_(client),
+          scene_(scene),
+          pool_(pool),
+          onFinished_(onFinished),
+          width_(request.width > 0 ? request.width
+                                   : scene->scene.imageWidth),
+          height_(scene->scene.ImageHeight(width_)),
+          spp_(scene->scene.samplesPerPixel),
+          camera_(scene->scene.MakeCamera(height_)),
+          renderer_(camera_, radianceFor(request, *scene), request.sampler,
+                    width_, height_, 1),
+          start_(std::chrono::steady_clock::now()),
+          image_(static_cast<size_t>(width_) * height_, Color{0, 0, 0}) {
+        // 和命令行一样，环境光遮蔽预览默认16个样本
+        if (request.integrator == "ao") spp_ = 16;
+        if (request.spp > 0) spp_ = request.spp;
+    }
+
+    int Id() const { return id_; }
+
+    void Start() { startPass(); }
+
+    void Cancel() { cancelled_ = true; }
+
+    bool Finished() const { return finished_; }
+
+    void Describe(std::ostream& out) const {
+        out << "job " << id_ << " scene " << request_.scene << ' '
+            << width_ << 'x' << height_ << ' ' << request_.integrator
+            << " priority " << request_.priority << ", "
+            << samplesDone_.load() << '/' << spp_ << " spp\n";
+    }
+};
+
+// Accepts connections on a Unix domain socket and runs their jobs on one
+// RenderPool. The socket is only reachable on this machine and is created
+// with mode 0600, so only the user running the server can submit jobs.
+class RenderServer {
+   private:
+    std::string socketPath_;
+    RenderPool pool_;
+    SceneCache scenes_;
+    int listenFd_ = -1;
+    std::atomic<bool> stopping_{false};
+
+    std::mutex mutex_;
+    std::condition_variable idle_;
+    std::map<int, std::shared_ptr<RenderJob>> jobs_;
+    int nextJobId_ = 1;
+    // 打开的连接，退出时用来唤醒阻塞在读上的线程
+    std::map<Connection*, std::weak_ptr<Connection>> connections_;
+
+    std::shared_ptr<RenderJob> startJob(
+        const JobRequest& request, std::shared_ptr<Connection> connection) {
+        auto scene = scenes_.Get(request.scene);
+        std::shared_ptr<RenderJob> job;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto id = nextJobId_++;
+            job = std::make_shared<RenderJob>(
+                id, request, connection, scene, pool_,
+                [this](int finished) { jobFinished(finished); });
+            jobs_[id] = job;
+        }
+        connection->Send("job " + std::to_string(job->Id()) + "\n");
+        std::cerr << "Started ";
+        job->Describe(std::cerr);
+        job->Start();
+        return job;
+    }
+
+    void jobFinished(int id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.erase(id);
+        idle_.notify_all();
+    }
+
+    bool cancelJob(int id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto job = jobs_.find(id);
+        if (job == jobs_.end()) return false;
+        job->second->Cancel();
+        return true;
+    }
+
+    std::string status() {
+        std::ostringstream out;
+        out << "threads " << pool_.ThreadCount() << '\n';
+        scenes_.Describe(out);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto& entry : jobs_) entry.second->Describe(out);
+        }
+        out << "end\n";
+        return out.str();
+    }
+
+    void serve(std::shared_ptr<Connection> connection) {
+        // 这个连接最近发起的任务，连接断开时取消
+        std::shared_ptr<RenderJob> job;
+        std::string line;
+        while (connection->ReadLine(line)) {
+            std::istringstream in(line);
+            std::string command;
+            in >> command;
+            if (command == "render") {
+                JobRequest request;
+                std::string error;
+                if (job != nullptr && !job->Finished()) {
+                    connection->Send("error one job per connection\n");
+                } else if (!ParseJobRequest(in, request, error)) {
+                    connection->Send("error " + error + "\n");
+                } else {
+                    job = startJob(request, connection);
+                }
+            } else if (command == "cancel") {
+                int id = 0;
+                in >> id;
+                connection->Send(cancelJob(id) ? "ok\n"
+                                               : "error unknown job\n");
+            } else if (command == "status") {
+                connection->Send(status());
+            } else if (command == "shutdown") {
+                connection->Send("ok\n");
+                Stop();
+            } else {
+                connection->Send("error unknown command " + command + "\n");
+            }
+        }
+        if (job != nullptr) job->Cancel();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        connections_.erase(connection.get());
+        idle_.notify_all();
+    }
+
+   public:
+    RenderServer(const std::string& socketPath, int threadCount)
+        : socketPath_(socketPath), pool_(threadCount) {}
+
+    ~RenderServer() {
+        if (listenFd_ >= 0) {
+            close(listenFd_);
+            unlink(socketPath_.c_str());
+        }
+    }
+
+    // Creates the socket. A stale socket file from a server that died is
+    // replaced; a socket that still accepts connections is left alone.
+    bool Listen() {
+        sockaddr_un address;
+        if (socketPath_.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Socket path too long: " << socketPath_ << '\n';
+            return false;
+        }
+        if (Connection::Open(socketPath_) != nullptr) {
+            std::cerr << "A server is already listening on " << socketPath_
+                      << '\n';
+            return false;
+        }
+        unlink(socketPath_.c_str());
+
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        std::strcpy(address.sun_path, socketPath_.c_str());
+        auto fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        auto oldMask = umask(0077);
+        auto bound = fd >= 0 && bind(fd, reinterpret_cast<sockaddr*>(&address),
+                                     sizeof(address)) == 0;
+        umask(oldMask);
+        if (!bound || listen(fd, 16) != 0) {
+            std::cerr << "Could not listen on " << socketPath_ << ": "
+                      << std::strerror(errno) << '\n';
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        listenFd_ = fd;
+        std::cerr << "Listening on " << socketPath_ << " with "
+                  << pool_.ThreadCount() << " render threads\n";
+        return true;
+    }
+
+    // 处理连接直到收到shutdown，返回前取消所有任务并等它们结束
+    void Run() {
+        while (!stopping_) {
+            auto fd = accept(listenFd_, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                break;
+            }
+            // 不读结果的客户端不能让渲染线程一直阻塞在发送上
+            timeval timeout{10, 0};
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                       sizeof(timeout));
+            auto connection = std::make_shared<Connection>(fd);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                connections_[connection.get()] = connection;
+            }
+            std::thread(&RenderServer::serve, this, connection).detach();
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (auto& entry : jobs_) entry.second->Cancel();
+        for (auto& entry : connections_) {
+            auto connection = entry.second.lock();
+            if (connection != nullptr) connection->Shutdown();
+        }
+        idle_.wait(lock,
+                   [&]() { return jobs_.empty() && connections_.empty(); });
+    }
+
+    // 让Run()停止接受连接，可以从任何线程调用
+    void Stop() {
+        stopping_ = true;
+        // 连一下自己，把Run()从accept中唤醒
+        Connection::Open(socketPath_);
+    }
+};
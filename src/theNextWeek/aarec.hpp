@@ -1,83 +1,183 @@
 #pragma once
 
+#include "color.hpp"
 #include "hittable.hpp"
+#include "material.hpp"
 #include "rtweekend.hpp"
 
 class XYRect : public Hittable {
    public:
     std::shared_ptr<Material> mp;
-    double x0, x1, y0, y1, k;
+    Real x0, x1, y0, y1, k;
 
     XYRect() {}
 
-    XYRect(double _x0, double _x1, double _y0, double _y1, double _k,
+    XYRect(Real _x0, Real _x1, Real _y0, Real _y1, Real _k,
            std::shared_ptr<Material> mat)
         : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {}
 
-    virtual bool Hit(const Ray& r, double tMin, double tMax,
+    virtual bool Hit(const Ray& r, Real tMin, Real tMax,
                      HitRecord& rec) const override;
 
+    virtual bool Occluded(const Ray& r, Real tMin, Real tMax) const override {
+        Real t;
+        return intersect(r, tMin, tMax, t);
+    }
+
+    virtual void SurfaceInteraction(const Ray& r,
+                                    HitRecord& rec) const override;
+
+    virtual void CollectLights(LightList& lights) const override {
+        if (mp->IsEmissive()) lights.add(this);
+    }
+
+    virtual bool SampleLight(const Point3& origin, double time,
+                             const Point2& u,
+                             LightSample& sample) const override;
+
+    virtual bool EmitterBounds(LightBounds& bounds) const override;
+
     virtual bool BoundingBox(double time0, double time1,
                              AABB& outputBox) const override {
         // The bounding box must have non-zero width in each dimension, so pad
         // the Z dimension a small amount.
 
         outputBox =
-            AABB(Point3{x0, y0, k - 0.0001}, Point3{x1, y1, k + 0.0001});
+            AABB(Point3(x0, y0, k - 0.0001), Point3(x1, y1, k + 0.0001));
         return true;
     }
+
+   private:
+    // 与平面的交点在[tMin, tMax]内并且落在矩形里，Hit和Occluded共用
+    bool intersect(const Ray& r, Real tMin, Real tMax, Real& t) const;
 };
 class XZRect : public Hittable {
    public:
     std::shared_ptr<Material> mp;
-    double x0, x1, z0, z1, k;
+    Real x0, x1, z0, z1, k;
 
     XZRect() {}
 
-    XZRect(double _x0, double _x1, double _z0, double _z1, double _k,
+    XZRect(Real _x0, Real _x1, Real _z0, Real _z1, Real _k,
            std::shared_ptr<Material> mat)
         : x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat) {}
 
-    virtual bool Hit(const Ray& r, double tMin, double tMax,
+    virtual bool Hit(const Ray& r, Real tMin, Real tMax,
                      HitRecord& rec) const override;
 
+    virtual bool Occluded(const Ray& r, Real tMin, Real tMax) const override {
+        Real t;
+        return intersect(r, tMin, tMax, t);
+    }
+
+    virtual void SurfaceInteraction(const Ray& r,
+                                    HitRecord& rec) const override;
+
+    virtual void CollectLights(LightList& lights) const override {
+        if (mp->IsEmissive()) lights.add(this);
+    }
+
+    virtual bool SampleLight(const Point3& origin, double time,
+                             const Point2& u,
+                             LightSample& sample) const override;
+
+    virtual bool EmitterBounds(LightBounds& bounds) const override;
+
     virtual bool BoundingBox(double time0, double time1,
                              AABB& outputBox) const override {
         // The bounding box must have non-zero width in each dimension, so pad
         // the Y dimension a small amount.
 
         outputBox =
-            AABB(Point3{x0, k - 0.0001, z0}, Point3{x1, k + 0.0001, z1});
+            AABB(Point3(x0, k - 0.0001, z0), Point3(x1, k + 0.0001, z1));
         return true;
     }
+
+   private:
+    bool intersect(const Ray& r, Real tMin, Real tMax, Real& t) const;
 };
 class YZRect : public Hittable {
    public:
     std::shared_ptr<Material> mp;
-    double y0, y1, z0, z1, k;
+    Real y0, y1, z0, z1, k;
 
     YZRect() {}
 
-    YZRect(double _y0, double _y1, double _x0, double _x1, double _k,
+    YZRect(Real _y0, Real _y1, Real _x0, Real _x1, Real _k,
            std::shared_ptr<Material> mat)
         : y0(_y0), y1(_y1), z0(_x0), z1(_x1), k(_k), mp(mat) {}
 
-    virtual bool Hit(const Ray& r, double tMin, double tMax,
+    virtual bool Hit(const Ray& r, Real tMin, Real tMax,
                      HitRecord& rec) const override;
 
+    virtual bool Occluded(const Ray& r, Real tMin, Real tMax) const override {
+        Real t;
+        return intersect(r, tMin, tMax, t);
+    }
+
+    virtual void SurfaceInteraction(const Ray& r,
+                                    HitRecord& rec) const override;
+
+    virtual void CollectLights(LightList& lights) const override {
+        if (mp->IsEmissive()) lights.add(this);
+    }
+
+    virtual bool SampleLight(const Point3& origin, double time,
+                             const Point2& u,
+                             LightSample& sample) const override;
+
+    virtual bool EmitterBounds(LightBounds& bounds) const override;
+
     virtual bool BoundingBox(double time0, double time1,
                              AABB& outputBox) const override {
         // The bounding box must have non-zero width in each dimension, so pad
         // the X dimension a small amount.
 
         outputBox =
-            AABB(Point3{k - 0.0001, y0, z0}, Point3{k + 0.0001, y1, z1});
+            AABB(Point3(k - 0.0001, y0, z0), Point3(k + 0.0001, y1, z1));
         return true;
     }
+
+   private:
+    bool intersect(const Ray& r, Real tMin, Real tMax, Real& t) const;
 };
 
-bool XYRect::Hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
-    auto t = (k - r.Origin().Z()) / r.Direction().Z();
+// 在矩形上按面积均匀采样时，从origin采到point的立体角pdf
+inline double RectLightPdf(const Point3& origin, const Point3& point,
+                           const Vec3& normal, double area) {
+    auto direction = point - origin;
+    auto distanceSquared = direction.LengthSquared();
+    auto cosine = fabs(Dot(direction, normal)) / sqrt(distanceSquared);
+    if (cosine < 1e-8) return 0;
+    return distanceSquared / (cosine * area);
+}
+
+inline bool SampleRectLight(const Point3& origin, const Point3& point,
+                            const Vec3& normal, double area,
+                            LightSample& sample) {
+    sample.direction = point - origin;
+    sample.pdf = RectLightPdf(origin, point, normal, area);
+    return sample.pdf > 0;
+}
+
+// 矩形两面都发光，法线都是normal；功率按中心处的发光估计
+inline bool RectEmitterBounds(const Material& material, const AABB& box,
+                              const Vec3& normal, double area,
+                              LightBounds& bounds) {
+    if (!material.IsEmissive()) return false;
+    bounds.box = box;
+    auto center = 0.5 * (box.Min() + box.Max());
+    bounds.axis = normal;
+    bounds.phi = 2 * Luminance(material.Emitted(0.5, 0.5, center)) * area;
+    bounds.cosThetaO = 1;
+    bounds.cosThetaE = 0;
+    bounds.twoSided = true;
+    return true;
+}
+
+bool XYRect::intersect(const Ray& r, Real tMin, Real tMax, Real& t) const {
+    RTW_STAT_PRIMITIVE(PrimitiveType::Rect);
+    t = (k - r.Origin().Z()) / r.Direction().Z();
     if (t < tMin || t > tMax) {
         return false;
     }
@@ -86,19 +186,40 @@ bool XYRect::Hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
     if (x < x0 || x > x1 || y < y0 || y > y1) {
         return false;
     }
-    rec.u = (x - x0) / (x1 - x0);
-    rec.v = (y - y0) / (y1 - y0);
+    return true;
+}
+
+bool XYRect::Hit(const Ray& r, Real tMin, Real tMax, HitRecord& rec) const {
+    Real t;
+    if (!intersect(r, tMin, tMax, t)) return false;
     rec.t = t;
+    rec.object = this;
+    return true;
+}
 
+void XYRect::SurfaceInteraction(const Ray& r, HitRecord& rec) const {
+    // 平面上的坐标直接取k，交点没有垂直于平面的误差
+    rec.p = r.at(rec.t);
+    rec.p[2] = k;
+    rec.pError = Vec3(0, 0, 0);
     auto outwardNormal = Vec3{0, 0, 1};
     rec.SetFaceNormal(r, outwardNormal);
     rec.matPtr = mp;
-    rec.p = r.at(t);
-    return true;
+    if (mp->IsEmissive()) {
+        auto area = (x1 - x0) * (y1 - y0);
+        rec.lightPdf = RectLightPdf(r.Origin(), rec.p, outwardNormal, area);
+        rec.light = this;
+    }
+    if (mp->NeedsUV()) {
+        rec.u = (rec.p.X() - x0) / (x1 - x0);
+        rec.v = (rec.p.Y() - y0) / (y1 - y0);
+        rec.SetUVFootprint(r, 1 / fmin(x1 - x0, y1 - y0));
+    }
 }
 
-bool XZRect::Hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
-    auto t = (k - r.Origin().Y()) / r.Direction().Y();
+bool XZRect::intersect(const Ray& r, Real tMin, Real tMax, Real& t) const {
+    RTW_STAT_PRIMITIVE(PrimitiveType::Rect);
+    t = (k - r.Origin().Y()) / r.Direction().Y();
     if (t < tMin || t > tMax) {
         return false;
     }
@@ -107,18 +228,39 @@ bool XZRect::Hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
     if (x < x0 || x > x1 || z < z0 || z > z1) {
         return false;
     }
-    rec.u = (x - x0) / (x1 - x0);
-    rec.v = (z - z0) / (z1 - z0);
+    return true;
+}
+
+bool XZRect::Hit(const Ray& r, Real tMin, Real tMax, HitRecord& rec) const {
+    Real t;
+    if (!intersect(r, tMin, tMax, t)) return false;
     rec.t = t;
+    rec.object = this;
+    return true;
+}
 
+void XZRect::SurfaceInteraction(const Ray& r, HitRecord& rec) const {
+    rec.p = r.at(rec.t);
+    rec.p[1] = k;
+    rec.pError = Vec3(0, 0, 0);
     auto outwardNormal = Vec3{0, 1, 0};
     rec.SetFaceNormal(r, outwardNormal);
     rec.matPtr = mp;
-    rec.p = r.at(t);
-    return true;
+    if (mp->IsEmissive()) {
+        auto area = (x1 - x0) * (z1 - z0);
+        rec.lightPdf = RectLightPdf(r.Origin(), rec.p, outwardNormal, area);
+        rec.light = this;
+    }
+    if (mp->NeedsUV()) {
+        rec.u = (rec.p.X() - x0) / (x1 - x0);
+        rec.v = (rec.p.Z() - z0) / (z1 - z0);
+        rec.SetUVFootprint(r, 1 / fmin(x1 - x0, z1 - z0));
+    }
 }
-bool YZRect::Hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
-    auto t = (k - r.Origin().X()) / r.Direction().X();
+
+bool YZRect::intersect(const Ray& r, Real tMin, Real tMax, Real& t) const {
+    RTW_STAT_PRIMITIVE(PrimitiveType::Rect);
+    t = (k - r.Origin().X()) / r.Direction().X();
     if (t < tMin || t > tMax) {
         return false;
     }
@@ -127,13 +269,77 @@ bool YZRect::Hit(const Ray& r, double tMin, double tMax, HitRecord& rec) const {
     if (z < z0 || z > z1 || y < y0 || y > y1) {
         return false;
     }
-    rec.u = (y - y0) / (y1 - y0);
-    rec.v = (z - z0) / (z1 - z0);
+    return true;
+}
+
+bool YZRect::Hit(const Ray& r, Real tMin, Real tMax, HitRecord& rec) const {
+    Real t;
+    if (!intersect(r, tMin, tMax, t)) return false;
     rec.t = t;
+    rec.object = this;
+    return true;
+}
 
+void YZRect::SurfaceInteraction(const Ray& r, HitRecord& rec) const {
+    rec.p = r.at(rec.t);
+    rec.p[0] = k;
+    rec.pError = Vec3(0, 0, 0);
     auto outwardNormal = Vec3{1, 0, 0};
     rec.SetFaceNormal(r, outwardNormal);
     rec.matPtr = mp;
-    rec.p = r.at(t);
-    return true;
-}
\ No newline at end of file
+    if (mp->IsEmissive()) {
+        auto area = (y1 - y0) * (z1 - z0);
+        rec.lightPdf = RectLightPdf(r.Origin(), rec.p, outwardNormal, area);
+        rec.light = this;
+    }
+    if (mp->NeedsUV()) {
+        rec.u = (rec.p.Y() - y0) / (y1 - y0);
+        rec.v = (rec.p.Z() - z0) / (z1 - z0);
+        rec.SetUVFootprint(r, 1 / fmin(y1 - y0, z1 - z0));
+    }
+}
+
+bool XYRect::SampleLight(const Point3& origin, double time,
+                         const Point2& u, LightSample& sample) const {
+    auto point = Point3(x0 + u.x * (x1 - x0), y0 + u.y * (y1 - y0), k);
+    sample.emitted = mp->Emitted(u.x, u.y, point);
+    return SampleRectLight(origin, point, Vec3{0, 0, 1},
+                           (x1 - x0) * (y1 - y0), sample);
+}
+
+bool XZRect::SampleLight(const Point3& origin, double time,
+                         const Point2& u, LightSample& sample) const {
+    auto point = Point3(x0 + u.x * (x1 - x0), k, z0 + u.y * (z1 - z0));
+    sample.emitted = mp->Emitted(u.x, u.y, point);
+    return SampleRectLight(origin, point, Vec3{0, 1, 0},
+                           (x1 - x0) * (z1 - z0), sample);
+}
+
+bool YZRect::SampleLight(const Point3& origin, double time,
+                         const Point2& u, LightSample& sample) const {
+    auto point = Point3(k, y0 + u.x * (y1 - y0), z0 + u.y * (z1 - z0));
+    sample.emitted = mp->Emitted(u.x, u.y, point);
+    return SampleRectLight(origin, point, Vec3{1, 0, 0},
+                           (y1 - y0) * (z1 - z0), sample);
+}
+
+bool XYRect::EmitterBounds(LightBounds& bounds) const {
+    AABB box;
+    BoundingBox(0, 0, box);
+    return RectEmitterBounds(*mp, box, Vec3{0, 0, 1}, (x1 - x0) * (y1 - y0),
+                             bounds);
+}
+
+bool XZRect::EmitterBounds(LightBounds& bounds) const {
+    AABB box;
+    BoundingBox(0, 0, box);
+    return RectEmitterBounds(*mp, box, Vec3{0, 1, 0}, (x1 - x0) * (z1 - z0),
+                             bounds);
+}
+
+bool YZRect::EmitterBounds(LightBounds& bounds) const {
+    AABB box;
+    BoundingBox(0, 0, box);
+    return RectEmitterBounds(*mp, box, Vec3{1, 0, 0}, (y1 - y0) * (z1 - z0),
+                             bounds);
+}
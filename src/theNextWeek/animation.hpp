@@ -0,0 +1,64 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+
+#include "arena.hpp"
+#include "bvh.hpp"
+#include "hittable_list.hpp"
+
+// The scene of an animation sequence: one BVH over all objects, refit for
+// the shutter interval of every frame instead of being rebuilt. Refitting
+// keeps the topology, so as objects move apart the nodes grow and overlap;
+// once the node areas have grown by more than rebuildThreshold on average
+// (BVHNode::AreaGrowth), the tree is rebuilt for the current frame.
+//
+// Each tree gets a SceneArena of its own, which is released together with
+// the tree when it is rebuilt, so memory stays bounded however often a
+// long sequence rebuilds.
+class AnimatedWorld {
+   private:
+    HittableList objects_;
+    // 声明在bvh_之前：析构时先销毁树的节点，再释放它们所在的内存
+    std::unique_ptr<SceneArena> arena_;
+    std::shared_ptr<BVHNode> bvh_;
+    double rebuildThreshold_;
+    int rebuilds_ = 0;
+
+    void build(double time0, double time1) {
+        std::unique_ptr<SceneArena> arena(new SceneArena);
+        std::shared_ptr<BVHNode> bvh;
+        {
+            SceneArena::Scope scope(*arena);
+            bvh = MakeShared<BVHNode>(objects_, time0, time1);
+        }
+        // 旧树先析构，它的arena随后释放
+        bvh_ = bvh;
+        arena_ = std::move(arena);
+    }
+
+   public:
+    // 先按第一帧的快门区间[time0, time1]建树
+    AnimatedWorld(const HittableList& objects, double rebuildThreshold,
+                  double time0, double time1)
+        : objects_(objects), rebuildThreshold_(rebuildThreshold) {
+        objects_.Refit(time0, time1);
+        build(time0, time1);
+    }
+
+    // Moves the scene to the shutter interval of the next frame. Returns
+    // whether the BVH had to be rebuilt.
+    bool Update(double time0, double time1) {
+        bvh_->Refit(time0, time1);
+        if (bvh_->AreaGrowth() <= rebuildThreshold_) {
+            return false;
+        }
+        build(time0, time1);
+        rebuilds_++;
+        return true;
+    }
+
+    const Hittable& World() const { return *bvh_; }
+    double AreaGrowth() const { return bvh_->AreaGrowth(); }
+    int Rebuilds() const { return rebuilds_; }
+};
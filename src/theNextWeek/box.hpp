@@ -13,35 +13,72 @@ class Box : public Hittable {
     Box() {}
     Box(const Point3& p0, const Point3& p1, std::shared_ptr<Material> ptr);
 
-    virtual bool Hit(const Ray& r, double t_min, double t_max,
+    virtual bool Hit(const Ray& r, Real t_min, Real t_max,
                      HitRecord& rec) const override;
 
+    virtual bool Occluded(const Ray& r, Real tMin, Real tMax) const override {
+        return sides.Occluded(r, tMin, tMax);
+    }
+
     virtual bool BoundingBox(double time0, double time1,
                              AABB& outputBox) const override {
         outputBox = AABB{boxMin, boxMax};
         return true;
     };
+
+    virtual bool IsConvex() const override { return true; }
+
+    virtual bool Interval(const Ray& r, Real& tEnter,
+                          Real& tExit) const override;
+
+    virtual void CollectLights(LightList& lights) const override {
+        sides.CollectLights(lights);
+    }
 };
 
 Box::Box(const Point3& p0, const Point3& p1, std::shared_ptr<Material> ptr) {
     boxMin = p0, boxMax = p1;
 
     sides.add(
-        std::make_shared<XYRect>(p0.X(), p1.X(), p0.Y(), p1.Y(), p1.Z(), ptr));
+        MakeShared<XYRect>(p0.X(), p1.X(), p0.Y(), p1.Y(), p1.Z(), ptr));
     sides.add(
-        std::make_shared<XYRect>(p0.X(), p1.X(), p0.Y(), p1.Y(), p0.Z(), ptr));
+        MakeShared<XYRect>(p0.X(), p1.X(), p0.Y(), p1.Y(), p0.Z(), ptr));
 
     sides.add(
-        std::make_shared<XZRect>(p0.X(), p1.X(), p0.Z(), p1.Z(), p1.Y(), ptr));
+        MakeShared<XZRect>(p0.X(), p1.X(), p0.Z(), p1.Z(), p1.Y(), ptr));
     sides.add(
-        std::make_shared<XZRect>(p0.X(), p1.X(), p0.Z(), p1.Z(), p0.Y(), ptr));
+        MakeShared<XZRect>(p0.X(), p1.X(), p0.Z(), p1.Z(), p0.Y(), ptr));
 
     sides.add(
-        std::make_shared<YZRect>(p0.Y(), p1.Y(), p0.Z(), p1.Z(), p1.X(), ptr));
+        MakeShared<YZRect>(p0.Y(), p1.Y(), p0.Z(), p1.Z(), p1.X(), ptr));
     sides.add(
-        std::make_shared<YZRect>(p0.Y(), p1.Y(), p0.Z(), p1.Z(), p0.X(), ptr));
+        MakeShared<YZRect>(p0.Y(), p1.Y(), p0.Z(), p1.Z(), p0.X(), ptr));
 }
 
-bool Box::Hit(const Ray& r, double t_min, double t_max, HitRecord& rec) const {
+bool Box::Hit(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const {
     return sides.Hit(r, t_min, t_max, rec);
 }
+
+// slab test
+bool Box::Interval(const Ray& r, Real& tEnter, Real& tExit) const {
+    tEnter = -infinity;
+    tExit = infinity;
+    for (int a = 0; a < 3; a++) {
+        // 和这组平面平行时0 * inf会得到NaN：起点在两个平面之间(含平面上)
+        // 则整条光线都在这个slab里，否则永远不在
+        if (r.Direction()[a] == 0) {
+            if (r.Origin()[a] < boxMin[a] || r.Origin()[a] > boxMax[a]) {
+                return false;
+            }
+            continue;
+        }
+        auto invD = 1.0 / r.Direction()[a];
+        auto t0 = (boxMin[a] - r.Origin()[a]) * invD;
+        auto t1 = (boxMax[a] - r.Origin()[a]) * invD;
+        if (invD < 0.0) std::swap(t0, t1);
+        tEnter = fmax(t0, tEnter);
+        tExit = fmin(t1, tExit);
+        if (tExit <= tEnter) return false;
+    }
+    return true;
+}
@@ -4,39 +4,41 @@
 #include "hittable_list.hpp"
 #include "rtweekend.hpp"
 
+// 按time时刻包围盒的最小角排序，重建时物体已经移动到了新的位置
 inline bool BoxCompare(const std::shared_ptr<Hittable> a,
-                       const std::shared_ptr<Hittable> b, int axis) {
+                       const std::shared_ptr<Hittable> b, int axis,
+                       double time) {
     AABB boxA;
     AABB boxB;
 
-    if (!a->BoundingBox(0, 0, boxA) || !b->BoundingBox(0, 0, boxB)) {
+    if (!a->BoundingBox(time, time, boxA) ||
+        !b->BoundingBox(time, time, boxB)) {
         std::cerr << "No bounding box in bvh_node constructor.\n";
     }
 
     return boxA.Min().e[axis] < boxB.Min().e[axis];
 }
 
-bool BoxCompareX(const std::shared_ptr<Hittable> a,
-                 const std::shared_ptr<Hittable> b) {
-    return BoxCompare(a, b, 0);
-}
-
-bool BoxCompareY(const std::shared_ptr<Hittable> a,
-                 const std::shared_ptr<Hittable> b) {
-    return BoxCompare(a, b, 1);
-}
-
-bool BoxCompareZ(const std::shared_ptr<Hittable> a,
-                 const std::shared_ptr<Hittable> b) {
-    return BoxCompare(a, b, 2);
-}
-
 class BVHNode : public Hittable {
+   private:
+    // 子树里每个节点当前表面积与建树时表面积之比的和，以及节点数
+    void areaGrowth(double& growthSum, int& nodeCount) const {
+        growthSum += builtArea > 0 ? box.SurfaceArea() / builtArea : 1;
+        nodeCount++;
+        for (const auto& child : {left, right}) {
+            auto node = dynamic_cast<const BVHNode*>(child.get());
+            if (node != nullptr) node->areaGrowth(growthSum, nodeCount);
+            if (left == right) break;
+        }
+    }
+
    public:
     std::shared_ptr<Hittable> left;
     std::shared_ptr<Hittable> right;
 
     AABB box;
+    // 建树时box的表面积
+    double builtArea = 0;
 
     BVHNode() {}
     BVHNode(const HittableList& list, double time0, double time1)
@@ -44,11 +46,31 @@ class BVHNode : public Hittable {
     BVHNode(const std::vector<std::shared_ptr<Hittable>>& src_objects,
             size_t start, size_t end, double time0, double time1);
 
-    virtual bool Hit(const Ray& r, double tMin, double tMax,
+    virtual bool Hit(const Ray& r, Real tMin, Real tMax,
                      HitRecord& rec) const override;
 
+    virtual bool Occluded(const Ray& r, Real tMin, Real tMax) const override;
+
     virtual bool BoundingBox(double time0, double time1,
                              AABB& outputBox) const override;
+
+    virtual void Refit(double time0, double time1) override;
+
+    // Average factor by which the surface areas of the nodes have grown
+    // since they were built. The chance that a ray visits a node is roughly
+    // proportional to its area, so this tracks how much more traversal
+    // work refits have added as objects moved apart.
+    double AreaGrowth() const {
+        auto growthSum = 0.0;
+        auto nodeCount = 0;
+        areaGrowth(growthSum, nodeCount);
+        return growthSum / nodeCount;
+    }
+
+    virtual void CollectLights(LightList& lights) const override {
+        left->CollectLights(lights);
+        if (right != left) right->CollectLights(lights);
+    }
 };
 
 BVHNode::BVHNode(const std::vector<std::shared_ptr<Hittable>>& src_objects,
@@ -57,9 +79,10 @@ BVHNode::BVHNode(const std::vector<std::shared_ptr<Hittable>>& src_objects,
     auto objects = src_objects;
     // 随机选择一个轴
     int axis = RandomInt(0, 2);
-    auto comparator = (axis == 0)   ? BoxCompareX
-                      : (axis == 1) ? BoxCompareY
-                                    : BoxCompareZ;
+    auto comparator = [axis, time0](const std::shared_ptr<Hittable> a,
+                                    const std::shared_ptr<Hittable> b) {
+        return BoxCompare(a, b, axis, time0);
+    };
 
     size_t objectSpan = end - start;
 
@@ -78,8 +101,8 @@ BVHNode::BVHNode(const std::vector<std::shared_ptr<Hittable>>& src_objects,
 
         auto mid = start + objectSpan / 2;
 
-        left = std::make_shared<BVHNode>(objects, start, mid, time0, time1);
-        right = std::make_shared<BVHNode>(objects, mid, end, time0, time1);
+        left = MakeShared<BVHNode>(objects, start, mid, time0, time1);
+        right = MakeShared<BVHNode>(objects, mid, end, time0, time1);
     }
 
     AABB boxLeft, boxRight;
@@ -89,10 +112,12 @@ BVHNode::BVHNode(const std::vector<std::shared_ptr<Hittable>>& src_objects,
         std::cerr << "No bounding box in bvh_node constructor.\n";
     }
     box = SurroundingBox(boxLeft, boxRight);
+    builtArea = box.SurfaceArea();
 }
 
-bool BVHNode::Hit(const Ray& r, double tMin, double tMax,
+bool BVHNode::Hit(const Ray& r, Real tMin, Real tMax,
                   HitRecord& rec) const {
+    RTW_STAT_NODE();
     if (!box.Hit(r, tMin, tMax)) {
         return false;
     }
@@ -103,6 +128,26 @@ bool BVHNode::Hit(const Ray& r, double tMin, double tMax,
     return hitLeft || hitRight;
 }
 
+// 左子树命中就不再访问右子树
+bool BVHNode::Occluded(const Ray& r, Real tMin, Real tMax) const {
+    RTW_STAT_NODE();
+    if (!box.Hit(r, tMin, tMax)) {
+        return false;
+    }
+    return left->Occluded(r, tMin, tMax) || right->Occluded(r, tMin, tMax);
+}
+
+void BVHNode::Refit(double time0, double time1) {
+    left->Refit(time0, time1);
+    if (right != left) right->Refit(time0, time1);
+
+    AABB boxLeft, boxRight;
+    if (left->BoundingBox(time0, time1, boxLeft) &&
+        right->BoundingBox(time0, time1, boxRight)) {
+        box = SurroundingBox(boxLeft, boxRight);
+    }
+}
+
 bool BVHNode::BoundingBox(double time0, double time1, AABB& outputBox) const {
     outputBox = box;
     return true;
@@ -1,82 +1,133 @@
 #pragma once
 
+#include "fast_math.hpp"
 #include "hittable.hpp"
 #include "material.hpp"
 #include "rtweekend.hpp"
 #include "texture.hpp"
 
+// 均匀介质。边界是凸的(球、盒子以及它们的变换)时用Interval()一次求出
+// 进出的位置；没有边界时介质充满整个空间，不做任何边界测试
 class ConstantMedium : public Hittable {
+   private:
+    bool boundarySpan(const Ray& r, Real& tEnter, Real& tExit) const;
+
    public:
     std::shared_ptr<Hittable> boundary;
     std::shared_ptr<Material> phaseFunction;
     double negInvDensity;
+    bool convexBoundary;
 
     ConstantMedium(std::shared_ptr<Hittable> b, double d,
                    std::shared_ptr<Texture> a)
         : boundary(b),
           negInvDensity(-1 / d),
-          phaseFunction(std::make_shared<Isotropic>(a)) {}
+          phaseFunction(MakeMaterial<Isotropic>(a)),
+          convexBoundary(b->IsConvex()) {}
 
     ConstantMedium(std::shared_ptr<Hittable> b, double d, Color c)
         : boundary(b),
           negInvDensity(-1 / d),
-          phaseFunction(std::make_shared<Isotropic>(c)) {}
+          phaseFunction(MakeMaterial<Isotropic>(c)),
+          convexBoundary(b->IsConvex()) {}
+
+    // A medium without a boundary that fills all of space. Every ray that
+    // would otherwise escape to the background scatters somewhere, so paths
+    // only end at the depth limit; wrap the scene in a large sphere instead
+    // when escaping rays matter.
+    ConstantMedium(double d, Color c)
+        : phaseFunction(MakeMaterial<Isotropic>(c)),
+          negInvDensity(-1 / d),
+          convexBoundary(false) {}
 
-    virtual bool Hit(const Ray& r, double tMin, double tMax,
+    virtual bool Hit(const Ray& r, Real tMin, Real tMax,
                      HitRecord& rec) const override;
 
+    virtual void SurfaceInteraction(const Ray& r,
+                                    HitRecord& rec) const override;
+
     virtual bool BoundingBox(double time0, double time1,
                              AABB& outputBox) const override {
-        return boundary->BoundingBox(time0, time1, outputBox);
+        return boundary != nullptr &&
+               boundary->BoundingBox(time0, time1, outputBox);
+    }
+
+    virtual void Refit(double time0, double time1) override {
+        if (boundary != nullptr) boundary->Refit(time0, time1);
     }
 };
 
-bool ConstantMedium::Hit(const Ray& r, double tMin, double tMax,
+bool ConstantMedium::Hit(const Ray& r, Real tMin, Real tMax,
                          HitRecord& rec) const {
+    RTW_STAT_PRIMITIVE(PrimitiveType::Medium);
     // Print occasional samples when debugging. To enable, set enableDebug true.
     const bool enableDebug = false;
     const bool debugging = enableDebug && RandomDouble() < 0.00001;
 
-    HitRecord rec1, rec2;
-
-    if (!boundary->Hit(r, -infinity, infinity, rec1)) {
-        return false;
-    }
-
-    if (!boundary->Hit(r, rec1.t + 0.0001, infinity, rec2)) {
+    Real tEnter, tExit;
+    if (!boundarySpan(r, tEnter, tExit)) {
         return false;
     }
 
     if (debugging)
-        std::cerr << "\nt_min=" << rec1.t << ", t_max=" << rec2.t << '\n';
+        std::cerr << "\nt_min=" << tEnter << ", t_max=" << tExit << '\n';
 
-    if (rec1.t < tMin) rec1.t = tMin;
-    if (rec2.t > tMax) rec2.t = tMax;
+    if (tEnter < tMin) tEnter = tMin;
+    if (tExit > tMax) tExit = tMax;
 
-    if (rec1.t >= rec2.t) {
+    if (tEnter >= tExit) {
         return false;
     }
 
-    if (rec1.t < 0) rec1.t = 0;
+    if (tEnter < 0) tEnter = 0;
 
     const auto rayLength = r.Direction().Length();
-    const auto distanceInsideBoundary = (rec2.t - rec1.t) * rayLength;
-    const auto hitDistance = negInvDensity * log(RandomDouble());
+    const auto distanceInsideBoundary = (tExit - tEnter) * rayLength;
+    const auto hitDistance = negInvDensity * Log(RandomDouble());
 
     if (hitDistance > distanceInsideBoundary) return false;
 
-    rec.t = rec1.t + hitDistance / rayLength;
-    rec.p = r.at(rec.t);
+    rec.t = tEnter + hitDistance / rayLength;
+    rec.object = this;
 
     if (debugging) {
         std::cerr << "hit_distance = " << hitDistance << '\n'
-                  << "rec.t = " << rec.t << '\n'
-                  << "rec.p = " << rec.p << '\n';
+                  << "rec.t = " << rec.t << '\n';
+    }
+
+    return true;
+}
+
+bool ConstantMedium::boundarySpan(const Ray& r, Real& tEnter,
+                                  Real& tExit) const {
+    if (boundary == nullptr) {
+        tEnter = -infinity;
+        tExit = infinity;
+        return true;
+    }
+    if (convexBoundary) {
+        return boundary->Interval(r, tEnter, tExit);
+    }
+
+    // 一般的边界：第一个交点是进入点，之后的下一个交点是离开点
+    HitRecord rec1, rec2;
+    if (!boundary->Hit(r, -infinity, infinity, rec1)) {
+        return false;
     }
+    if (!boundary->Hit(r, rec1.t + 0.0001, infinity, rec2)) {
+        return false;
+    }
+    tEnter = rec1.t;
+    tExit = rec2.t;
+    return true;
+}
 
+void ConstantMedium::SurfaceInteraction(const Ray& r, HitRecord& rec) const {
+    RTW_STAT_MEDIUM_SCATTER();
+    rec.p = r.at(rec.t);
+    // 介质内部的散射点不在任何表面上，不需要推离
+    rec.pError = Vec3(0, 0, 0);
     rec.normal = Vec3(1, 0, 0);  // arbitrary
     rec.front_face = true;       // also arbitrary
     rec.matPtr = phaseFunction;
-
-    return true;
 }
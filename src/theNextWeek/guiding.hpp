@@ -0,0 +1,491 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "aabb.hpp"
+#include "fast_math.hpp"
+#include "rtweekend.hpp"
+#include "sampler.hpp"
+
+// Online path guiding after Müller et al., "Practical Path Guiding for
+// Efficient Light-Transport Simulation" (2017). Space is cut into cells by
+// a binary tree; every cell holds a quadtree over the sphere of directions
+// that learns where the incident radiance at the cell comes from. Training
+// renders passes of 1, 2, 4, ... samples per pixel: each pass samples from
+// the distributions learned by the passes before it and records what its
+// own paths find, and after the pass the cells that saw many samples are
+// split and the quadtrees are refined where the energy is.
+
+// 原子地把value加到target上
+inline void AtomicAdd(std::atomic<float>& target, float value) {
+    auto current = target.load(std::memory_order_relaxed);
+    while (!target.compare_exchange_weak(current, current + value,
+                                         std::memory_order_relaxed)) {
+    }
+}
+
+// 单位方向和[0,1]^2之间保面积的映射(圆柱投影)：x是(cosθ + 1) / 2，
+// y是φ / 2π。正方形上的密度除以4π就是立体角上的密度。方向只用来找
+// 四叉树的叶子，FastAtan2的精度足够，不随RTW_FAST_MATH切换
+inline Point2 DirectionToSquare(const Vec3& direction) {
+    auto d = UnitVector(direction);
+    auto cosTheta = Clamp(d.Z(), -1.0, 1.0);
+    auto phi = FastAtan2(d.Y(), d.X());
+    if (phi < 0) phi += 2 * pi;
+    return Point2{(cosTheta + 1) / 2, phi / (2 * pi)};
+}
+
+inline Vec3 SquareToDirection(const Point2& p) {
+    auto cosTheta = 2 * p.x - 1;
+    auto sinTheta = sqrt(fmax(0.0, 1 - cosTheta * cosTheta));
+    auto phi = 2 * pi * p.y;
+    return Vec3(sinTheta * cos(phi), sinTheta * sin(phi), cosTheta);
+}
+
+// Quadtree over the square of DirectionToSquare. Every node splits its
+// square into four quadrants and keeps the energy recorded in each; a
+// quadrant without a child is a leaf, within which the density is
+// uniform. Record() may be called from many threads at once, everything
+// else runs between passes.
+class DirectionalTree {
+   private:
+    struct Node {
+        // 叶子象限由Record累加，有子节点的象限在Build时求和
+        std::atomic<float> sums[4];
+        // 象限的子节点，0表示叶子(0号是根节点，不会是谁的子节点)
+        uint32_t children[4];
+
+        Node() {
+            for (int q = 0; q < 4; q++) {
+                sums[q].store(0, std::memory_order_relaxed);
+                children[q] = 0;
+            }
+        }
+
+        Node(const Node& other) { *this = other; }
+
+        Node& operator=(const Node& other) {
+            for (int q = 0; q < 4; q++) {
+                sums[q].store(other.Sum(q), std::memory_order_relaxed);
+                children[q] = other.children[q];
+            }
+            return *this;
+        }
+
+        float Sum(int q) const {
+            return sums[q].load(std::memory_order_relaxed);
+        }
+
+        float Sum() const { return Sum(0) + Sum(1) + Sum(2) + Sum(3); }
+
+        // p所在的象限，同时把p变换到这个象限自己的[0,1]^2里
+        static int Quadrant(Point2& p) {
+            int q = 0;
+            if (p.x >= 0.5) {
+                q |= 1;
+                p.x = 2 * p.x - 1;
+            } else {
+                p.x *= 2;
+            }
+            if (p.y >= 0.5) {
+                q |= 2;
+                p.y = 2 * p.y - 1;
+            } else {
+                p.y *= 2;
+            }
+            return q;
+        }
+    };
+
+    std::vector<Node> nodes_;
+    // 这一遍记录的样本数，决定空间上要不要细分
+    std::atomic<uint64_t> sampleCount_;
+    // Build之后整棵树的能量，为0时不能用来采样
+    float total_ = 0;
+
+    float build(uint32_t index) {
+        for (int q = 0; q < 4; q++) {
+            auto child = nodes_[index].children[q];
+            if (child != 0) {
+                nodes_[index].sums[q].store(build(child),
+                                            std::memory_order_relaxed);
+            }
+        }
+        return nodes_[index].Sum();
+    }
+
+   public:
+    DirectionalTree() : nodes_(1), sampleCount_(0) {}
+
+    DirectionalTree(const DirectionalTree& other)
+        : nodes_(other.nodes_),
+          sampleCount_(other.SampleCount()),
+          total_(other.total_) {}
+
+    DirectionalTree& operator=(const DirectionalTree& other) {
+        nodes_ = other.nodes_;
+        sampleCount_.store(other.SampleCount(), std::memory_order_relaxed);
+        total_ = other.total_;
+        return *this;
+    }
+
+    uint64_t SampleCount() const {
+        return sampleCount_.load(std::memory_order_relaxed);
+    }
+
+    void SetSampleCount(uint64_t count) {
+        sampleCount_.store(count, std::memory_order_relaxed);
+    }
+
+    size_t NodeCount() const { return nodes_.size(); }
+
+    bool CanSample() const { return total_ > 0; }
+
+    // 把一个样本的value(辐亮度除以方向的pdf)加到direction所在的叶子上
+    void Record(const Vec3& direction, double value) {
+        sampleCount_.fetch_add(1, std::memory_order_relaxed);
+        if (!(value > 0) || !std::isfinite(value)) return;
+        auto p = DirectionToSquare(direction);
+        uint32_t index = 0;
+        while (true) {
+            auto q = Node::Quadrant(p);
+            auto child = nodes_[index].children[q];
+            if (child == 0) {
+                AtomicAdd(nodes_[index].sums[q], static_cast<float>(value));
+                return;
+            }
+            index = child;
+        }
+    }
+
+    // 一遍结束后把叶子的能量向上求和，之后就可以采样
+    void Build() { total_ = build(0); }
+
+    // 从根往下，按能量选择象限，u每一步重新缩放到[0, 1)；pdf是选到的
+    // 方向的立体角密度，和Pdf()相同
+    Vec3 Sample(Point2 u, double& pdf) const {
+        Point2 origin{0, 0};
+        auto size = 1.0;
+        // 选中的象限的能量之积和所在节点的能量之积，最后做一次除法
+        auto numerator = 1.0, denominator = 1.0;
+        uint32_t index = 0;
+        while (true) {
+            const auto& node = nodes_[index];
+            // 先按左右两列的能量选x，再在选中的列里选y
+            double s[4] = {node.Sum(0), node.Sum(1), node.Sum(2), node.Sum(3)};
+            auto left = s[0] + s[2];
+            auto total = left + s[1] + s[3];
+            int q = 0;
+            if (u.x * total < left) {
+                u.x = fmin(u.x * total / left, oneMinusEpsilon);
+            } else {
+                q |= 1;
+                u.x = fmin((u.x * total - left) / (total - left),
+                           oneMinusEpsilon);
+            }
+            auto column = s[q] + s[q | 2];
+            if (u.y * column < s[q]) {
+                u.y = fmin(u.y * column / s[q], oneMinusEpsilon);
+            } else {
+                u.y = fmin((u.y * column - s[q]) / s[q | 2], oneMinusEpsilon);
+                q |= 2;
+            }
+            size /= 2;
+            origin.x += (q & 1) * size;
+            origin.y += (q >> 1) * size;
+            numerator *= 4 * s[q];
+            denominator *= total;
+            if (node.children[q] == 0) break;
+            index = node.children[q];
+        }
+        pdf = numerator / (denominator * 4 * pi);
+        return SquareToDirection(
+            Point2{origin.x + u.x * size, origin.y + u.y * size});
+    }
+
+    // Sample()选到direction的立体角密度
+    double Pdf(const Vec3& direction) const {
+        if (total_ <= 0) return 0;
+        auto p = DirectionToSquare(direction);
+        auto numerator = 1.0, denominator = 4 * pi;
+        uint32_t index = 0;
+        while (true) {
+            const auto& node = nodes_[index];
+            auto q = Node::Quadrant(p);
+            auto sum = node.Sum(q);
+            if (sum <= 0) return 0;
+            numerator *= 4 * sum;
+            denominator *= node.Sum();
+            if (node.children[q] == 0) return numerator / denominator;
+            index = node.children[q];
+        }
+    }
+
+    // Sample() for a surface point with the given normal: directions behind
+    // the surface would be wasted, so they are mirrored in the tangent
+    // plane, and the density in front is that of the direction plus that
+    // of its mirror image. A zero normal (a point in a medium) keeps the
+    // whole sphere.
+    Vec3 Sample(Point2 u, const Vec3& normal, double& pdf) const {
+        auto direction = Sample(u, pdf);
+        if (normal.NearZero()) return direction;
+        auto mirror = Reflect(direction, normal);
+        pdf += Pdf(mirror);
+        return Dot(direction, normal) < 0 ? mirror : direction;
+    }
+
+    double Pdf(const Vec3& direction, const Vec3& normal) const {
+        if (normal.NearZero()) return Pdf(direction);
+        if (Dot(direction, normal) <= 0) return 0;
+        return Pdf(direction) + Pdf(Reflect(direction, normal));
+    }
+
+    // Rebuilds the structure for the next pass from the energy previous
+    // has learned: a quadrant holding more than threshold of the total is
+    // split, down to maxDepth levels. Where previous has a leaf, its energy
+    // is spread evenly over the new quadrants, so one refinement can split
+    // a leaf several levels deep. The recorded energy starts from zero.
+    void Refine(const DirectionalTree& previous, int maxDepth,
+                double threshold) {
+        nodes_.assign(1, Node());
+        SetSampleCount(0);
+        total_ = 0;
+        if (previous.total_ <= 0) return;
+
+        // other是tree里对应的节点；tree为this时是新建的节点自己
+        struct Entry {
+            uint32_t node;
+            const DirectionalTree* tree;
+            uint32_t other;
+            int depth;
+        };
+        std::vector<Entry> stack{Entry{0, &previous, 0, 1}};
+        while (!stack.empty()) {
+            auto entry = stack.back();
+            stack.pop_back();
+            for (int q = 0; q < 4; q++) {
+                // emplace_back可能让引用失效，每个象限重新取
+                const auto& other = entry.tree->nodes_[entry.other];
+                auto sum = other.Sum(q);
+                if (entry.depth >= maxDepth ||
+                    sum <= threshold * previous.total_) {
+                    continue;
+                }
+                auto child = static_cast<uint32_t>(nodes_.size());
+                if (other.children[q] != 0) {
+                    stack.push_back(Entry{child, entry.tree,
+                                          other.children[q],
+                                          entry.depth + 1});
+                } else {
+                    stack.push_back(Entry{child, this, child, entry.depth + 1});
+                }
+                nodes_[entry.node].children[q] = child;
+                nodes_.emplace_back();
+                for (auto& s : nodes_.back().sums) {
+                    s.store(sum / 4, std::memory_order_relaxed);
+                }
+            }
+        }
+        for (auto& node : nodes_) {
+            for (auto& s : node.sums) s.store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+// 一个空间格子：上一遍学到的分布用来采样，这一遍的样本记到另一棵树里
+struct GuidingCell {
+    DirectionalTree sampling;
+    DirectionalTree recording;
+};
+
+// The spatial half of the SD-tree: a binary tree over the scene's bounding
+// cube whose splits cycle through x, y and z, so every cell stays roughly
+// cubic. After pass k (2^k samples per pixel) a cell is split when it
+// recorded more than spatialThreshold * sqrt(2^k) samples, which gives
+// every cell about the same number of samples to learn from as the
+// passes grow. Both halves of a split cell start from its distribution.
+class PathGuide {
+   private:
+    struct Node {
+        GuidingCell cell;
+        // 两个子节点，children[0]为0时是叶子
+        uint32_t children[2] = {0, 0};
+        int axis = 0;
+
+        bool IsLeaf() const { return children[0] == 0; }
+    };
+
+    Point3 origin_;
+    double size_ = 1;
+    std::vector<Node> nodes_;
+    int pass_ = 0;
+    bool training_ = true;
+
+    void split(size_t index) {
+        auto child = static_cast<uint32_t>(nodes_.size());
+        Node node;
+        node.axis = (nodes_[index].axis + 1) % 3;
+        node.cell.recording = nodes_[index].cell.recording;
+        node.cell.recording.SetSampleCount(
+            node.cell.recording.SampleCount() / 2);
+        nodes_.push_back(node);
+        nodes_.push_back(node);
+        nodes_[index].children[0] = child;
+        nodes_[index].children[1] = child + 1;
+        // 内部节点不再需要分布
+        nodes_[index].cell = GuidingCell();
+    }
+
+   public:
+    static const int maxDirectionalDepth = 20;
+    // 能量超过整个球面的这个比例的象限继续细分
+    static constexpr double directionalThreshold = 0.01;
+    static constexpr double spatialThreshold = 12000;
+    // 引导的顶点以这个概率按材质采样，其余按学到的分布
+    static constexpr double bsdfFraction = 0.5;
+
+    // 包围盒扩成立方体，再放大一点，边界上的点不会落到外面
+    explicit PathGuide(const AABB& bounds) : nodes_(1) {
+        auto extent = bounds.Max() - bounds.Min();
+        size_ = 1.01 * std::max({extent.X(), extent.Y(), extent.Z(),
+                                 static_cast<Real>(1e-3)});
+        origin_ = (bounds.Min() + bounds.Max()) / 2 -
+                  Vec3(size_ / 2, size_ / 2, size_ / 2);
+    }
+
+    // 训练时记录路径找到的辐亮度，最后一遍只采样
+    bool Training() const { return training_; }
+    void SetTraining(bool training) { training_ = training; }
+
+    // 已经完成的训练遍数
+    int Passes() const { return pass_; }
+
+    size_t CellCount() const { return (nodes_.size() + 1) / 2; }
+
+    // 方向四叉树的节点总数(采样用的那一份)
+    size_t DirectionalNodeCount() const {
+        size_t count = 0;
+        for (const auto& node : nodes_) {
+            if (node.IsLeaf()) count += node.cell.sampling.NodeCount();
+        }
+        return count;
+    }
+
+    // p所在的格子；包围立方体外面的点算到最近的格子里
+    GuidingCell& Lookup(const Point3& p) {
+        double x[3];
+        for (int a = 0; a < 3; a++) {
+            x[a] = Clamp((p[a] - origin_[a]) / size_, 0.0, 1.0);
+        }
+        uint32_t index = 0;
+        while (!nodes_[index].IsLeaf()) {
+            const auto& node = nodes_[index];
+            auto& c = x[node.axis];
+            if (c < 0.5) {
+                c *= 2;
+                index = node.children[0];
+            } else {
+                c = 2 * c - 1;
+                index = node.children[1];
+            }
+        }
+        return nodes_[index].cell;
+    }
+
+    // Ends a training pass: sums up what the pass recorded, splits the
+    // cells that saw too many samples, makes the new energy the sampling
+    // distribution and refines the quadtrees that the next pass records
+    // into.
+    void Refine() {
+        for (auto& node : nodes_) {
+            if (node.IsLeaf()) node.cell.recording.Build();
+        }
+        auto threshold = spatialThreshold * sqrt(std::ldexp(1.0, pass_));
+        // 新加的子节点排在后面，同一个循环里会继续检查
+        for (size_t i = 0; i < nodes_.size(); i++) {
+            if (nodes_[i].IsLeaf() &&
+                nodes_[i].cell.recording.SampleCount() > threshold) {
+                split(i);
+            }
+        }
+        for (auto& node : nodes_) {
+            if (!node.IsLeaf()) continue;
+            node.cell.sampling = node.cell.recording;
+            node.cell.recording.Refine(node.cell.sampling, maxDirectionalDepth,
+                                       directionalThreshold);
+        }
+        pass_++;
+    }
+};
+
+// Samples per pixel of the passes of a guided render with a budget of
+// totalSpp: 1, 2, 4, ... while the budget left after a pass would still
+// cover the next, twice as long pass; the last pass takes all that is
+// left. Every pass but the last also trains the guide; PassCombiner
+// merges all passes of two or more samples into the image.
+inline std::vector<int> GuidingPasses(int totalSpp) {
+    std::vector<int> passes;
+    auto left = std::max(totalSpp, 1);
+    for (auto n = 1; left > 0; n *= 2) {
+        auto samples = left - n < 2 * n ? left : n;
+        passes.push_back(samples);
+        left -= samples;
+    }
+    return passes;
+}
+
+// Combines the passes of a guided render into one image, weighting each
+// pass by the inverse of its estimated variance, so that the training
+// passes are not wasted but a pass from a poorly trained guide counts
+// less. A pass is rendered as two halves; the squared difference of their
+// means, averaged over the image, estimates the variance of the pass. The
+// difference is taken in display space (gamma 2, clamped to 1) as in the
+// written image: in linear space one firefly could decide the weight of a
+// whole pass. Passes of one sample cannot be split and are left out.
+// The weights are estimated from the same samples they weight, so the
+// combined image is biased, though consistent: the bias vanishes as the
+// passes grow.
+class PassCombiner {
+   private:
+    std::vector<Color> sum_;
+    double weight_ = 0;
+
+   public:
+    // first和second是同一遍的两半，各自是n1和n2个样本之和；返回这一遍
+    // 平均值的方差估计
+    double Add(const std::vector<Color>& first, int n1,
+               const std::vector<Color>& second, int n2) {
+        auto display = [](double c) { return Clamp(sqrt(fmax(c, 0.0)), 0, 1); };
+        sum_.resize(first.size(), Color{0, 0, 0});
+        auto squares = 0.0;
+        for (size_t p = 0; p < first.size(); p++) {
+            for (int c = 0; c < 3; c++) {
+                auto d = display(first[p][c] / n1) - display(second[p][c] / n2);
+                squares += d * d;
+            }
+        }
+        // 两半之差的方差是σ^2 (1/n1 + 1/n2)，整遍平均值的方差是σ^2 / n
+        auto n = n1 + n2;
+        auto variance =
+            squares / (3 * first.size()) / (1.0 / n1 + 1.0 / n2) / n;
+        auto weight = 1 / fmax(variance, 1e-20);
+        for (size_t p = 0; p < first.size(); p++) {
+            sum_[p] += (first[p] + second[p]) * (weight / n);
+        }
+        weight_ += weight;
+        return variance;
+    }
+
+    bool Empty() const { return weight_ == 0; }
+
+    // 加权平均，每个像素相当于一个样本
+    std::vector<Color> Image() const {
+        std::vector<Color> image(sum_.size());
+        for (size_t p = 0; p < sum_.size(); p++) image[p] = sum_[p] / weight_;
+        return image;
+    }
+};
@@ -1,66 +1,271 @@
 #pragma once
 
+#include <vector>
+
 #include "aabb.hpp"
 #include "ray.hpp"
 #include "rtweekend.hpp"
+#include "sampler.hpp"
+#include "stats.hpp"
 
 class Material;
+class Hittable;
 
 class HitRecord {
    public:
     Point3 p;
+    // p离真实表面可能有多远(每个分量的绝对误差界)，由图元在
+    // SurfaceInteraction中给出；只沿表面滑动的误差不影响自相交，可以不计
+    Vec3 pError;
     Vec3 normal;
     std::shared_ptr<Material> matPtr;
-    double t;
+    Real t;
 
     // 对于球体的一个点(θ,ϕ)
     // 其纹理坐标u = ϕ/2Π, v = θ/Π
-    double u, v;
+    double u = 0, v = 0;
+    // 光线锥在交点处的宽度，换算到uv空间
+    double uvFootprint = 0;
 
     bool front_face;
+    // 命中的是可采样的光源时，SampleLight()从光线起点采到这一点的立体角pdf
+    // 其他情况为0
+    double lightPdf = 0;
+
+    // 遍历阶段图元只记录t和自身，表面信息在确定最近交点后由Resolve计算
+    const Hittable* object = nullptr;
+    // 和lightPdf一起设置：命中的光源图元，用来查它在光源树里的选择概率
+    const Hittable* light = nullptr;
 
     inline void SetFaceNormal(const Ray& r, const Vec3& outward_normal) {
         front_face = Dot(r.Direction(), outward_normal) < 0;
         normal = front_face ? outward_normal : -outward_normal;
     }
+
+    // Width of the ray cone at the hit in world units.
+    double Footprint(const Ray& r) const {
+        return r.width + t * r.Direction().Length() * r.spread;
+    }
+
+    // uvPerUnit: how fast u and v change per world unit on the surface.
+    void SetUVFootprint(const Ray& r, double uvPerUnit) {
+        uvFootprint = Footprint(r) * uvPerUnit;
+    }
+
+    // 从交点出发的光线，起点按误差界推离表面(见OffsetRayOrigin)
+    Ray SpawnRay(const Vec3& direction, Real time) const {
+        return Ray(OffsetRayOrigin(p, pError, normal, direction), direction,
+                   time);
+    }
+
+    // 从交点到target的光线，t = 1时到达target
+    Ray SpawnRayTo(const Point3& target, Real time) const {
+        auto origin = OffsetRayOrigin(p, pError, normal, target - p);
+        return Ray(origin, target - origin, time);
+    }
+
+    inline void Resolve(const Ray& r);
 };
 
+// A point sampled on an emitter, as seen from a shading point.
+struct LightSample {
+    // from the shading point to the sampled point (t = 1 at the light)
+    Vec3 direction;
+    // solid angle density of direction
+    double pdf;
+    Color emitted;
+};
+
+// Where an emitter is, which way it faces and how much it emits, for the
+// light tree. Every normal of the emitter lies within cosThetaO of axis,
+// and each point emits within cosThetaE of its normal (0 for diffuse
+// emitters, which emit over the whole hemisphere).
+struct LightBounds {
+    AABB box;
+    Vec3 axis{0, 0, 1};
+    // 发光功率(省略了漫射光源共有的因子π)
+    double phi = 0;
+    double cosThetaO = 1;
+    double cosThetaE = 0;
+    // 两面都发光，例如矩形光源
+    bool twoSided = false;
+};
+
+class LightList;
+
 class Hittable {
    public:
-    virtual bool Hit(const Ray& r, double t_min, double t_max,
+    virtual bool Hit(const Ray& r, Real t_min, Real t_max,
                      HitRecord& rec) const = 0;
 
+    // Any-hit query: whether anything blocks r within [tMin, tMax]. Unlike
+    // Hit() it may stop at the first intersection it finds and never
+    // resolves surface data, which is all a visibility test needs. The
+    // default falls back to Hit() with a scratch record.
+    virtual bool Occluded(const Ray& r, Real tMin, Real tMax) const {
+        HitRecord rec;
+        return Hit(r, tMin, tMax, rec);
+    }
+
+    // Fill in p, normal, material and (if needed) uv for a hit this object
+    // reported in Hit(). Only called once, for the closest hit.
+    virtual void SurfaceInteraction(const Ray& r, HitRecord& rec) const {}
+
     virtual bool BoundingBox(double time0, double time1,
                              AABB& outputBox) const = 0;
+
+    // Recomputes any bounds cached for a shutter interval (BVH nodes,
+    // rotated boxes) for the new interval [time0, time1], children first.
+    virtual void Refit(double time0, double time1) {}
+
+    // Convex objects can report where the line of a ray enters and leaves
+    // them in one step, without building HitRecords.
+    virtual bool IsConvex() const { return false; }
+
+    // Entry and exit parameters of the whole line through r (t unbounded,
+    // tEnter may be negative); false if the line misses. Only meaningful
+    // when IsConvex().
+    virtual bool Interval(const Ray& r, Real& tEnter, Real& tExit) const {
+        return false;
+    }
+
+    // Appends the emissive primitives below this object that support
+    // SampleLight().
+    virtual void CollectLights(LightList& lights) const {}
+
+    // Samples a point on this (emissive) surface visible from origin; u
+    // is a point in [0,1)^2 that is mapped onto the surface.
+    virtual bool SampleLight(const Point3& origin, double time,
+                             const Point2& u, LightSample& sample) const {
+        return false;
+    }
+
+    // Bounds of what SampleLight() can return, for building a light tree;
+    // false if this object cannot bound its emission.
+    virtual bool EmitterBounds(LightBounds& bounds) const { return false; }
+};
+
+class LightTree;
+
+// 场景中可以直接采样的光源
+// 变换包装器会为子树中的光源创建代理对象，proxies持有它们
+class LightList {
+   public:
+    std::vector<const Hittable*> lights;
+    // lights[i]代理的图元(没有代理时就是它本身)，也就是命中时
+    // HitRecord::light里的对象
+    std::vector<const Hittable*> primitives;
+    std::vector<std::shared_ptr<Hittable>> proxies;
+    // 按位置、朝向和功率选择光源，为空时均匀选择(见light_tree.hpp)
+    std::shared_ptr<const LightTree> tree;
+
+    void add(const Hittable* light) { add(light, light); }
+    void add(const Hittable* light, const Hittable* primitive) {
+        lights.push_back(light);
+        primitives.push_back(primitive);
+    }
+    bool empty() const { return lights.empty(); }
+    size_t size() const { return lights.size(); }
 };
 
+inline void HitRecord::Resolve(const Ray& r) {
+    if (object == nullptr) return;
+    auto hitObject = object;
+    object = nullptr;
+    lightPdf = 0;
+    light = nullptr;
+    hitObject->SurfaceInteraction(r, *this);
+}
+
 class Translate : public Hittable {
    public:
     Translate(std::shared_ptr<Hittable> p, const Vec3& displacement)
         : ptr(p), offset(displacement) {}
 
-    virtual bool Hit(const Ray& r, double t_min, double t_max,
+    virtual bool Hit(const Ray& r, Real t_min, Real t_max,
                      HitRecord& rec) const override;
 
+    virtual bool Occluded(const Ray& r, Real tMin, Real tMax) const override {
+        return ptr->Occluded(toLocal(r), tMin, tMax);
+    }
+
     virtual bool BoundingBox(double time0, double time1,
                              AABB& output_box) const override;
 
+    virtual void Refit(double time0, double time1) override {
+        ptr->Refit(time0, time1);
+    }
+
+    virtual bool IsConvex() const override { return ptr->IsConvex(); }
+
+    virtual bool Interval(const Ray& r, Real& tEnter,
+                          Real& tExit) const override {
+        return ptr->Interval(toLocal(r), tEnter, tExit);
+    }
+
+    virtual void CollectLights(LightList& lights) const override;
+
+    virtual bool SampleLight(const Point3& origin, double time,
+                             const Point2& u,
+                             LightSample& sample) const override {
+        return ptr->SampleLight(origin - offset, time, u, sample);
+    }
+
+    virtual bool EmitterBounds(LightBounds& bounds) const override {
+        if (!ptr->EmitterBounds(bounds)) return false;
+        bounds.box =
+            AABB(bounds.box.Min() + offset, bounds.box.Max() + offset);
+        return true;
+    }
+
    public:
     std::shared_ptr<Hittable> ptr;
     Vec3 offset;
+
+   private:
+    // 把光线移到子对象的坐标系。平移不改变长度，光线锥原样保留
+    Ray toLocal(const Ray& r) const {
+        Ray moved = r;
+        moved.origin = r.Origin() - offset;
+        return moved;
+    }
 };
 
-bool Translate::Hit(const Ray& r, double t_min, double t_max,
+// 不持有所有权的shared_ptr，用于给子树里的光源套上变换代理
+inline std::shared_ptr<Hittable> UnownedHittable(const Hittable* p) {
+    return std::shared_ptr<Hittable>(std::shared_ptr<Hittable>(),
+                                      const_cast<Hittable*>(p));
+}
+
+bool Translate::Hit(const Ray& r, Real t_min, Real t_max,
                     HitRecord& rec) const {
-    Ray moved_r(r.Origin() - offset, r.Direction(), r.Time());
+    Ray moved_r = toLocal(r);
     if (!ptr->Hit(moved_r, t_min, t_max, rec)) return false;
 
+    // 子树看到的是变换后的光线，所以在这里完成子树最近交点的表面计算
+    rec.Resolve(moved_r);
+    auto localP = rec.p;
     rec.p += offset;
+    // 平移到世界坐标和光线起点平移回来各舍入一次
+    rec.pError += Gamma(1) * (Abs(localP) + Abs(rec.p));
     rec.SetFaceNormal(moved_r, rec.normal);
 
     return true;
 }
 
+void Translate::CollectLights(LightList& lights) const {
+    LightList inner;
+    ptr->CollectLights(inner);
+    for (size_t i = 0; i < inner.size(); i++) {
+        auto proxy =
+            MakeShared<Translate>(UnownedHittable(inner.lights[i]), offset);
+        lights.add(proxy.get(), inner.primitives[i]);
+        lights.proxies.push_back(proxy);
+    }
+    lights.proxies.insert(lights.proxies.end(), inner.proxies.begin(),
+                          inner.proxies.end());
+}
+
 bool Translate::BoundingBox(double time0, double time1,
                             AABB& output_box) const {
     if (!ptr->BoundingBox(time0, time1, output_box)) return false;
@@ -74,43 +279,101 @@ class RotateY : public Hittable {
    public:
     RotateY(std::shared_ptr<Hittable> p, double angle);
 
-    virtual bool Hit(const Ray& r, double t_min, double t_max,
+    virtual bool Hit(const Ray& r, Real t_min, Real t_max,
                      HitRecord& rec) const override;
 
+    virtual bool Occluded(const Ray& r, Real tMin, Real tMax) const override {
+        return ptr->Occluded(toLocal(r), tMin, tMax);
+    }
+
     virtual bool BoundingBox(double time0, double time1,
                              AABB& output_box) const override {
         output_box = bbox;
         return hasbox;
     }
 
+    virtual void Refit(double time0, double time1) override {
+        ptr->Refit(time0, time1);
+        computeBox(time0, time1);
+    }
+
+    virtual bool IsConvex() const override { return ptr->IsConvex(); }
+
+    virtual bool Interval(const Ray& r, Real& tEnter,
+                          Real& tExit) const override {
+        return ptr->Interval(toLocal(r), tEnter, tExit);
+    }
+
+    virtual void CollectLights(LightList& lights) const override;
+
+    virtual bool SampleLight(const Point3& origin, double time,
+                             const Point2& u,
+                             LightSample& sample) const override;
+
+    virtual bool EmitterBounds(LightBounds& bounds) const override;
+
    public:
     std::shared_ptr<Hittable> ptr;
     double sin_theta;
     double cos_theta;
     bool hasbox;
     AABB bbox;
+
+   private:
+    // 子对象在[time0, time1]内的包围盒旋转之后的包围盒
+    void computeBox(double time0, double time1);
+
+    // 子对象坐标系里的包围盒旋转到外面之后的包围盒
+    AABB rotateBox(const AABB& box) const;
+
+    // 把子对象坐标系里的方向转出来
+    Vec3 toWorld(const Vec3& v) const {
+        return Vec3(cos_theta * v[0] + sin_theta * v[2], v[1],
+                    -sin_theta * v[0] + cos_theta * v[2]);
+    }
+
+    // 把光线转到子对象的坐标系。旋转不改变长度，光线锥原样保留
+    Ray toLocal(const Ray& r) const {
+        Ray local = r;
+        auto& origin = local.origin;
+        auto& direction = local.dir;
+
+        origin[0] = cos_theta * r.Origin()[0] - sin_theta * r.Origin()[2];
+        origin[2] = sin_theta * r.Origin()[0] + cos_theta * r.Origin()[2];
+
+        direction[0] =
+            cos_theta * r.Direction()[0] - sin_theta * r.Direction()[2];
+        direction[2] =
+            sin_theta * r.Direction()[0] + cos_theta * r.Direction()[2];
+
+        return local;
+    }
 };
 
 RotateY::RotateY(std::shared_ptr<Hittable> p, double angle) : ptr(p) {
     auto radians = degrees_to_radians(angle);
     sin_theta = sin(radians);
     cos_theta = cos(radians);
-    hasbox = ptr->BoundingBox(0, 1, bbox);
+    computeBox(0, 1);
+}
+
+void RotateY::computeBox(double time0, double time1) {
+    hasbox = ptr->BoundingBox(time0, time1, bbox);
+    bbox = rotateBox(bbox);
+}
 
+AABB RotateY::rotateBox(const AABB& box) const {
     Point3 min(infinity, infinity, infinity);
     Point3 max(-infinity, -infinity, -infinity);
 
     for (int i = 0; i < 2; i++) {
         for (int j = 0; j < 2; j++) {
             for (int k = 0; k < 2; k++) {
-                auto x = i * bbox.Max().X() + (1 - i) * bbox.Min().X();
-                auto y = j * bbox.Max().Y() + (1 - j) * bbox.Min().Y();
-                auto z = k * bbox.Max().Z() + (1 - k) * bbox.Min().Z();
+                auto x = i * box.Max().X() + (1 - i) * box.Min().X();
+                auto y = j * box.Max().Y() + (1 - j) * box.Min().Y();
+                auto z = k * box.Max().Z() + (1 - k) * box.Min().Z();
 
-                auto newx = cos_theta * x + sin_theta * z;
-                auto newz = -sin_theta * x + cos_theta * z;
-
-                Vec3 tester(newx, y, newz);
+                auto tester = toWorld(Vec3(x, y, z));
 
                 for (int c = 0; c < 3; c++) {
                     min[c] = fmin(min[c], tester[c]);
@@ -120,24 +383,16 @@ RotateY::RotateY(std::shared_ptr<Hittable> p, double angle) : ptr(p) {
         }
     }
 
-    bbox = AABB(min, max);
+    return AABB(min, max);
 }
 
-bool RotateY::Hit(const Ray& r, double t_min, double t_max,
+bool RotateY::Hit(const Ray& r, Real t_min, Real t_max,
                   HitRecord& rec) const {
-    auto origin = r.Origin();
-    auto direction = r.Direction();
-
-    origin[0] = cos_theta * r.Origin()[0] - sin_theta * r.Origin()[2];
-    origin[2] = sin_theta * r.Origin()[0] + cos_theta * r.Origin()[2];
-
-    direction[0] = cos_theta * r.Direction()[0] - sin_theta * r.Direction()[2];
-    direction[2] = sin_theta * r.Direction()[0] + cos_theta * r.Direction()[2];
-
-    Ray rotated_r(origin, direction, r.Time());
+    auto rotated_r = toLocal(r);
 
     if (!ptr->Hit(rotated_r, t_min, t_max, rec)) return false;
 
+    rec.Resolve(rotated_r);
     auto p = rec.p;
     auto normal = rec.normal;
 
@@ -147,8 +402,53 @@ bool RotateY::Hit(const Ray& r, double t_min, double t_max,
     normal[0] = cos_theta * rec.normal[0] + sin_theta * rec.normal[2];
     normal[2] = -sin_theta * rec.normal[0] + cos_theta * rec.normal[2];
 
+    // 误差盒随点一起旋转，再加上旋转到世界坐标和光线起点转回子对象坐标
+    // 时的舍入
+    auto c = fabs(cos_theta), s = fabs(sin_theta);
+    auto e = rec.pError;
+    Vec3 rounding(c * fabs(rec.p[0]) + s * fabs(rec.p[2]), 0,
+                  s * fabs(rec.p[0]) + c * fabs(rec.p[2]));
+    rec.pError = Vec3(c * e[0] + s * e[2], e[1], s * e[0] + c * e[2]) +
+                 Gamma(6) * rounding;
+
     rec.p = p;
     rec.SetFaceNormal(rotated_r, normal);
 
     return true;
 }
+
+void RotateY::CollectLights(LightList& lights) const {
+    LightList inner;
+    ptr->CollectLights(inner);
+    for (size_t i = 0; i < inner.size(); i++) {
+        auto proxy = MakeShared<RotateY>(UnownedHittable(inner.lights[i]), 0);
+        // 复用同一个旋转，不重新计算包围盒
+        proxy->sin_theta = sin_theta;
+        proxy->cos_theta = cos_theta;
+        lights.add(proxy.get(), inner.primitives[i]);
+        lights.proxies.push_back(proxy);
+    }
+    lights.proxies.insert(lights.proxies.end(), inner.proxies.begin(),
+                          inner.proxies.end());
+}
+
+bool RotateY::SampleLight(const Point3& origin, double time, const Point2& u,
+                          LightSample& sample) const {
+    auto o = origin;
+    o[0] = cos_theta * origin[0] - sin_theta * origin[2];
+    o[2] = sin_theta * origin[0] + cos_theta * origin[2];
+
+    if (!ptr->SampleLight(o, time, u, sample)) return false;
+
+    auto d = sample.direction;
+    sample.direction[0] = cos_theta * d[0] + sin_theta * d[2];
+    sample.direction[2] = -sin_theta * d[0] + cos_theta * d[2];
+    return true;
+}
+
+bool RotateY::EmitterBounds(LightBounds& bounds) const {
+    if (!ptr->EmitterBounds(bounds)) return false;
+    bounds.box = rotateBox(bounds.box);
+    bounds.axis = toWorld(bounds.axis);
+    return true;
+}
@@ -15,31 +15,52 @@ class HittableList : public Hittable {
     void clear() { objects.clear(); }
     void add(std::shared_ptr<Hittable> object) { objects.push_back(object); }
 
-    virtual bool Hit(const Ray& r, double t_min, double t_max,
+    virtual bool Hit(const Ray& r, Real t_min, Real t_max,
                      HitRecord& rec) const override;
 
+    virtual bool Occluded(const Ray& r, Real tMin, Real tMax) const override;
+
     virtual bool BoundingBox(double time0, double time1,
                              AABB& outputBox) const override;
+
+    virtual void Refit(double time0, double time1) override {
+        for (const auto& object : objects) {
+            object->Refit(time0, time1);
+        }
+    }
+
+    virtual void CollectLights(LightList& lights) const override {
+        for (const auto& object : objects) {
+            object->CollectLights(lights);
+        }
+    }
 };
 
-bool HittableList::Hit(const Ray& r, double t_min, double t_max,
+bool HittableList::Hit(const Ray& r, Real t_min, Real t_max,
                        HitRecord& rec) const {
-    HitRecord tempRec;
     bool hitAnything = false;
     auto closestSoFar = t_max;
 
     // 根据closestSoFar来决定最近的物体
+    // Hit只在命中时写rec，所以不需要临时记录
     for (const auto& object : objects) {
-        if (object->Hit(r, t_min, closestSoFar, tempRec)) {
+        if (object->Hit(r, t_min, closestSoFar, rec)) {
             hitAnything = true;
-            closestSoFar = tempRec.t;
-            rec = tempRec;
+            closestSoFar = rec.t;
         }
     }
 
     return hitAnything;
 }
 
+// 任何一个物体挡住就可以返回，不需要找最近的
+bool HittableList::Occluded(const Ray& r, Real tMin, Real tMax) const {
+    for (const auto& object : objects) {
+        if (object->Occluded(r, tMin, tMax)) return true;
+    }
+    return false;
+}
+
 bool HittableList::BoundingBox(double time0, double time1,
                                AABB& outputBox) const {
     if (objects.empty()) {
@@ -0,0 +1,325 @@
+#pragma once
+
+#include "camera.hpp"
+#include "denoise.hpp"
+#include "guiding.hpp"
+#include "hittable.hpp"
+#include "light_tree.hpp"
+#include "material.hpp"
+#include "parallel.hpp"
+#include "rtweekend.hpp"
+
+Color RayColor(const Ray& r, const Color& background, const Hittable& world,
+               int depth) {
+    HitRecord rec;
+    // If we've exceeded the ray bounce limit, no more light is gathered.
+    if (depth <= 0) {
+        RTW_STAT_DEPTH_TERMINATED();
+        return Color(0, 0, 0);
+    }
+    RTW_STAT_RAY(depth);
+
+    // If the ray hits nothing, return the background color.
+    // 次级光线的起点已经推离了表面(HitRecord::SpawnRay)，从t = 0开始求交
+    if (!world.Hit(r, 0, infinity, rec)) {
+        return background;
+    }
+    rec.Resolve(r);
+
+    Ray scattered;
+    Color attenuation;
+    Color emitted = rec.matPtr->Emitted(rec.u, rec.v, rec.p);
+
+    if (!rec.matPtr->Scatter(r, rec, attenuation, scattered)) {
+        return emitted;
+    }
+
+    // 递归，多次反射
+    return emitted +
+           attenuation * RayColor(scattered, background, world, depth - 1);
+}
+
+// Balance heuristic的平方版本，f和g是两种策略各自的pdf
+inline double PowerHeuristic(double f, double g) {
+    return f * f / (f * f + g * g);
+}
+
+// 光源树估计贡献时用的法线：介质里的散射点向各个方向散射，没有法线
+inline Vec3 LightingNormal(const HitRecord& rec) {
+    return rec.matPtr->Type() == MaterialType::Isotropic ? Vec3(0, 0, 0)
+                                                         : rec.normal;
+}
+
+// 选择一个光源(见SelectLight)并在上面采样一个点，用阴影光线测试可见性，
+// 返回这一点的直接光照；mis为true时按power heuristic和材质采样的pdf加权
+Color DirectLighting(const Ray& r, const HitRecord& rec, const Hittable& world,
+                     const LightList& lights, Sampler& sampler,
+                     bool mis = false) {
+    double selectPdf;
+    auto light = SelectLight(lights, rec.p, LightingNormal(rec),
+                             sampler.Get1D(), selectPdf);
+    if (light == nullptr) return Color{0, 0, 0};
+
+    LightSample sample;
+    auto u = sampler.Get2D();
+    if (!light->SampleLight(rec.p, r.Time(), u, sample) || sample.pdf <= 0) {
+        return Color{0, 0, 0};
+    }
+
+    auto f = rec.matPtr->Eval(rec, sample.direction);
+    if (f.NearZero()) return Color{0, 0, 0};
+
+    // 光源上的点在t = 1处，留一点余量避免打到光源自己
+    auto shadow = rec.SpawnRayTo(rec.p + sample.direction, r.Time());
+    RTW_STAT_SHADOW_RAY();
+    if (world.Occluded(shadow, 0, 1 - 0.0001)) {
+        return Color{0, 0, 0};
+    }
+
+    auto lightPdf = selectPdf * sample.pdf;
+    auto weight = mis ? PowerHeuristic(
+                            lightPdf, rec.matPtr->Pdf(rec, sample.direction))
+                      : 1.0;
+    return weight * f * sample.emitted / lightPdf;
+}
+
+// RayColor with next-event estimation: at every diffuse or isotropic
+// vertex one light is sampled explicitly, and emission found by the
+// following bounce is skipped for lights in the list so that it is not
+// counted twice. All random decisions after the camera ray come from
+// sampler, one NextBounce() per vertex.
+Color RayColorNEE(const Ray& r, const Color& background, const Hittable& world,
+                  const LightList& lights, Sampler& sampler, int depth,
+                  bool countEmitted = true) {
+    HitRecord rec;
+    if (depth <= 0) {
+        RTW_STAT_DEPTH_TERMINATED();
+        return Color(0, 0, 0);
+    }
+    RTW_STAT_RAY(depth);
+
+    if (!world.Hit(r, 0, infinity, rec)) {
+        return background;
+    }
+    rec.Resolve(r);
+
+    Color emitted{0, 0, 0};
+    if (countEmitted || rec.lightPdf == 0) {
+        emitted = rec.matPtr->Emitted(rec.u, rec.v, rec.p);
+    }
+
+    sampler.NextBounce();
+    ScatterRecord srec;
+    if (!rec.matPtr->Sample(r, rec, sampler, srec)) {
+        return emitted;
+    }
+
+    auto diffuse = rec.matPtr->IsDiffuse() && !lights.empty();
+    if (diffuse) {
+        emitted += DirectLighting(r, rec, world, lights, sampler);
+    }
+
+    return emitted + srec.attenuation * RayColorNEE(srec.scattered, background,
+                                                    world, lights, sampler,
+                                                    depth - 1, !diffuse);
+}
+
+// Path tracing with multiple importance sampling: at diffuse vertices the
+// direct light is estimated both by sampling a light and by sampling the
+// material, and the two are combined with the power heuristic. bsdfPdf is
+// the density of r at the previous vertex, or 0 if that vertex was
+// specular (or r is a camera ray) and light sampling could not produce it;
+// from is that vertex, where a light would have been chosen.
+Color RayColorMIS(const Ray& r, const Color& background, const Hittable& world,
+                  const LightList& lights, Sampler& sampler, int depth,
+                  double bsdfPdf = 0, const HitRecord* from = nullptr) {
+    HitRecord rec;
+    if (depth <= 0) {
+        RTW_STAT_DEPTH_TERMINATED();
+        return Color(0, 0, 0);
+    }
+    RTW_STAT_RAY(depth);
+
+    if (!world.Hit(r, 0, infinity, rec)) {
+        return background;
+    }
+    rec.Resolve(r);
+
+    auto emitted = rec.matPtr->Emitted(rec.u, rec.v, rec.p);
+    if (bsdfPdf > 0 && rec.lightPdf > 0) {
+        auto selectPdf = SelectLightPmf(lights, from->p, LightingNormal(*from),
+                                        rec.light);
+        emitted *= PowerHeuristic(bsdfPdf, selectPdf * rec.lightPdf);
+    }
+
+    sampler.NextBounce();
+    ScatterRecord srec;
+    if (!rec.matPtr->Sample(r, rec, sampler, srec)) {
+        return emitted;
+    }
+
+    if (!srec.IsSpecular() && !lights.empty()) {
+        emitted += DirectLighting(r, rec, world, lights, sampler, true);
+    }
+
+    return emitted + srec.attenuation * RayColorMIS(srec.scattered, background,
+                                                    world, lights, sampler,
+                                                    depth - 1, srec.pdf, &rec);
+}
+
+// RayColorNEE with path guiding: at diffuse and isotropic vertices the
+// next direction comes from the material with probability
+// PathGuide::bsdfFraction and from the distribution the guide has learned
+// for the cell of the vertex otherwise, weighted by the density of the
+// mixture; on surfaces the guide only samples the side the normal faces.
+// While the guide trains, every such vertex records the radiance its path
+// brings back, divided by that density. Lights in the list are sampled by
+// next-event estimation, so the guide learns the indirect light; with an
+// empty list this is guided path tracing, and the guide learns the direct
+// light as well.
+Color RayColorGuided(const Ray& r, const Color& background,
+                     const Hittable& world, const LightList& lights,
+                     PathGuide& guide, Sampler& sampler, int depth,
+                     bool countEmitted = true) {
+    HitRecord rec;
+    if (depth <= 0) {
+        RTW_STAT_DEPTH_TERMINATED();
+        return Color(0, 0, 0);
+    }
+    RTW_STAT_RAY(depth);
+
+    if (!world.Hit(r, 0, infinity, rec)) {
+        return background;
+    }
+    rec.Resolve(r);
+
+    Color emitted{0, 0, 0};
+    if (countEmitted || rec.lightPdf == 0) {
+        emitted = rec.matPtr->Emitted(rec.u, rec.v, rec.p);
+    }
+
+    sampler.NextBounce();
+    ScatterRecord srec;
+    if (!rec.matPtr->Sample(r, rec, sampler, srec)) {
+        return emitted;
+    }
+
+    if (!rec.matPtr->IsDiffuse()) {
+        return emitted + srec.attenuation * RayColorGuided(
+                                                srec.scattered, background,
+                                                world, lights, guide, sampler,
+                                                depth - 1);
+    }
+    if (!lights.empty()) {
+        emitted += DirectLighting(r, rec, world, lights, sampler);
+    }
+
+    auto& cell = guide.Lookup(rec.p);
+    auto normal = LightingNormal(rec);
+    auto choice = sampler.Get1D();
+    auto u = sampler.Get2D();
+    if (cell.sampling.CanSample()) {
+        // 材质的样本也要按混合分布的密度重新加权
+        auto direction = srec.scattered.Direction();
+        auto f = srec.attenuation * srec.pdf;
+        auto bsdfPdf = srec.pdf;
+        double guidePdf;
+        if (choice < PathGuide::bsdfFraction) {
+            guidePdf = cell.sampling.Pdf(direction, normal);
+        } else {
+            direction = cell.sampling.Sample(u, normal, guidePdf);
+            auto scattered = rec.SpawnRay(direction, r.Time());
+            scattered.width = srec.scattered.width;
+            scattered.spread = srec.scattered.spread;
+            srec.scattered = scattered;
+            f = rec.matPtr->Eval(rec, direction);
+            bsdfPdf = rec.matPtr->Pdf(rec, direction);
+        }
+        srec.pdf = PathGuide::bsdfFraction * bsdfPdf +
+                   (1 - PathGuide::bsdfFraction) * guidePdf;
+        if (srec.pdf <= 0 || f.NearZero()) return emitted;
+        srec.attenuation = f / srec.pdf;
+    }
+
+    auto incident =
+        RayColorGuided(srec.scattered, background, world, lights, guide,
+                       sampler, depth - 1, lights.empty());
+    if (guide.Training()) {
+        cell.recording.Record(srec.scattered.Direction(),
+                              Luminance(incident) / srec.pdf);
+    }
+    return emitted + srec.attenuation * incident;
+}
+
+// Ambient-occlusion preview: the first hit is shaded with its albedo, and
+// is black if one cosine-distributed ray from it is blocked within
+// maxDistance. With cosine sampling the cosine and the pdf cancel, so the
+// mean over the pixel samples is the albedo times the unoccluded fraction
+// of the hemisphere. One closest hit and one Occluded() query per sample,
+// with no materials evaluated beyond the albedo. depth is only used to
+// count the camera ray in the statistics like the other integrators do.
+Color AmbientOcclusion(const Ray& r, const Color& background,
+                       const Hittable& world, Sampler& sampler,
+                       double maxDistance, int depth) {
+    HitRecord rec;
+    RTW_STAT_RAY(depth);
+    if (!world.Hit(r, 0, infinity, rec)) {
+        return Color(fmin(background.X(), 1.0), fmin(background.Y(), 1.0),
+                     fmin(background.Z(), 1.0));
+    }
+    rec.Resolve(r);
+
+    sampler.NextBounce();
+    auto u = sampler.Get2D();
+    ONB uvw(rec.normal);
+    auto direction = uvw.Local(SampleCosineDirection(u.x, u.y));
+    RTW_STAT_SHADOW_RAY();
+    if (world.Occluded(rec.SpawnRay(direction, r.Time()), 0, maxDistance)) {
+        return Color(0, 0, 0);
+    }
+    return rec.matPtr->Albedo(rec);
+}
+
+// Renders the first-hit albedo, normal and depth of every pixel, averaged
+// over samplesPerPixel jittered camera rays, in output order. Rays that
+// escape get the background as albedo and zero normal and depth.
+FeatureBuffers RenderFeatures(const Hittable& world, const Camera& camera,
+                              const Color& background, int width, int height,
+                              int samplesPerPixel, int threadCount) {
+    FeatureBuffers features;
+    features.Resize(static_cast<size_t>(width) * height);
+    auto backgroundAlbedo =
+        Color(fmin(background.X(), 1.0), fmin(background.Y(), 1.0),
+              fmin(background.Z(), 1.0));
+
+    ParallelFor(height, 1, threadCount, [&](size_t begin, size_t end) {
+        for (auto row = begin; row < end; row++) {
+            auto j = height - 1 - static_cast<int>(row);
+            for (int i = 0; i < width; i++) {
+                auto pixel = row * width + i;
+                SeedRandom(pixel);
+                Color albedo{0, 0, 0};
+                Vec3 normal{0, 0, 0};
+                auto depth = 0.0;
+                for (int s = 0; s < samplesPerPixel; s++) {
+                    auto u = (i + RandomDouble()) / (width - 1);
+                    auto v = (j + RandomDouble()) / (height - 1);
+                    Ray r = camera.GetRay(u, v);
+                    HitRecord rec;
+                    if (!world.Hit(r, 0, infinity, rec)) {
+                        albedo += backgroundAlbedo;
+                        continue;
+                    }
+                    rec.Resolve(r);
+                    albedo += rec.matPtr->Albedo(rec);
+                    normal += rec.normal;
+                    depth += rec.t * r.Direction().Length();
+                }
+                features.albedo[pixel] = albedo / samplesPerPixel;
+                features.normal[pixel] = normal / samplesPerPixel;
+                features.depth[pixel] = depth / samplesPerPixel;
+            }
+        }
+    });
+    return features;
+}
@@ -0,0 +1,395 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "hittable.hpp"
+#include "rtweekend.hpp"
+
+// Light BVH in the style of Conty and Kulla (2018) as done in pbrt-v4:
+// emitters are clustered by position, orientation and power, and a light
+// is picked by walking down from the root, choosing each child with
+// probability proportional to an estimate of its contribution at the
+// shading point. Picking a light costs one walk of O(log n) nodes, and so
+// does computing the probability with which a given light is picked,
+// which MIS needs when a material sample hits a light.
+
+inline double SafeSqrt(double x) { return sqrt(fmax(x, 0.0)); }
+
+inline double SafeAcos(double x) { return acos(Clamp(x, -1.0, 1.0)); }
+
+// cos(max(0, a - b))，a, b在[0, π]内，用正弦和余弦给出
+inline double CosSubClamped(double sinA, double cosA, double sinB,
+                            double cosB) {
+    if (cosA > cosB) return 1;
+    return cosA * cosB + sinA * sinB;
+}
+
+// 绕单位向量axis把v转过angle(Rodrigues公式)
+inline Vec3 RotateAbout(const Vec3& v, const Vec3& axis, double angle) {
+    auto c = cos(angle), s = sin(angle);
+    return c * v + s * Cross(axis, v) + (1 - c) * Dot(axis, v) * axis;
+}
+
+// The smallest cone around both cones (axis, cosTheta) a and b; a
+// cosine of -1 is the whole sphere.
+inline void UnionCones(const Vec3& axisA, double cosA, const Vec3& axisB,
+                       double cosB, Vec3& axis, double& cosTheta) {
+    auto thetaA = SafeAcos(cosA), thetaB = SafeAcos(cosB);
+    auto thetaD = SafeAcos(Dot(axisA, axisB));
+    // 一个锥已经包含了另一个
+    if (fmin(thetaD + thetaB, pi) <= thetaA) {
+        axis = axisA;
+        cosTheta = cosA;
+        return;
+    }
+    if (fmin(thetaD + thetaA, pi) <= thetaB) {
+        axis = axisB;
+        cosTheta = cosB;
+        return;
+    }
+    auto thetaO = (thetaA + thetaD + thetaB) / 2;
+    auto rotationAxis = Cross(axisA, axisB);
+    if (thetaO >= pi || rotationAxis.LengthSquared() == 0) {
+        axis = axisA;
+        cosTheta = -1;
+        return;
+    }
+    axis = UnitVector(
+        RotateAbout(axisA, UnitVector(rotationAxis), thetaO - thetaA));
+    cosTheta = cos(thetaO);
+}
+
+inline LightBounds UnionBounds(const LightBounds& a, const LightBounds& b) {
+    LightBounds bounds;
+    bounds.box = SurroundingBox(a.box, b.box);
+    bounds.phi = a.phi + b.phi;
+    UnionCones(a.axis, a.cosThetaO, b.axis, b.cosThetaO, bounds.axis,
+               bounds.cosThetaO);
+    bounds.cosThetaE = fmin(a.cosThetaE, b.cosThetaE);
+    bounds.twoSided = a.twoSided || b.twoSided;
+    return bounds;
+}
+
+// LightBounds in the form the traversal reads: the box is replaced by its
+// bounding sphere and the sine of the normal cone is precomputed.
+struct LightCluster {
+    Point3 center;
+    Vec3 axis;
+    double radius, radiusSquared;
+    double phi;
+    double cosThetaO, sinThetaO;
+    double cosThetaE;
+    bool twoSided;
+
+    LightCluster() {}
+    explicit LightCluster(const LightBounds& b)
+        : center(0.5 * (b.box.Min() + b.box.Max())),
+          axis(b.axis),
+          radius(0.5 * (b.box.Max() - b.box.Min()).Length()),
+          radiusSquared(radius * radius),
+          phi(b.phi),
+          cosThetaO(b.cosThetaO),
+          sinThetaO(SafeSqrt(1 - b.cosThetaO * b.cosThetaO)),
+          cosThetaE(b.cosThetaE),
+          twoSided(b.twoSided) {}
+
+    // Estimated contribution of the emitters in the cluster at p, for a
+    // surface with normal n (the zero vector in a volume): the power over
+    // the squared distance, times the cosines at the emitter and at p for
+    // the best orientation the bounds allow. It is 0 only where none of
+    // the emitters can reach p, so choosing lights in proportion to it
+    // stays unbiased.
+    double Importance(const Point3& p, const Vec3& n) const {
+        auto toPoint = p - center;
+        auto distanceSquared = static_cast<double>(toPoint.LengthSquared());
+        // 下面的余弦都要除以距离，只算一次倒数
+        auto invDistance =
+            distanceSquared > 0 ? 1 / sqrt(distanceSquared) : 0.0;
+
+        // 包围球对p张成的半角θb；p在包围球里时方向上没有任何约束
+        auto inside = distanceSquared <= radiusSquared;
+        auto sinThetaB = inside ? 0.0 : radius * invDistance;
+        auto cosThetaB = inside ? -1.0 : SafeSqrt(1 - sinThetaB * sinThetaB);
+
+        // 光源法线与指向p的方向之间可能的最小夹角 θ' = θw - θo - θb。
+        // 指向p的方向在法线锥里时θ' = 0，这时不需要算正弦
+        auto cosThetaW =
+            distanceSquared > 0 ? Dot(axis, toPoint) * invDistance : 1.0;
+        if (twoSided) cosThetaW = fabs(cosThetaW);
+        auto cosThetaP = 1.0;
+        if (cosThetaW <= cosThetaO) {
+            auto sinThetaW = SafeSqrt(1 - cosThetaW * cosThetaW);
+            auto cosThetaX = cosThetaW * cosThetaO + sinThetaW * sinThetaO;
+            auto sinThetaX = sinThetaW * cosThetaO - cosThetaW * sinThetaO;
+            cosThetaP =
+                CosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+        }
+        if (cosThetaP <= cosThetaE) return 0;
+
+        // 距离按包围球的半径截断
+        auto importance = phi * cosThetaP *
+                          (inside ? 1 / radiusSquared
+                                  : invDistance * invDistance);
+
+        // 表面上还要乘p处法线与入射方向夹角余弦的上界 cos(θi - θb)
+        if (n.LengthSquared() > 0) {
+            auto cosThetaI =
+                distanceSquared > 0 ? -Dot(n, toPoint) * invDistance : 1.0;
+            if (cosThetaI <= cosThetaB) {
+                auto sinThetaI = SafeSqrt(1 - cosThetaI * cosThetaI);
+                importance *=
+                    fmax(cosThetaI * cosThetaB + sinThetaI * sinThetaB, 0.0);
+            }
+        }
+        return importance;
+    }
+};
+
+class LightTree {
+   private:
+    struct Node {
+        LightCluster cluster;
+        // 内部节点是第二个子节点的下标(第一个紧跟在它后面)，叶子是光源
+        // 在LightList里的下标
+        uint32_t index;
+        bool leaf;
+    };
+
+    struct Item {
+        LightBounds bounds;
+        Point3 centroid;
+        uint32_t light;
+    };
+
+    std::vector<Node> nodes_;
+    // 图元到从根走到它的叶子的路径，第d位是第d层走向了哪个子节点
+    std::unordered_map<const Hittable*, uint64_t> trails_;
+
+    // 超过这个深度后按数量对半分，保证路径能放进64位
+    static const int balancedDepth = 32;
+    static const int bucketCount = 12;
+
+    // Cost of a cluster in the surface area orientation heuristic: power
+    // times a measure of the solid angle its normals and emission cover
+    // times its surface area, with boxes that are thin along the split
+    // axis penalized (Kr).
+    static double clusterCost(const LightBounds& b, const AABB& parent,
+                              int axis) {
+        auto thetaO = SafeAcos(b.cosThetaO), thetaE = SafeAcos(b.cosThetaE);
+        auto thetaW = fmin(thetaO + thetaE, pi);
+        auto sinThetaO = SafeSqrt(1 - b.cosThetaO * b.cosThetaO);
+        auto mOmega = 2 * pi * (1 - b.cosThetaO) +
+                      pi / 2 *
+                          (2 * thetaW * sinThetaO - cos(thetaO - 2 * thetaW) -
+                           2 * thetaO * sinThetaO + b.cosThetaO);
+        auto extent = parent.Max() - parent.Min();
+        auto kr = fmax(extent.X(), fmax(extent.Y(), extent.Z())) /
+                  extent[axis];
+        return b.phi * mOmega * kr * b.box.SurfaceArea();
+    }
+
+    uint32_t build(const LightList& lights, std::vector<Item>& items,
+                   size_t begin, size_t end, uint64_t trail, int depth) {
+        auto nodeIndex = static_cast<uint32_t>(nodes_.size());
+        nodes_.push_back(Node());
+        if (end - begin == 1) {
+            auto& item = items[begin];
+            nodes_[nodeIndex] =
+                Node{LightCluster(item.bounds), item.light, true};
+            trails_[lights.primitives[item.light]] = trail;
+            return nodeIndex;
+        }
+
+        auto bounds = items[begin].bounds;
+        AABB centroids(items[begin].centroid, items[begin].centroid);
+        for (auto i = begin + 1; i < end; i++) {
+            bounds = UnionBounds(bounds, items[i].bounds);
+            centroids = SurroundingBox(
+                centroids, AABB(items[i].centroid, items[i].centroid));
+        }
+        auto extent = centroids.Max() - centroids.Min();
+
+        // 在每个轴上把质心分进若干个桶，选代价最小的分界
+        auto bestCost = infinity;
+        int bestAxis = -1, bestBucket = -1;
+        auto bucketOf = [&](const Item& item, int axis) {
+            auto b = static_cast<int>(
+                bucketCount * (item.centroid[axis] - centroids.Min()[axis]) /
+                extent[axis]);
+            return std::min(b, bucketCount - 1);
+        };
+        for (int axis = 0; axis < 3 && depth < balancedDepth; axis++) {
+            if (!(extent[axis] > 0)) continue;
+            LightBounds buckets[bucketCount];
+            bool used[bucketCount] = {};
+            for (auto i = begin; i < end; i++) {
+                auto b = bucketOf(items[i], axis);
+                buckets[b] = used[b] ? UnionBounds(buckets[b], items[i].bounds)
+                                     : items[i].bounds;
+                used[b] = true;
+            }
+            for (int split = 0; split < bucketCount - 1; split++) {
+                LightBounds below, above;
+                bool anyBelow = false, anyAbove = false;
+                for (int b = 0; b < bucketCount; b++) {
+                    if (!used[b]) continue;
+                    auto& side = b <= split ? below : above;
+                    auto& any = b <= split ? anyBelow : anyAbove;
+                    side = any ? UnionBounds(side, buckets[b]) : buckets[b];
+                    any = true;
+                }
+                if (!anyBelow || !anyAbove) continue;
+                auto cost = clusterCost(below, bounds.box, axis) +
+                            clusterCost(above, bounds.box, axis);
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBucket = split;
+                }
+            }
+        }
+
+        size_t mid;
+        if (bestAxis >= 0) {
+            auto middle = std::partition(
+                items.begin() + begin, items.begin() + end,
+                [&](const Item& item) {
+                    return bucketOf(item, bestAxis) <= bestBucket;
+                });
+            mid = middle - items.begin();
+        } else {
+            // 质心重合或者树太深：沿最长的轴按数量对半分
+            int axis = extent.X() > extent.Y()
+                           ? (extent.X() > extent.Z() ? 0 : 2)
+                           : (extent.Y() > extent.Z() ? 1 : 2);
+            mid = (begin + end) / 2;
+            std::nth_element(items.begin() + begin, items.begin() + mid,
+                             items.begin() + end,
+                             [axis](const Item& a, const Item& b) {
+                                 return a.centroid[axis] < b.centroid[axis];
+                             });
+        }
+
+        build(lights, items, begin, mid, trail, depth + 1);
+        auto second = build(lights, items, mid, end,
+                            trail | (uint64_t(1) << depth), depth + 1);
+        nodes_[nodeIndex] = Node{LightCluster(bounds), second, false};
+        return nodeIndex;
+    }
+
+   public:
+    // Builds the tree over all lights, or returns nullptr if one of them
+    // cannot bound its emission or a primitive is in the list twice (an
+    // instanced emitter): a hit on it could not tell which of its copies
+    // it is, so its probability for MIS would be ambiguous.
+    static std::shared_ptr<const LightTree> Build(const LightList& lights) {
+        if (lights.empty()) return nullptr;
+        std::vector<Item> items(lights.size());
+        for (size_t i = 0; i < lights.size(); i++) {
+            auto& item = items[i];
+            if (!lights.lights[i]->EmitterBounds(item.bounds)) return nullptr;
+            const auto& box = item.bounds.box;
+            item.centroid = 0.5 * (box.Min() + box.Max());
+            item.light = static_cast<uint32_t>(i);
+        }
+        auto tree = std::make_shared<LightTree>();
+        tree->nodes_.reserve(2 * lights.size() - 1);
+        tree->build(lights, items, 0, items.size(), 0, 0);
+        if (tree->trails_.size() != lights.size()) return nullptr;
+        return tree;
+    }
+
+    size_t NodeCount() const { return nodes_.size(); }
+
+    // Picks a light for the shading point (p, n) with one number u in
+    // [0, 1), which is reused for every level after rescaling. Returns the
+    // index into the LightList, or false if no light can reach p.
+    bool Sample(const Point3& p, const Vec3& n, double u, size_t& light,
+                double& pmf) const {
+        uint32_t index = 0;
+        pmf = 1;
+        while (!nodes_[index].leaf) {
+            auto first = index + 1, second = nodes_[index].index;
+            auto importance0 = nodes_[first].cluster.Importance(p, n);
+            auto importance1 = nodes_[second].cluster.Importance(p, n);
+            if (importance0 == 0 && importance1 == 0) return false;
+            auto p0 = importance0 / (importance0 + importance1);
+            if (u < p0) {
+                index = first;
+                u = fmin(u / p0, oneMinusEpsilon);
+                pmf *= p0;
+            } else {
+                index = second;
+                u = fmin((u - p0) / (1 - p0), oneMinusEpsilon);
+                pmf *= 1 - p0;
+            }
+        }
+        light = nodes_[index].index;
+        return true;
+    }
+
+    // Probability that Sample() at (p, n) picks the light whose primitive
+    // this is; 0 for primitives that are not in the tree.
+    double Pmf(const Point3& p, const Vec3& n,
+               const Hittable* primitive) const {
+        auto found = trails_.find(primitive);
+        if (found == trails_.end()) return 0;
+        auto trail = found->second;
+        uint32_t index = 0;
+        auto pmf = 1.0;
+        while (!nodes_[index].leaf) {
+            auto first = index + 1, second = nodes_[index].index;
+            auto importance0 = nodes_[first].cluster.Importance(p, n);
+            auto importance1 = nodes_[second].cluster.Importance(p, n);
+            if (importance0 == 0 && importance1 == 0) return 0;
+            auto p0 = importance0 / (importance0 + importance1);
+            if (trail & 1) {
+                index = second;
+                pmf *= 1 - p0;
+            } else {
+                index = first;
+                pmf *= p0;
+            }
+            trail >>= 1;
+        }
+        return pmf;
+    }
+};
+
+// Builds lights.tree; without one (see LightTree::Build) lights are
+// chosen uniformly. Returns whether the tree was built.
+inline bool BuildLightTree(LightList& lights) {
+    lights.tree = LightTree::Build(lights);
+    return lights.tree != nullptr;
+}
+
+// Chooses one of lights for the shading point (p, n) with u in [0, 1),
+// in proportion to its estimated contribution if lights has a tree and
+// uniformly otherwise. Returns nullptr if no light can reach p.
+inline const Hittable* SelectLight(const LightList& lights, const Point3& p,
+                                   const Vec3& n, double u, double& pmf) {
+    if (lights.empty()) return nullptr;
+    size_t index;
+    if (lights.tree != nullptr) {
+        if (!lights.tree->Sample(p, n, u, index, pmf)) return nullptr;
+    } else {
+        index = std::min(static_cast<size_t>(u * lights.size()),
+                         lights.size() - 1);
+        pmf = 1.0 / lights.size();
+    }
+    return lights.lights[index];
+}
+
+// The probability with which SelectLight() at (p, n) chooses the light of
+// primitive (HitRecord::light).
+inline double SelectLightPmf(const LightList& lights, const Point3& p,
+                             const Vec3& n, const Hittable* primitive) {
+    if (lights.empty()) return 0;
+    if (lights.tree != nullptr) return lights.tree->Pmf(p, n, primitive);
+    return 1.0 / lights.size();
+}
@@ -1,418 +1,422 @@
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
 
-#include "aarec.hpp"
-#include "box.hpp"
-#include "bvh.hpp"
-#include "camera.hpp"
-#include "color.hpp"
-#include "constant_medium.hpp"
-#include "hittable_list.hpp"
-#include "material.hpp"
-#include "moving_sphere.hpp"
-#include "perlin.hpp"
-#include "rtweekend.hpp"
-#include "sphere.hpp"
-#include "texture.hpp"
-
-Color RayColor(const Ray& r, const Color& background, const Hittable& world,
-               int depth);
-HittableList RandomScene();
-HittableList TwoSpheres();
-HittableList TwoPerlinSpheres();
-HittableList Earth();
-HittableList SimpleLight();
-HittableList CornellBox();
-HittableList CornellSmoke();
-HittableList FinalScene();
-
-int main() {
-    //  Image
-
-    auto aspectRatio = 16.0 / 9.0;
-    int imageWidth = 400;
-    int samplePerPixels = 100;
-    const int maxDepth = 50;
+#include "animation.hpp"
+#include "integrator.hpp"
+#include "options.hpp"
+#include "progressive.hpp"
+#include "scenes.hpp"
+#include "wavefront.hpp"
+
+RadianceFunction SelectRadiance(const Options& options, const Hittable& world,
+                                const Color& background,
+                                const LightList& lights, int maxDepth,
+                                PathGuide* guide = nullptr);
+int RenderGuided(const Options& options, const Hittable& world,
+                 const Camera& camera, const Color& background,
+                 const LightList& lights, int maxDepth, int imageWidth,
+                 int imageHeight, int samplesPerPixel,
+                 std::vector<Color>& image);
+int RenderSequence(const Options& options, const Scene& scene,
+                   const LightList& lights, int imageWidth,
+                   int samplesPerPixel, int maxDepth);
+bool FramePatternValid(const std::string& pattern);
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        return 1;
+    }
+    auto sampler = MakeSampler(options.sampler);
+    if (sampler == nullptr) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    // 波前积分器只做一遍独立采样的路径追踪，不经过SelectRadiance
+    if (options.wavefront &&
+        (options.ao || options.nee || options.mis || options.guide ||
+         options.timeBudget > 0 || options.sampler != "independent")) {
+        std::cerr << "--wavefront does not support --ao, --nee, --mis, "
+                     "--guide, --time-budget or --sampler other than "
+                     "independent\n";
+        return 1;
+    }
+    // 引导和时间预算的渲染不统计逐像素的开销
+    if (!options.heatmap.empty() && (options.guide || options.timeBudget > 0)) {
+        std::cerr << "--heatmap is not supported with "
+                  << (options.guide ? "--guide" : "--time-budget") << '\n';
+        return 1;
+    }
+    // 动画序列每帧都用ProgressiveRenderer渲染固定的样本数
+    if (options.frames > 0 &&
+        (options.wavefront || options.guide || options.denoise ||
+         !options.auxPrefix.empty() || options.timeBudget > 0 ||
+         !options.heatmap.empty())) {
+        std::cerr << "--frames does not support --wavefront, --guide, "
+                     "--denoise, --aux, --time-budget or --heatmap\n";
+        return 1;
+    }
 
     // World
 
-    HittableList world;
-    Point3 lookFrom;
-    Point3 lookAt;
-    auto vfov = 40.0;
-    auto aperture = 0.0;
-    Color background{0, 0, 0};
-
-    switch (0) {
-        case 1:
-            world = RandomScene();
-            background = Color{0.7, 0.8, 1.0};
-            lookFrom = Point3(13, 2, 3);
-            lookAt = Point3(0, 0, 0);
-            vfov = 20.0;
-            aperture = 0.1;
-            break;
-
-        case 2:
-            world = TwoSpheres();
-            background = Color{0.7, 0.8, 1.0};
-            lookFrom = Point3(13, 2, 3);
-            lookAt = Point3(0, 0, 0);
-            vfov = 20.0;
-
-            break;
-
-        case 3:
-            world = TwoPerlinSpheres();
-            background = Color{0.7, 0.8, 1.0};
-            lookFrom = Point3(13, 2, 3);
-            lookAt = Point3(0, 0, 0);
-            vfov = 20.0;
-            break;
-
-        case 4:
-            world = Earth();
-            background = Color{0.7, 0.8, 1.0};
-            lookFrom = Point3(13, 2, 3);
-            lookAt = Point3(0, 0, 0);
-            vfov = 20.0;
-            break;
-
-        case 5:
-            world = SimpleLight();
-            samplePerPixels = 400;
-            background = Color{0.0, 0.0, 0.0};
-            lookFrom = Point3(26, 3, 6);
-            lookAt = Point3(0, 2, 0);
-            vfov = 20.0;
-            break;
+    // 场景对象都从arena分配，arena要比world活得久；材质放进同一张表
+    SceneArena arena;
+    SceneArena::Scope arenaScope(arena);
+    MaterialTable::Scope materialScope;
+    auto scene = LoadScene(options.scene);
+    const HittableList& world = scene.world;
+    const Color& background = scene.background;
+    const int maxDepth = 50;
+    int imageWidth = scene.imageWidth;
+    int samplePerPixels = scene.samplesPerPixel;
+
+    if (options.ao) {
+        // 预览只需要少量样本，遮蔽距离随场景的尺度变化
+        samplePerPixels = 16;
+        if (options.aoDistance <= 0) {
+            options.aoDistance = (scene.lookAt - scene.lookFrom).Length() / 10;
+        }
+    }
+    if (options.imageWidth > 0) imageWidth = options.imageWidth;
+    if (options.samplesPerPixel > 0) samplePerPixels = options.samplesPerPixel;
+
+    // 直接光照采样用到的光源
+    LightList lights;
+    if (options.nee || options.mis) {
+        world.CollectLights(lights);
+        if (!options.uniformLights && BuildLightTree(lights)) {
+            std::cerr << "Sampling " << lights.size()
+                      << " lights from a light tree of "
+                      << lights.tree->NodeCount() << " nodes\n";
+        } else {
+            std::cerr << "Sampling " << lights.size()
+                      << " lights uniformly\n";
+        }
+    }
 
-        case 6:
-            world = CornellBox();
-            aspectRatio = 1.0;
-            imageWidth = 600;
-            samplePerPixels = 200;
-            background = Color(0, 0, 0);
-            lookFrom = Point3(278, 278, -800);
-            lookAt = Point3(278, 278, 0);
-            vfov = 40.0;
-            break;
+    std::cerr << "Scene memory: " << arena.ObjectCount() << " objects in "
+              << arena.PoolCount() << " pools, " << arena.BytesUsed()
+              << " bytes used, " << arena.BytesReserved() << " bytes reserved\n";
 
-        case 7:
-            world = CornellSmoke();
-            aspectRatio = 1.0;
-            imageWidth = 600;
-            samplePerPixels = 200;
-            lookFrom = Point3(278, 278, -800);
-            lookAt = Point3(278, 278, 0);
-            vfov = 40.0;
-            break;
-            
-        default:
-        case 8:
-            world = FinalScene();
-            aspectRatio = 1.0;
-            imageWidth = 800;
-            samplePerPixels = 10000;
-            background = Color(0, 0, 0);
-            lookFrom = Point3(478, 278, -600);
-            lookAt = Point3(278, 278, 0);
-            vfov = 40.0;
-            break;
+    if (options.frames > 0) {
+        return RenderSequence(options, scene, lights, imageWidth,
+                              samplePerPixels, maxDepth);
     }
 
     // Camera
 
-    Vec3 vup = Vec3(0, 1, 0);
-    const int imageHeight = static_cast<int>(imageWidth / aspectRatio);
-    auto distToFocus = 10.0;
-    Camera camera(lookFrom, lookAt, vup, vfov, aspectRatio, aperture,
-                  distToFocus, 0.0, 1.0);
+    const int imageHeight = scene.ImageHeight(imageWidth);
+    auto camera = scene.MakeCamera(imageHeight);
 
     // Render
 
-    std::cout << "P3\n" << imageWidth << ' ' << imageHeight << "\n255\n";
-
-    // ! 直接重定向会导致输出的文件是带有BOM的UTF-16的文件
-    // ! .\theNextWeek.exe | set-content imageTheNextWeek.ppm -encoding String
-    for (int j = imageHeight - 1; j >= 0; --j) {
-        std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-        for (int i = 0; i < imageWidth; ++i) {
-            Color pixelColor = Color{0, 0, 0};
-            for (int s = 0; s < samplePerPixels; ++s) {
-                // 一个像素取samplePerPixels条打在这个像素内的光线
-                auto u = (i + RandomDouble()) / (imageWidth - 1);
-                auto v = (j + RandomDouble()) / (imageHeight - 1);
-                Ray r = camera.GetRay(u, v);
-                pixelColor += RayColor(r, background, world, maxDepth);
-            }
-            WriteColor(std::cout, pixelColor, samplePerPixels);
+    // 每个像素所有样本的和，从最上面一行开始
+    std::vector<Color> image;
+    // 每个像素所有样本的遍历开销之和，只在RTW_STATS下统计
+    std::vector<double> cost;
+    auto radiance =
+        SelectRadiance(options, world, background, lights, maxDepth);
+
+    // 没有--output时写到标准输出
+    std::ofstream file;
+    if (!options.output.empty()) {
+        file.open(options.output, std::ios::binary);
+        if (!file) {
+            std::cerr << "Could not open " << options.output << '\n';
+            return 1;
         }
-        std::cout << "\n";
-    }
-    std::cerr << "\nDone.\n";
-    return 0;
-}
-
-Color RayColor(const Ray& r, const Color& background, const Hittable& world,
-               int depth) {
-    HitRecord rec;
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0) return Color(0, 0, 0);
-
-    // If the ray hits nothing, return the background color.
-    // 防止浮点数近似为0
-    if (!world.Hit(r, 0.001, infinity, rec)) {
-        return background;
     }
-
-    Ray scattered;
-    Color attenuation;
-    Color emitted = rec.matPtr->Emitted(rec.u, rec.v, rec.p);
-
-    if (!rec.matPtr->Scatter(r, rec, attenuation, scattered)) {
-        return emitted;
+    std::ostream& out = options.output.empty() ? std::cout : file;
+
+    // 不需要整幅图像做后处理时，渲染好的行直接交给写线程，内存只和
+    // 等待写出的行数有关
+    const bool streaming = options.timeBudget <= 0 && !options.wavefront &&
+                           !options.guide && !options.denoise &&
+                           options.auxPrefix.empty() && options.heatmap.empty();
+    if (streaming) {
+        ProgressiveRenderer renderer(camera, radiance, options.sampler,
+                                     imageWidth, imageHeight,
+                                     options.threadCount);
+        renderer.Stream(samplePerPixels, out, 4 * options.threadCount);
+    } else if (options.guide) {
+        samplePerPixels = RenderGuided(options, world, camera, background,
+                                       lights, maxDepth, imageWidth,
+                                       imageHeight, samplePerPixels, image);
+        if (samplePerPixels == 0) return 1;
+    } else if (options.timeBudget > 0) {
+        ProgressiveRenderer renderer(camera, radiance, options.sampler,
+                                     imageWidth, imageHeight,
+                                     options.threadCount);
+        std::vector<int> sampleCount;
+        renderer.Render(options.timeBudget, options.samplesPerPixel, image,
+                        sampleCount);
+        auto minCount = *std::min_element(sampleCount.begin(),
+                                          sampleCount.end());
+        auto maxCount = *std::max_element(sampleCount.begin(),
+                                          sampleCount.end());
+        std::cerr << "Samples per pixel: " << minCount << " to " << maxCount
+                  << "\n";
+        if (!options.sppMap.empty()) {
+            std::ofstream sppMap(options.sppMap);
+            WriteSampleCounts(sppMap, sampleCount, imageWidth, imageHeight);
+        }
+        // 每个像素的样本数不同，换成平均值，后面按1个样本输出
+        for (size_t p = 0; p < image.size(); p++) {
+            image[p] /= std::max(sampleCount[p], 1);
+        }
+        samplePerPixels = 1;
+    } else if (options.wavefront) {
+        WavefrontIntegrator integrator(
+            world, camera, background, imageWidth, imageHeight,
+            samplePerPixels, maxDepth, options.threadCount, options.batchSize,
+            options.sortRays);
+        auto start = std::chrono::steady_clock::now();
+        integrator.Render(image, &cost);
+        std::chrono::duration<double> seconds =
+            std::chrono::steady_clock::now() - start;
+        std::cerr << "\nTraced " << integrator.RaysTraced() << " rays in "
+                  << seconds.count() << "s ("
+                  << integrator.RaysTraced() / seconds.count() / 1e6
+                  << " Mrays/s)\n";
+    } else {
+        ProgressiveRenderer renderer(camera, radiance, options.sampler,
+                                     imageWidth, imageHeight,
+                                     options.threadCount);
+        renderer.Render(samplePerPixels, image, 0, &cost);
     }
 
-    // 递归，多次反射
-    return emitted +
-           attenuation * RayColor(scattered, background, world, depth - 1);
-}
-
-HittableList RandomScene() {
-    HittableList world;
-
-    auto checker = std::make_shared<CheckerTexture>(Color(0.2, 0.3, 0.1),
-                                                    Color(0.9, 0.9, 0.9));
-    world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000,
-                                       std::make_shared<Lambertian>(checker)));
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto chooseMat = RandomDouble();
-            Point3 center(a + 0.9 * RandomDouble(), 0.2,
-                          b + 0.9 * RandomDouble());
-
-            if ((center - Point3(4, 0.2, 0)).Length() > 0.9) {
-                std::shared_ptr<Material> sphereMaterial;
-
-                if (chooseMat < 0.8) {
-                    // diffuse
-                    auto albedo = Color::Random() * Color::Random();
-                    sphereMaterial = std::make_shared<Lambertian>(albedo);
-                    auto center2 = center + Vec3(0, RandomDouble(0, 0.5), 0);
-                    world.add(std::make_shared<MovingSphere>(
-                        center, center2, 0.0, 1.0, 0.2, sphereMaterial));
-                } else if (chooseMat < 0.95) {
-                    // metal
-                    auto albedo = Color::Random(0.5, 1);
-                    auto fuzz = RandomDouble(0, 0.5);
-                    sphereMaterial = std::make_shared<Metal>(albedo, fuzz);
-                    world.add(
-                        std::make_shared<Sphere>(center, 0.2, sphereMaterial));
-                } else {
-                    // glass
-                    sphereMaterial = std::make_shared<Dielectric>(1.5);
-                    world.add(
-                        std::make_shared<Sphere>(center, 0.2, sphereMaterial));
-                }
+    // 特征图和降噪的光线不计入统计
+    if (options.stats || !options.heatmap.empty()) {
+#ifdef RTW_STATS
+        if (options.stats) Stats::Collect().Print(std::cerr, maxDepth);
+        if (!options.heatmap.empty()) {
+            auto meanCost = 0.0;
+            for (auto& c : cost) {
+                c /= samplePerPixels;
+                meanCost += c / cost.size();
             }
+            std::ofstream heatmap(options.heatmap);
+            auto white = WriteHeatmap(heatmap, cost, imageWidth, imageHeight);
+            std::cerr << "Traversal cost per sample: mean " << meanCost
+                      << ", " << white << " is white in the heatmap\n";
         }
+#else
+        std::cerr << "--stats and --heatmap need a build with RTW_STATS\n";
+#endif
     }
 
-    auto material1 = std::make_shared<Dielectric>(1.5);
-    world.add(std::make_shared<Sphere>(Point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = std::make_shared<Lambertian>(Color(0.4, 0.2, 0.1));
-    world.add(std::make_shared<Sphere>(Point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
-    world.add(std::make_shared<Sphere>(Point3(4, 1, 0), 1.0, material3));
-
-    return world;
-}
-
-HittableList TwoSpheres() {
-    HittableList objects;
-
-    auto checker = std::make_shared<CheckerTexture>(Color(0.2, 0.3, 0.1),
-                                                    Color(0.9, 0.9, 0.9));
-    objects.add(std::make_shared<Sphere>(
-        Point3(0, -10, 0), 10, std::make_shared<Lambertian>(checker)));
-    objects.add(std::make_shared<Sphere>(
-        Point3(0, 10, 0), 10, std::make_shared<Lambertian>(checker)));
-    return objects;
-}
-
-HittableList TwoPerlinSpheres() {
-    HittableList objects;
-
-    auto pertext = std::make_shared<NoiseTexture>(4);
-    objects.add(std::make_shared<Sphere>(
-        Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(pertext)));
-    objects.add(std::make_shared<Sphere>(
-        Point3(0, 2, 0), 2, std::make_shared<Lambertian>(pertext)));
-    return objects;
-}
-
-HittableList Earth() {
-    auto earthTexture =
-        std::make_shared<ImageTexture>("resources/earthmap.jpg");
-    auto earthSurface = std::make_shared<Lambertian>(earthTexture);
-    auto globe = std::make_shared<Sphere>(Point3{0, 0, 0}, 2, earthSurface);
+    if (options.denoise || !options.auxPrefix.empty()) {
+        // 特征图的噪声很小，少量样本就足够抗锯齿
+        auto features =
+            RenderFeatures(world, camera, background, imageWidth, imageHeight,
+                           std::min(samplePerPixels, 8), options.threadCount);
+        if (!options.auxPrefix.empty()) {
+            WriteFeatures(options.auxPrefix, features, imageWidth,
+                          imageHeight);
+        }
+        if (options.denoise) {
+            for (auto& pixelColor : image) pixelColor /= samplePerPixels;
+            auto start = std::chrono::steady_clock::now();
+            Denoise(image, features, imageWidth, imageHeight,
+                    options.threadCount);
+            std::chrono::duration<double> seconds =
+                std::chrono::steady_clock::now() - start;
+            std::cerr << "Denoised in " << seconds.count() << "s\n";
+            for (auto& pixelColor : image) pixelColor *= samplePerPixels;
+        }
+    }
 
-    return HittableList(globe);
+    // ! 直接重定向会导致输出的文件是带有BOM的UTF-16的文件
+    // ! .\theNextWeek.exe | set-content imageTheNextWeek.ppm -encoding String
+    if (!streaming) {
+        out << "P3\n" << imageWidth << ' ' << imageHeight << "\n255\n";
+        for (const auto& pixelColor : image) {
+            WriteColor(out, pixelColor, samplePerPixels);
+        }
+    }
+    if (!out.flush()) {
+        std::cerr << "Could not write the image\n";
+        return 1;
+    }
+    std::cerr << "Done.\n";
+    return 0;
 }
 
-HittableList SimpleLight() {
-    HittableList objects;
-
-    auto pertext = std::make_shared<NoiseTexture>(4);
-    objects.add(std::make_shared<Sphere>(
-        Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(pertext)));
-    objects.add(std::make_shared<Sphere>(
-        Point3(0, 2, 0), 2, std::make_shared<Lambertian>(pertext)));
-
-    // ? 颜色值超出范围
-    auto diffLight = std::make_shared<DiffuseLight>(Color{4, 4, 4});
-    objects.add(std::make_shared<XYRect>(3, 5, 1, 3, -2, diffLight));
-    return objects;
+RadianceFunction SelectRadiance(const Options& options, const Hittable& world,
+                                const Color& background,
+                                const LightList& lights, int maxDepth,
+                                PathGuide* guide) {
+    return [&options, &world, background, &lights, maxDepth, guide](
+               const Ray& r, Sampler& sampler) {
+        if (guide != nullptr) {
+            return RayColorGuided(r, background, world, lights, *guide,
+                                  sampler, maxDepth);
+        }
+        if (options.ao) {
+            return AmbientOcclusion(r, background, world, sampler,
+                                    options.aoDistance, maxDepth);
+        }
+        if (options.mis) {
+            return RayColorMIS(r, background, world, lights, sampler,
+                               maxDepth);
+        }
+        if (options.nee) {
+            return RayColorNEE(r, background, world, lights, sampler,
+                               maxDepth);
+        }
+        return RayColor(r, background, world, maxDepth);
+    };
 }
 
-HittableList CornellBox() {
-    HittableList objects;
-    auto red = std::make_shared<Lambertian>(Color{0.65, 0.05, 0.05});
-    auto white = std::make_shared<Lambertian>(Color{0.73, 0.73, 0.73});
-    auto green = std::make_shared<Lambertian>(Color{.12, .45, .15});
-    auto light = std::make_shared<DiffuseLight>(Color{15, 15, 15});
-
-    objects.add(std::make_shared<YZRect>(0, 555, 0, 555, 555, green));
-    objects.add(std::make_shared<YZRect>(0, 555, 0, 555, 0, red));
-    objects.add(std::make_shared<XZRect>(213, 343, 227, 332, 554, light));
-    objects.add(std::make_shared<XZRect>(0, 555, 0, 555, 0, white));
-    objects.add(std::make_shared<XZRect>(0, 555, 0, 555, 555, white));
-    objects.add(std::make_shared<XYRect>(0, 555, 0, 555, 555, white));
-
-    std::shared_ptr<Hittable> box1 =
-        std::make_shared<Box>(Point3(0, 0, 0), Point3(165, 330, 165), white);
-    box1 = std::make_shared<RotateY>(box1, 15);
-    box1 = std::make_shared<Translate>(box1, Vec3{256, 0, 295});
-    objects.add(box1);
+// Trains a PathGuide with the passes of GuidingPasses(samplesPerPixel) and
+// leaves their combination (PassCombiner) in image, as the mean of each
+// pixel. Without --nee lights is empty and the guide drives a plain path
+// tracer. Returns 1, the samples per pixel image is scaled for, or 0 if
+// the scene has no bounding box to guide in or --mis was asked for.
+int RenderGuided(const Options& options, const Hittable& world,
+                 const Camera& camera, const Color& background,
+                 const LightList& lights, int maxDepth, int imageWidth,
+                 int imageHeight, int samplesPerPixel,
+                 std::vector<Color>& image) {
+    AABB bounds;
+    if (!world.BoundingBox(0, 1, bounds)) {
+        std::cerr << "--guide needs a scene with a bounding box\n";
+        return 0;
+    }
+    if (options.mis) {
+        std::cerr << "--guide works with path tracing and --nee\n";
+        return 0;
+    }
+    if (options.timeBudget > 0) {
+        std::cerr << "--time-budget is ignored with --guide\n";
+    }
 
-    std::shared_ptr<Hittable> box2 =
-        std::make_shared<Box>(Point3(0, 0, 0), Point3(165, 165, 165), white);
-    box2 = std::make_shared<RotateY>(box2, -18);
-    box2 = std::make_shared<Translate>(box2, Vec3{130, 0, 65});
-    objects.add(box2);
-    return objects;
+    PathGuide guide(bounds);
+    auto radiance =
+        SelectRadiance(options, world, background, lights, maxDepth, &guide);
+    ProgressiveRenderer renderer(camera, radiance, options.sampler,
+                                 imageWidth, imageHeight, options.threadCount);
+    PassCombiner combiner;
+    std::vector<Color> second;
+    auto passes = GuidingPasses(samplesPerPixel);
+    auto first = 0;
+    for (size_t pass = 0; pass < passes.size(); pass++) {
+        auto last = pass + 1 == passes.size();
+        guide.SetTraining(!last);
+        auto start = std::chrono::steady_clock::now();
+        // 样本编号接着之前的pass，低差异序列不会重复
+        auto n1 = passes[pass] / 2, n2 = passes[pass] - n1;
+        auto variance = 0.0;
+        if (n1 == 0) {
+            renderer.Render(n2, image, first);
+        } else {
+            renderer.Render(n1, image, first);
+            renderer.Render(n2, second, first + n1);
+            variance = combiner.Add(image, n1, second, n2);
+        }
+        first += passes[pass];
+        if (!last) guide.Refine();
+        std::chrono::duration<double> seconds =
+            std::chrono::steady_clock::now() - start;
+        std::cerr << (last ? "Final pass: " : "Training pass: ")
+                  << passes[pass] << " spp in " << seconds.count() << "s";
+        if (n1 > 0) std::cerr << ", variance " << variance;
+        if (!last) {
+            std::cerr << ", " << guide.CellCount() << " cells, "
+                      << guide.DirectionalNodeCount() << " quadtree nodes";
+        }
+        std::cerr << '\n';
+    }
+    if (combiner.Empty()) return passes.back();
+    image = combiner.Image();
+    return 1;
 }
 
-HittableList CornellSmoke() {
-    HittableList objects;
-
-    auto red = std::make_shared<Lambertian>(Color(.65, .05, .05));
-    auto white = std::make_shared<Lambertian>(Color(.73, .73, .73));
-    auto green = std::make_shared<Lambertian>(Color(.12, .45, .15));
-    auto light = std::make_shared<DiffuseLight>(Color(7, 7, 7));
-
-    objects.add(std::make_shared<YZRect>(0, 555, 0, 555, 555, green));
-    objects.add(std::make_shared<YZRect>(0, 555, 0, 555, 0, red));
-    objects.add(std::make_shared<XZRect>(113, 443, 127, 432, 554, light));
-    objects.add(std::make_shared<XZRect>(0, 555, 0, 555, 555, white));
-    objects.add(std::make_shared<XZRect>(0, 555, 0, 555, 0, white));
-    objects.add(std::make_shared<XYRect>(0, 555, 0, 555, 555, white));
-
-    std::shared_ptr<Hittable> box1 =
-        std::make_shared<Box>(Point3(0, 0, 0), Point3(165, 330, 165), white);
-    box1 = std::make_shared<RotateY>(box1, 15);
-    box1 = std::make_shared<Translate>(box1, Vec3(265, 0, 295));
-
-    std::shared_ptr<Hittable> box2 =
-        std::make_shared<Box>(Point3(0, 0, 0), Point3(165, 165, 165), white);
-    box2 = std::make_shared<RotateY>(box2, -18);
-    box2 = std::make_shared<Translate>(box2, Vec3(130, 0, 65));
+// 在一个进程里渲染整个序列：每帧移动快门区间和相机，BVH只做refit，
+// 质量变差时才重建
+int RenderSequence(const Options& options, const Scene& scene,
+                   const LightList& lights, int imageWidth,
+                   int samplesPerPixel, int maxDepth) {
+    if (!FramePatternValid(options.output)) {
+        std::cerr << "--frames needs --output with one frame number pattern "
+                     "%d or %0Nd, e.g. frame_%04d.ppm (other % as %%)\n";
+        return 1;
+    }
 
-    objects.add(std::make_shared<ConstantMedium>(box1, 0.01, Color(0, 0, 0)));
-    objects.add(std::make_shared<ConstantMedium>(box2, 0.01, Color(1, 1, 1)));
+    auto start = std::chrono::steady_clock::now();
+    AnimatedWorld animated(scene.world, options.rebuildThreshold, 0,
+                           options.shutter / options.fps);
+    std::chrono::duration<double> buildSeconds =
+        std::chrono::steady_clock::now() - start;
+    std::cerr << "Built the scene BVH in " << buildSeconds.count() << "s\n";
+
+    const int imageHeight = scene.ImageHeight(imageWidth);
+    std::vector<Color> image;
+    double updateSeconds = 0;
+    for (int frame = 0; frame < options.frames; frame++) {
+        // 第frame帧的快门在frame / fps时打开
+        auto time0 = frame / options.fps;
+        auto time1 = time0 + options.shutter / options.fps;
+        auto orbit = options.orbit * frame / options.frames;
+
+        auto frameStart = std::chrono::steady_clock::now();
+        auto rebuilt = animated.Update(time0, time1);
+        std::chrono::duration<double> update =
+            std::chrono::steady_clock::now() - frameStart;
+        updateSeconds += update.count();
+
+        // 重建之后World()是一棵新的树
+        auto radiance = SelectRadiance(options, animated.World(),
+                                       scene.background, lights, maxDepth);
+        auto camera = scene.MakeCamera(imageHeight, time0, time1, orbit);
+        ProgressiveRenderer renderer(camera, radiance, options.sampler,
+                                     imageWidth, imageHeight,
+                                     options.threadCount);
+        renderer.Render(samplesPerPixel, image);
+        std::chrono::duration<double> frameSeconds =
+            std::chrono::steady_clock::now() - frameStart;
+
+        char path[1024];
+        std::snprintf(path, sizeof(path), options.output.c_str(), frame);
+        std::ofstream out(path);
+        out << "P3\n" << imageWidth << ' ' << imageHeight << "\n255\n";
+        for (const auto& pixelColor : image) {
+            WriteColor(out, pixelColor, samplesPerPixel);
+        }
+        if (!out) {
+            std::cerr << "Could not write " << path << '\n';
+            return 1;
+        }
 
-    return objects;
+        std::cerr << "Frame " << frame << ": " << frameSeconds.count()
+                  << "s, BVH " << (rebuilt ? "rebuilt" : "refit") << " in "
+                  << update.count() * 1e3 << "ms, node area growth "
+                  << animated.AreaGrowth() << '\n';
+    }
+    std::cerr << options.frames << " frames, " << animated.Rebuilds()
+              << " BVH rebuilds, " << updateSeconds << "s updating the BVH\n";
+#ifdef RTW_STATS
+    if (options.stats) Stats::Collect().Print(std::cerr, maxDepth);
+#endif
+    return 0;
 }
 
-HittableList FinalScene() {
-    HittableList objects;
-
-    // 地板
-    HittableList boxes1;
-    auto ground = std::make_shared<Lambertian>(Color{0.48, 0.83, 0.53});
-
-    const int boxesPerSize = 20;
-    for (int i = 0; i < boxesPerSize; i++) {
-        for (int j = 0; j < boxesPerSize; j++) {
-            auto w = 100.0;
-            auto x0 = -1000.0 + i * w;
-            auto z0 = -1000.0 + j * w;
-            auto y0 = 0.0;
-            auto x1 = x0 + w;
-            auto y1 = RandomDouble(1, 101);
-            auto z1 = z0 + w;
-            boxes1.add(std::make_shared<Box>(Point3(x0, y0, z0),
-                                             Point3(x1, y1, z1), ground));
+// 帧号模式直接作为snprintf的格式，所以只允许恰好一个%d或者%0Nd，
+// 其余的%必须写成%%
+bool FramePatternValid(const std::string& pattern) {
+    auto conversions = 0;
+    for (size_t n = 0; n < pattern.size(); n++) {
+        if (pattern[n] != '%') continue;
+        if (++n < pattern.size() && pattern[n] == '%') continue;
+        while (n < pattern.size() &&
+               std::isdigit(static_cast<unsigned char>(pattern[n]))) {
+            n++;
         }
+        if (n == pattern.size() || pattern[n] != 'd') return false;
+        conversions++;
     }
-    objects.add(std::make_shared<BVHNode>(boxes1, 0, 1));
-
-    // 光源
-    auto light = std::make_shared<DiffuseLight>(Color{7, 7, 7});
-    objects.add(std::make_shared<XZRect>(123, 423, 147, 412, 554, light));
-
-    // 移动的球
-    auto center1 = Point3(400, 400, 200);
-    auto center2 = center1 + Vec3(30, 0, 0);
-    auto moving_sphere_material =
-        std::make_shared<Lambertian>(Color(0.7, 0.3, 0.1));
-    objects.add(std::make_shared<MovingSphere>(center1, center2, 0, 1, 50,
-                                               moving_sphere_material));
-
-    // 玻璃球
-    objects.add(std::make_shared<Sphere>(Point3(260, 150, 45), 50,
-                                         std::make_shared<Dielectric>(1.5)));
-    // 金属球
-    objects.add(std::make_shared<Sphere>(
-        Point3(0, 150, 145), 50,
-        std::make_shared<Metal>(Color(0.8, 0.8, 0.9), 1.0)));
-
-    // 有色玻璃球，藏青
-    auto boundary = std::make_shared<Sphere>(Point3(360, 150, 145), 70,
-                                             std::make_shared<Dielectric>(1.5));
-    objects.add(boundary);
-    objects.add(
-        std::make_shared<ConstantMedium>(boundary, 0.2, Color(0.2, 0.4, 0.9)));
-    // 全局白色烟雾
-    boundary = std::make_shared<Sphere>(Point3(0, 0, 0), 5000,
-                                        std::make_shared<Dielectric>(1.5));
-    objects.add(
-        std::make_shared<ConstantMedium>(boundary, .0001, Color(1, 1, 1)));
-
-    // 地球
-    auto earthTexture =
-        std::make_shared<ImageTexture>("resources/earthmap.jpg");
-    auto earthSurface = std::make_shared<Lambertian>(earthTexture);
-    auto earth =
-        std::make_shared<Sphere>(Point3{400, 200, 400}, 100, earthSurface);
-    objects.add(earth);
-    // 柏林噪音球
-    auto pertext = std::make_shared<NoiseTexture>(0.1);
-    objects.add(std::make_shared<Sphere>(
-        Point3(220, 280, 300), 80, std::make_shared<Lambertian>(pertext)));
-
-    // 盒中众球
-    HittableList boxes2;
-    auto white = std::make_shared<Lambertian>(Color(.73, .73, .73));
-    int ns = 1000;
-    for (int j = 0; j < ns; j++) {
-        boxes2.add(std::make_shared<Sphere>(Point3::Random(0, 165), 10, white));
-    }
-    objects.add(std::make_shared<Translate>(
-        std::make_shared<RotateY>(std::make_shared<BVHNode>(boxes2, 0.0, 1.0),
-                                  15),
-        Vec3(-100, 270, 395)));
-    return objects;
-}
\ No newline at end of file
+    return conversions == 1;
+}
@@ -1,129 +1,399 @@
 #pragma once
 
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "fast_math.hpp"
+#include "hittable.hpp"
+#include "onb.hpp"
 #include "rtweekend.hpp"
+#include "sampler.hpp"
 #include "texture.hpp"
 
-class HitRecord;
+enum class MaterialType : unsigned char {
+    Lambertian,
+    Metal,
+    Dielectric,
+    DiffuseLight,
+    Isotropic
+};
+
+// 材质的紧凑描述，着色时按type分支，不再经过虚函数
+struct MaterialData {
+    MaterialType type;
+    // uv是否会被读取，构造时确定
+    bool needsUV;
+    // Metal的fuzz，Dielectric的折射率
+    double param;
+    // Lambertian/Isotropic/Metal的albedo，DiffuseLight的发光颜色
+    Color color;
+    // 非纯色的纹理，为空时直接使用color
+    const Texture* texture;
+};
+
+// 按材质的分布采样出的散射方向
+struct ScatterRecord {
+    Ray scattered;
+    // f * cos / pdf，也就是路径通量要乘上的权重
+    Color attenuation;
+    // 方向的立体角pdf，镜面(delta)分布为0
+    double pdf;
+
+    bool IsSpecular() const { return pdf == 0; }
+};
 
 class Material {
-   public:
-    virtual bool Scatter(const Ray& rayIn, const HitRecord& rec,
-                         Color& attenuation, Ray& scattered) const = 0;
+   private:
+    static double reflectance(double cosine, double ref_idx) {
+        // Use Schlick's approximation for reflectance.
+        auto r0 = (1 - ref_idx) / (1 + ref_idx);
+        r0 = r0 * r0;
+        return r0 + (1 - r0) * Pow5(1 - cosine);
+    }
 
-    virtual Color Emitted(double u, double v, const Point3& p) const {
-        return Color{0, 0, 0};
+    // 按Fresnel反射率在反射和折射之间选择，u是[0,1)内的随机数
+    Vec3 dielectricDirection(const Ray& rayIn, const HitRecord& rec,
+                             double u) const {
+        double refractionRatio =
+            rec.front_face ? (1.0 / data.param) : data.param;
+
+        Vec3 unitDirection = UnitVector(rayIn.Direction());
+        double cosTheta = fmin(Dot(-unitDirection, rec.normal), 1.0);
+        double sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+
+        bool cannotRefract = refractionRatio * sinTheta > 1.0;
+        if (cannotRefract || reflectance(cosTheta, refractionRatio) > u) {
+            return Reflect(unitDirection, rec.normal);
+        }
+        return Refract(unitDirection, rec.normal, refractionRatio);
+    }
+
+    Color textureValue(double u, double v, const Point3& p,
+                       double footprint) const {
+        return data.texture == nullptr
+                   ? data.color
+                   : data.texture->FilteredValue(u, v, p, footprint);
+    }
+
+    // 漫反射之后的纹理查询反正会被积分模糊，给一个很宽的锥读低分辨率层级
+    static constexpr double diffuseSpread = 0.25;
+
+    // Continues the incoming ray cone from the hit. Specular bounces keep
+    // the spread (ignoring surface curvature), rough ones widen it.
+    static void propagateCone(const Ray& rayIn, const HitRecord& rec,
+                              double extraSpread, Ray& scattered) {
+        scattered.width = rec.Footprint(rayIn);
+        scattered.spread = rayIn.spread + extraSpread;
     }
-};
 
-class Lambertian : public Material {
    public:
-    std::shared_ptr<Texture> albedo;
+    MaterialData data;
 
-    Lambertian(const Color& a) : albedo(std::make_shared<SolidColor>(a)) {}
-    Lambertian(std::shared_ptr<Texture> a) : albedo(a) {}
+    explicit Material(const MaterialData& d) : data(d) {}
 
-    virtual bool Scatter(const Ray& rayIn, const HitRecord& rec,
-                         Color& attenuation, Ray& scattered) const override {
-        // 随机漫反射
-        auto scatterDirection = rec.normal + RandomUnitVector();
+    MaterialType Type() const { return data.type; }
 
-        // Lambertian Reflection
-        // auto scatterDirection = rec.p + rec.normal + RandomUnitVector();
+    bool IsEmissive() const { return data.type == MaterialType::DiffuseLight; }
 
-        // Catch degenerate scatter direction
-        if (scatterDirection.NearZero()) scatterDirection = rec.normal;
+    // 漫反射类的材质可以做直接光照采样
+    bool IsDiffuse() const {
+        return data.type == MaterialType::Lambertian ||
+               data.type == MaterialType::Isotropic;
+    }
 
-        scattered = Ray(rec.p, scatterDirection, rayIn.Time());
-        attenuation = albedo->Value(rec.u, rec.v, rec.p);
-        return true;
+    // BSDF (or phase function) times the cosine term for scattering into
+    // direction; zero for the specular materials.
+    Color Eval(const HitRecord& rec, const Vec3& direction) const {
+        switch (data.type) {
+            case MaterialType::Lambertian: {
+                auto cosine = Dot(rec.normal, UnitVector(direction));
+                if (cosine <= 0) return Color{0, 0, 0};
+                return textureValue(rec.u, rec.v, rec.p, rec.uvFootprint) *
+                       (cosine / pi);
+            }
+            case MaterialType::Isotropic:
+                return textureValue(rec.u, rec.v, rec.p, rec.uvFootprint) /
+                       (4 * pi);
+            default:
+                return Color{0, 0, 0};
+        }
     }
-};
 
-class Metal : public Material {
-   public:
-    Color albedo;
-    double fuzz;
-
-    Metal(const Color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
-
-    virtual bool Scatter(const Ray& rayIn, const HitRecord& rec,
-                         Color& attenuation, Ray& scattered) const override {
-        Vec3 reflected = Reflect(UnitVector(rayIn.Direction()), rec.normal);
-        scattered =
-            Ray(rec.p, reflected + fuzz * RandomInUnitSphere(), rayIn.Time());
-        attenuation = albedo;
-        return (Dot(scattered.Direction(), rec.normal) > 0);
+    // Solid angle density with which Sample() picks direction; zero for
+    // the specular materials, whose distributions are deltas.
+    double Pdf(const HitRecord& rec, const Vec3& direction) const {
+        switch (data.type) {
+            case MaterialType::Lambertian: {
+                auto cosine = Dot(rec.normal, UnitVector(direction));
+                return cosine <= 0 ? 0 : cosine / pi;
+            }
+            case MaterialType::Isotropic:
+                return 1 / (4 * pi);
+            default:
+                return 0;
+        }
     }
-};
 
-class Dielectric : public Material {
-   private:
-    static double reflectance(double cosine, double ref_idx) {
-        // Use Schlick's approximation for reflectance.
-        auto r0 = (1 - ref_idx) / (1 + ref_idx);
-        r0 = r0 * r0;
-        return r0 + (1 - r0) * pow((1 - cosine), 5);
+    inline bool Sample(const Ray& rayIn, const HitRecord& rec,
+                       Sampler& sampler, ScatterRecord& srec) const;
+
+    // 降噪用的首次命中反照率：镜面材质取白色，光源取截断到1的发光颜色
+    Color Albedo(const HitRecord& rec) const {
+        switch (data.type) {
+            case MaterialType::Dielectric:
+                return Color{1, 1, 1};
+            case MaterialType::DiffuseLight: {
+                auto c = textureValue(rec.u, rec.v, rec.p, rec.uvFootprint);
+                return Color(fmin(c.X(), 1.0), fmin(c.Y(), 1.0),
+                             fmin(c.Z(), 1.0));
+            }
+            default:
+                return textureValue(rec.u, rec.v, rec.p, rec.uvFootprint);
+        }
     }
 
-   public:
-    // index of Refraction
-    double ir;
+    // Whether Scatter/Emitted read rec.u and rec.v, so that primitives can
+    // skip computing texture coordinates.
+    bool NeedsUV() const { return data.needsUV; }
+
+    inline bool Scatter(const Ray& rayIn, const HitRecord& rec,
+                        Color& attenuation, Ray& scattered) const;
+
+    Color Emitted(double u, double v, const Point3& p) const {
+        if (data.type != MaterialType::DiffuseLight) {
+            return Color{0, 0, 0};
+        }
+        return textureValue(u, v, p, 0);
+    }
+};
 
-    Dielectric(double indexOfRefraction) : ir(indexOfRefraction) {}
+bool Material::Scatter(const Ray& rayIn, const HitRecord& rec,
+                       Color& attenuation, Ray& scattered) const {
+    switch (data.type) {
+        case MaterialType::Lambertian: {
+            // 随机漫反射
+            auto scatterDirection = rec.normal + RandomUnitVector();
 
-    virtual bool Scatter(const Ray& rayIn, const HitRecord& rec,
-                         Color& attenuation, Ray& scattered) const override {
-        // always refracts
-        attenuation = Color(1.0, 1.0, 1.0);
-        double refractionRatio = rec.front_face ? (1.0 / ir) : ir;
+            // Lambertian Reflection
+            // auto scatterDirection = rec.p + rec.normal + RandomUnitVector();
 
-        Vec3 unitDirection = UnitVector(rayIn.Direction());
-        double cosTheta = fmin(Dot(-unitDirection, rec.normal), 1.0);
-        double sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+            // Catch degenerate scatter direction
+            if (scatterDirection.NearZero()) scatterDirection = rec.normal;
 
-        bool cannotRefract = refractionRatio * sinTheta > 1.0;
-        Vec3 direction;
+            scattered = rec.SpawnRay(scatterDirection, rayIn.Time());
+            propagateCone(rayIn, rec, diffuseSpread, scattered);
+            attenuation = textureValue(rec.u, rec.v, rec.p, rec.uvFootprint);
+            return true;
+        }
+
+        case MaterialType::Metal: {
+            Vec3 reflected =
+                Reflect(UnitVector(rayIn.Direction()), rec.normal);
+            scattered = rec.SpawnRay(
+                reflected + data.param * RandomInUnitSphere(), rayIn.Time());
+            propagateCone(rayIn, rec, data.param * diffuseSpread, scattered);
+            attenuation = data.color;
+            return (Dot(scattered.Direction(), rec.normal) > 0);
+        }
+
+        case MaterialType::Dielectric: {
+            // always refracts
+            attenuation = Color(1.0, 1.0, 1.0);
+            auto direction = dielectricDirection(rayIn, rec, RandomDouble());
+            scattered = rec.SpawnRay(direction, rayIn.Time());
+            propagateCone(rayIn, rec, 0, scattered);
+            return true;
+        }
+
+        case MaterialType::Isotropic:
+            scattered = rec.SpawnRay(RandomInUnitSphere(), rayIn.Time());
+            propagateCone(rayIn, rec, diffuseSpread, scattered);
+            attenuation = textureValue(rec.u, rec.v, rec.p, rec.uvFootprint);
+            return true;
+
+        case MaterialType::DiffuseLight:
+        default:
+            return false;
+    }
+}
+
+// Scatter() driven by a Sampler, with the density of the sampled
+// direction. Every call draws the same three dimensions (a 2D sample and a
+// 1D sample) whatever the material, so that the dimensions of the next
+// bounce do not depend on it. Lambertian draws from cosθ/π in the frame of
+// the normal, Isotropic uniformly over the sphere; the specular materials
+// report pdf 0.
+bool Material::Sample(const Ray& rayIn, const HitRecord& rec,
+                      Sampler& sampler, ScatterRecord& srec) const {
+    auto u = sampler.Get2D();
+    auto u3 = sampler.Get1D();
 
-        if (cannotRefract ||
-            reflectance(cosTheta, refractionRatio) > RandomDouble()) {
-            direction = Reflect(unitDirection, rec.normal);
-        } else {
-            direction = Refract(unitDirection, rec.normal, refractionRatio);
+    switch (data.type) {
+        case MaterialType::Lambertian: {
+            ONB uvw(rec.normal);
+            auto direction = uvw.Local(SampleCosineDirection(u.x, u.y));
+            srec.scattered = rec.SpawnRay(direction, rayIn.Time());
+            propagateCone(rayIn, rec, diffuseSpread, srec.scattered);
+            srec.attenuation =
+                textureValue(rec.u, rec.v, rec.p, rec.uvFootprint);
+            srec.pdf = Pdf(rec, direction);
+            // 掠射方向cos为0，这个样本没有贡献
+            return srec.pdf > 0;
         }
 
-        scattered = Ray(rec.p, direction, rayIn.Time());
-        return true;
+        case MaterialType::Metal: {
+            // 单位球内均匀分布的扰动：方向取自u，半径取自u3
+            auto fuzz = cbrt(u3) * SampleUnitSphere(u.x, u.y);
+            auto reflected = Reflect(UnitVector(rayIn.Direction()), rec.normal);
+            srec.scattered =
+                rec.SpawnRay(reflected + data.param * fuzz, rayIn.Time());
+            propagateCone(rayIn, rec, data.param * diffuseSpread,
+                          srec.scattered);
+            srec.attenuation = data.color;
+            srec.pdf = 0;
+            return Dot(srec.scattered.Direction(), rec.normal) > 0;
+        }
+
+        case MaterialType::Dielectric:
+            srec.scattered = rec.SpawnRay(
+                dielectricDirection(rayIn, rec, u3), rayIn.Time());
+            propagateCone(rayIn, rec, 0, srec.scattered);
+            srec.attenuation = Color(1.0, 1.0, 1.0);
+            srec.pdf = 0;
+            return true;
+
+        case MaterialType::Isotropic:
+            srec.scattered =
+                rec.SpawnRay(SampleUnitSphere(u.x, u.y), rayIn.Time());
+            propagateCone(rayIn, rec, diffuseSpread, srec.scattered);
+            srec.attenuation =
+                textureValue(rec.u, rec.v, rec.p, rec.uvFootprint);
+            srec.pdf = 1 / (4 * pi);
+            return true;
+
+        case MaterialType::DiffuseLight:
+        default:
+            return false;
+    }
+}
+
+// A scene's materials by value: blocks of contiguous Material records,
+// which hold nothing but their MaterialData, plus the textures the
+// records point to. MakeMaterial adds to the table of the innermost Scope
+// on the calling thread, or outside any Scope to a table of its own; the
+// shared_ptr it returns points into the table and keeps the whole table
+// alive.
+class MaterialTable {
+   private:
+    // 块的容量固定，记录的地址不会因为后来的插入而改变
+    static const size_t blockSize = 256;
+
+    std::vector<std::vector<Material>> blocks_;
+    std::vector<std::shared_ptr<Texture>> textures_;
+
+    static std::shared_ptr<MaterialTable>& current() {
+        static thread_local std::shared_ptr<MaterialTable> table;
+        return table;
     }
-};
 
-class DiffuseLight : public Material {
    public:
-    std::shared_ptr<Texture> emit;
+    // Installs a new table as the target of MakeMaterial for the current
+    // thread until the scope ends.
+    class Scope {
+       private:
+        std::shared_ptr<MaterialTable> previous_;
+
+       public:
+        Scope() : previous_(current()) {
+            current() = std::make_shared<MaterialTable>();
+        }
+        ~Scope() { current() = previous_; }
 
-    DiffuseLight(std::shared_ptr<Texture> a) : emit(a) {}
-    DiffuseLight(Color c) : emit(std::make_shared<SolidColor>(c)) {}
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
 
-    virtual bool Scatter(const Ray& rayIn, const HitRecord& rec,
-                         Color& attenuation, Ray& scattered) const {
-        return false;
+    static std::shared_ptr<MaterialTable> Current() { return current(); }
+
+    Material* Add(const MaterialData& data, std::shared_ptr<Texture> texture) {
+        if (blocks_.empty() || blocks_.back().size() == blockSize) {
+            blocks_.emplace_back();
+            blocks_.back().reserve(blockSize);
+        }
+        if (texture != nullptr) textures_.push_back(std::move(texture));
+        blocks_.back().push_back(Material(data));
+        return &blocks_.back().back();
     }
 
-    virtual Color Emitted(double u, double v, const Point3& p) const {
-        return emit->Value(u, v, p);
+    size_t Size() const {
+        return blocks_.empty()
+                   ? 0
+                   : (blocks_.size() - 1) * blockSize + blocks_.back().size();
     }
 };
 
-class Isotropic : public Material {
-   public:
-    std::shared_ptr<Texture> albedo;
+// 以下类型只描述材质：算出MaterialData和记录要用的纹理，由MakeMaterial
+// 放进MaterialTable
+struct MaterialDescription {
+    MaterialData data;
+    // 纹理已经折叠进color时为空
+    std::shared_ptr<Texture> texture;
 
-    Isotropic(Color c) : albedo(std::make_shared<SolidColor>(c)) {}
-    Isotropic(std::shared_ptr<Texture> a) : albedo(a) {}
+   protected:
+    MaterialDescription(MaterialType type, const Color& color,
+                        double param = 0)
+        : data{type, false, param, color, nullptr} {}
 
-    virtual bool Scatter(const Ray& rayIn, const HitRecord& rec,
-                         Color& attenuation, Ray& scattered) const {
-        scattered = Ray(rec.p, RandomInUnitSphere(), rayIn.Time());
-        attenuation = albedo->Value(rec.u, rec.v, rec.p);
-        return true;
+    MaterialDescription(MaterialType type, std::shared_ptr<Texture> t)
+        : data{type, t->NeedsUV(), 0, Color{}, t.get()}, texture(t) {
+        // 纯色纹理直接折叠进color，省掉一次纹理查询
+        if (dynamic_cast<const SolidColor*>(t.get()) != nullptr) {
+            data.color = t->Value(0, 0, Point3{});
+            data.texture = nullptr;
+            texture = nullptr;
+        }
     }
 };
+
+struct Lambertian : MaterialDescription {
+    Lambertian(const Color& a)
+        : MaterialDescription(MaterialType::Lambertian, a) {}
+    Lambertian(std::shared_ptr<Texture> a)
+        : MaterialDescription(MaterialType::Lambertian, a) {}
+};
+
+struct Metal : MaterialDescription {
+    Metal(const Color& a, double f)
+        : MaterialDescription(MaterialType::Metal, a, f < 1 ? f : 1) {}
+};
+
+struct Dielectric : MaterialDescription {
+    Dielectric(double indexOfRefraction)
+        : MaterialDescription(MaterialType::Dielectric, Color{},
+                              indexOfRefraction) {}
+};
+
+struct DiffuseLight : MaterialDescription {
+    DiffuseLight(std::shared_ptr<Texture> a)
+        : MaterialDescription(MaterialType::DiffuseLight, a) {}
+    DiffuseLight(Color c)
+        : MaterialDescription(MaterialType::DiffuseLight, c) {}
+};
+
+struct Isotropic : MaterialDescription {
+    Isotropic(Color c) : MaterialDescription(MaterialType::Isotropic, c) {}
+    Isotropic(std::shared_ptr<Texture> a)
+        : MaterialDescription(MaterialType::Isotropic, a) {}
+};
+
+// Adds the material that T(args...) describes to the current MaterialTable.
+template <class T, class... Args>
+std::shared_ptr<Material> MakeMaterial(Args&&... args) {
+    T description(std::forward<Args>(args)...);
+    auto table = MaterialTable::Current();
+    if (table == nullptr) table = std::make_shared<MaterialTable>();
+    auto material =
+        table->Add(description.data, std::move(description.texture));
+    return std::shared_ptr<Material>(table, material);
+}
@@ -1,13 +1,14 @@
 #pragma once
 
 #include "hittable.hpp"
+#include "material.hpp"
 #include "rtweekend.hpp"
 
 class MovingSphere : public Hittable {
    public:
     Point3 center0, center1;
     double time0, time1;
-    double radius;
+    Real radius;
     std::shared_ptr<Material> matPtr;
 
     MovingSphere() {}
@@ -20,17 +21,34 @@ class MovingSphere : public Hittable {
           radius(r),
           matPtr(m) {}
 
-    virtual bool Hit(const Ray& r, double t_min, double t_max,
+    virtual bool Hit(const Ray& r, Real t_min, Real t_max,
                      HitRecord& rec) const override;
 
+    virtual bool Occluded(const Ray& r, Real tMin, Real tMax) const override {
+        Real root;
+        return nearestRoot(r, tMin, tMax, root);
+    }
+
+    virtual void SurfaceInteraction(const Ray& r,
+                                    HitRecord& rec) const override;
+
     virtual bool BoundingBox(double time0, double time1,
                              AABB& outputBox) const override;
 
+    virtual bool IsConvex() const override { return true; }
+
+    virtual bool Interval(const Ray& r, Real& tEnter,
+                          Real& tExit) const override;
+
     Point3 Center(double time) const;
+
+   private:
+    bool nearestRoot(const Ray& r, Real tMin, Real tMax, Real& root) const;
 };
 
-bool MovingSphere::Hit(const Ray& r, double t_min, double t_max,
-                       HitRecord& rec) const {
+bool MovingSphere::nearestRoot(const Ray& r, Real tMin, Real tMax,
+                               Real& root) const {
+    RTW_STAT_PRIMITIVE(PrimitiveType::MovingSphere);
     // 相对于Shpere，只是改变了center的获取方式
     // 由于只是进行学习，不需要考虑进一步抽象和封装
 
@@ -44,31 +62,61 @@ bool MovingSphere::Hit(const Ray& r, double t_min, double t_max,
     auto sqrtd = sqrt(discriminant);
 
     // Find the nearest root that lies in the acceptable range.
-    auto root = (-half_b - sqrtd) / a;
-    if (root < t_min || t_max < root) {
+    root = (-half_b - sqrtd) / a;
+    if (root < tMin || tMax < root) {
         root = (-half_b + sqrtd) / a;
-        if (root < t_min || t_max < root) return false;
+        if (root < tMin || tMax < root) return false;
     }
+    return true;
+}
+
+bool MovingSphere::Hit(const Ray& r, Real t_min, Real t_max,
+                       HitRecord& rec) const {
+    Real root;
+    if (!nearestRoot(r, t_min, t_max, root)) return false;
 
     rec.t = root;
-    rec.p = r.at(rec.t);
-    Vec3 outwardNormal = (rec.p - Center(r.Time())) / radius;
-    rec.SetFaceNormal(r, outwardNormal);
-    rec.matPtr = matPtr;
+    rec.object = this;
 
     return true;
 }
 
+void MovingSphere::SurfaceInteraction(const Ray& r, HitRecord& rec) const {
+    // 和Sphere一样投影回球面，负的半径只用来让法线反向
+    auto center = Center(r.Time());
+    auto local = r.at(rec.t) - center;
+    local *= fabs(radius) / local.Length();
+    rec.p = center + local;
+    rec.pError = Gamma(5) * Abs(local) + Gamma(1) * Abs(rec.p);
+    Vec3 outwardNormal = local / radius;
+    rec.SetFaceNormal(r, outwardNormal);
+    rec.matPtr = matPtr;
+}
+
 bool MovingSphere::BoundingBox(double time0, double time1,
                                AABB& outputBox) const {
-    AABB box0{Center(time0) - Vec3(radius, radius, radius),
-              Center(time0) + Vec3(radius, radius, radius)};
-    AABB box1{Center(time1) - Vec3(radius, radius, radius),
-              Center(time1) + Vec3(radius, radius, radius)};
+    auto r = fabs(radius);
+    AABB box0{Center(time0) - Vec3(r, r, r), Center(time0) + Vec3(r, r, r)};
+    AABB box1{Center(time1) - Vec3(r, r, r), Center(time1) + Vec3(r, r, r)};
     outputBox = SurroundingBox(box0, box1);
     return true;
 }
 
 Point3 MovingSphere::Center(double time) const {
     return center0 + ((time - time0) / (time1 - time0)) * (center1 - center0);
-}
\ No newline at end of file
+}
+
+bool MovingSphere::Interval(const Ray& r, Real& tEnter, Real& tExit) const {
+    Vec3 oc = r.Origin() - Center(r.Time());
+    auto a = r.Direction().LengthSquared();
+    auto halfB = Dot(oc, r.Direction());
+    auto c = oc.LengthSquared() - radius * radius;
+
+    auto discriminant = halfB * halfB - a * c;
+    if (discriminant < 0) return false;
+    auto sqrtd = sqrt(discriminant);
+
+    tEnter = (-halfB - sqrtd) / a;
+    tExit = (-halfB + sqrtd) / a;
+    return true;
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "parallel.hpp"
+
+// 命令行参数，0表示使用场景自己的设置
+struct Options {
+    int scene = 0;
+    int imageWidth = 0;
+    int samplesPerPixel = 0;
+    int threadCount = DefaultThreadCount();
+    bool wavefront = false;
+    int batchSize = 1 << 16;
+    bool sortRays = false;
+    bool nee = false;
+    bool mis = false;
+    // 直接光照均匀地选择光源，不建光源树
+    bool uniformLights = false;
+    // 路径引导：训练几遍学习入射光的分布，按它采样漫反射和介质里的方向；
+    // 和路径追踪或者--nee一起用
+    bool guide = false;
+    // 环境光遮蔽预览，aoDistance为0时取相机到lookAt距离的1/10
+    bool ao = false;
+    double aoDistance = 0;
+    bool denoise = false;
+    // 相机、材质和光源采样的随机数来源
+    std::string sampler = "independent";
+    // 非空时写出<auxPrefix>_albedo/_normal/_depth.ppm
+    std::string auxPrefix;
+    // 打印求交统计，需要用RTW_STATS编译
+    bool stats = false;
+    // 非空时写出逐像素遍历开销的热度图，需要用RTW_STATS编译
+    std::string heatmap;
+    // 大于0时按时间预算渐进渲染，--spp变成样本数的上限
+    double timeBudget = 0;
+    // 非空时写出每个像素实际的样本数
+    std::string sppMap;
+    // 输出文件，为空时写到标准输出；渲染动画序列(frames大于0)时是
+    // 按帧号格式化的文件名
+    int frames = 0;
+    std::string output;
+    double fps = 24;
+    // 快门打开的时间占一帧的比例
+    double shutter = 0.5;
+    // 整个序列里相机绕lookAt转过的角度
+    double orbit = 0;
+    // BVH节点的表面积平均增长到建树时的这么多倍就重建
+    double rebuildThreshold = 1.5;
+};
+
+inline void PrintUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options] > image.ppm\n"
+              << "  --scene N      scene to render (1-9, default 8)\n"
+              << "  --width N      override the image width\n"
+              << "  --spp N        override the samples per pixel\n"
+              << "  --threads N    worker threads (default: all cores)\n"
+              << "  --wavefront    wavefront path tracer (independent sampler\n"
+              << "                 only, no --ao/--nee/--mis/--guide/\n"
+              << "                 --time-budget)\n"
+              << "  --batch N      wavefront paths in flight (default 65536)\n"
+              << "  --sort-rays    sort secondary rays by origin and direction\n"
+              << "  --nee          sample lights explicitly at diffuse hits\n"
+              << "  --mis          combine light and material sampling\n"
+              << "  --uniform-lights pick lights uniformly (no light tree)\n"
+              << "  --guide        path guiding for path tracing or --nee\n"
+              << "  --ao           ambient occlusion preview (16 spp)\n"
+              << "  --ao-distance D AO ray length (default: view distance/10)\n"
+              << "  --denoise      feature-guided denoising of the output\n"
+              << "  --aux PREFIX   write the feature buffers to PREFIX_*.ppm\n"
+              << "  --sampler NAME independent, sobol, halton or bluenoise\n"
+              << "  --time-budget S render progressive passes for S seconds\n"
+              << "  --spp-map FILE write the samples of each pixel (PGM)\n"
+              << "  --frames N     render an animation sequence of N frames\n"
+              << "  --output FILE  write the image to FILE instead of stdout\n"
+              << "                 (with --frames a pattern, e.g. f_%04d.ppm)\n"
+              << "  --fps F        frames per second of scene time (24)\n"
+              << "  --shutter F    fraction of a frame the shutter is open\n"
+              << "  --orbit DEG    camera orbit over the whole sequence\n"
+              << "  --rebuild F    rebuild the BVH when refits degrade it F x\n"
+              << "  --stats        print ray and traversal counters (RTW_STATS)\n"
+              << "  --heatmap FILE write traversal cost per pixel (RTW_STATS)\n";
+}
+
+inline bool ParseOptions(int argc, char* argv[], Options& options) {
+    for (int n = 1; n < argc; n++) {
+        const char* arg = argv[n];
+        const char* value = n + 1 < argc ? argv[n + 1] : nullptr;
+
+        if (std::strcmp(arg, "--wavefront") == 0) {
+            options.wavefront = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--sort-rays") == 0) {
+            options.sortRays = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--nee") == 0) {
+            options.nee = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--mis") == 0) {
+            options.mis = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--uniform-lights") == 0) {
+            options.uniformLights = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--guide") == 0) {
+            options.guide = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--ao") == 0) {
+            options.ao = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--denoise") == 0) {
+            options.denoise = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--stats") == 0) {
+            options.stats = true;
+            continue;
+        }
+
+        if (value == nullptr) {
+            PrintUsage(argv[0]);
+            return false;
+        }
+        if (std::strcmp(arg, "--scene") == 0) {
+            options.scene = std::atoi(value);
+        } else if (std::strcmp(arg, "--width") == 0) {
+            options.imageWidth = std::atoi(value);
+        } else if (std::strcmp(arg, "--spp") == 0) {
+            options.samplesPerPixel = std::atoi(value);
+        } else if (std::strcmp(arg, "--batch") == 0) {
+            options.batchSize = std::max(1, std::atoi(value));
+        } else if (std::strcmp(arg, "--ao-distance") == 0) {
+            options.aoDistance = std::atof(value);
+        } else if (std::strcmp(arg, "--aux") == 0) {
+            options.auxPrefix = value;
+        } else if (std::strcmp(arg, "--frames") == 0) {
+            options.frames = std::max(0, std::atoi(value));
+        } else if (std::strcmp(arg, "--output") == 0) {
+            options.output = value;
+        } else if (std::strcmp(arg, "--fps") == 0) {
+            options.fps = std::atof(value);
+        } else if (std::strcmp(arg, "--shutter") == 0) {
+            options.shutter = std::atof(value);
+        } else if (std::strcmp(arg, "--orbit") == 0) {
+            options.orbit = std::atof(value);
+        } else if (std::strcmp(arg, "--rebuild") == 0) {
+            options.rebuildThreshold = std::atof(value);
+        } else if (std::strcmp(arg, "--time-budget") == 0) {
+            options.timeBudget = std::atof(value);
+        } else if (std::strcmp(arg, "--spp-map") == 0) {
+            options.sppMap = value;
+        } else if (std::strcmp(arg, "--heatmap") == 0) {
+            options.heatmap = value;
+        } else if (std::strcmp(arg, "--sampler") == 0) {
+            options.sampler = value;
+        } else if (std::strcmp(arg, "--threads") == 0) {
+            options.threadCount = std::max(1, std::atoi(value));
+        } else {
+            PrintUsage(argv[0]);
+            return false;
+        }
+        n++;
+    }
+    return true;
+}
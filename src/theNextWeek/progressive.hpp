@@ -0,0 +1,197 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "camera.hpp"
+#include "parallel.hpp"
+#include "row_writer.hpp"
+#include "rtweekend.hpp"
+#include "sampler.hpp"
+#include "stats.hpp"
+
+// 一条相机光线的辐亮度估计，由调用者选择积分器
+using RadianceFunction = std::function<Color(const Ray&, Sampler&)>;
+
+// Renders full-frame passes until a wall-clock deadline. The first pass
+// takes one sample per pixel; after that each pass is sized from the
+// measured time per frame-sample, doubling while there is time and
+// shrinking to what still fits before the deadline. Rendering stops when
+// not even one more sample per pixel fits. Rows are also checked against
+// the deadline, so a pass that turns out slower than estimated is cut off
+// at row granularity instead of overshooting; those rows simply keep fewer
+// samples, which is why the sample count is tracked per pixel.
+class ProgressiveRenderer {
+   private:
+    using Clock = std::chrono::steady_clock;
+
+    const Camera& camera_;
+    RadianceFunction radiance_;
+    std::string samplerName_;
+    int width_, height_;
+    int threadCount_;
+
+    // 像素(i, j)从第first个样本开始的samples个样本之和
+    Color samplePixel(int i, int j, int first, int samples,
+                      Sampler& sampler) const {
+        Color sum{0, 0, 0};
+        for (int s = first; s < first + samples; s++) {
+            sampler.StartPixelSample(i, j, s);
+            auto jitter = sampler.Get2D();
+            auto u = (i + jitter.x) / (width_ - 1);
+            auto v = (j + jitter.y) / (height_ - 1);
+            Ray r = camera_.GetRay(u, v, sampler);
+            sum += radiance_(r, sampler);
+        }
+        return sum;
+    }
+
+    // 每行一个块，行是检查截止时间的粒度。cost不为空时在RTW_STATS下
+    // 累加每个像素的遍历开销，一行在同一个线程上，线程局部的计数可以直接相减
+    void renderPass(int passSamples, Clock::time_point deadline,
+                    std::vector<Color>& image, std::vector<int>& sampleCount,
+                    std::vector<double>* cost = nullptr) const {
+        ParallelFor(height_, 1, threadCount_, [&](size_t begin, size_t end) {
+            auto sampler = MakeSampler(samplerName_);
+            for (auto row = begin; row < end; row++) {
+                if (Clock::now() >= deadline) return;
+                auto j = height_ - 1 - static_cast<int>(row);
+                for (int i = 0; i < width_; i++) {
+                    auto pixel = row * width_ + i;
+#ifdef RTW_STATS
+                    auto costBefore = Stats::Thread().traversalCost;
+#endif
+                    // 样本编号接着之前的pass，低差异序列不会重复
+                    image[pixel] += samplePixel(i, j, sampleCount[pixel],
+                                                passSamples, *sampler);
+                    sampleCount[pixel] += passSamples;
+#ifdef RTW_STATS
+                    if (cost != nullptr) {
+                        (*cost)[pixel] +=
+                            Stats::Thread().traversalCost - costBefore;
+                    }
+#endif
+                }
+            }
+        });
+    }
+
+   public:
+    ProgressiveRenderer(const Camera& camera, RadianceFunction radiance,
+                        const std::string& samplerName, int width, int height,
+                        int threadCount)
+        : camera_(camera),
+          radiance_(radiance),
+          samplerName_(samplerName),
+          width_(width),
+          height_(height),
+          threadCount_(threadCount) {}
+
+    // 把第row行(0是最上面一行)每个像素从第first个样本开始的samples个
+    // 样本加到pixels上，给自己安排线程的调用者用
+    void AccumulateRow(size_t row, int first, int samples, Sampler& sampler,
+                       Color* pixels) const {
+        auto j = height_ - 1 - static_cast<int>(row);
+        for (int i = 0; i < width_; i++) {
+            pixels[i] += samplePixel(i, j, first, samples, sampler);
+        }
+    }
+
+    // 不限时间，每个像素从第first个样本开始的samples个样本，一个pass完成。
+    // cost不为空时得到每个像素所有样本的遍历开销之和，只在RTW_STATS下统计
+    void Render(int samples, std::vector<Color>& image, int first = 0,
+                std::vector<double>* cost = nullptr) const {
+        auto pixels = static_cast<size_t>(width_) * height_;
+        image.assign(pixels, Color{0, 0, 0});
+        if (cost != nullptr) cost->assign(pixels, 0);
+        std::vector<int> sampleCount(pixels, first);
+        renderPass(samples, Clock::time_point::max(), image, sampleCount,
+                   cost);
+    }
+
+    // Renders one pass of samples per pixel without keeping the image: each
+    // finished row goes to a RowWriter that formats it into out on its own
+    // thread. At most window rows wait for the writer at any time.
+    void Stream(int samples, std::ostream& out, size_t window) const {
+        RowWriter writer(out, width_, height_, samples, window);
+        ParallelFor(height_, 1, threadCount_, [&](size_t begin, size_t end) {
+            auto sampler = MakeSampler(samplerName_);
+            for (auto row = begin; row < end; row++) {
+                std::vector<Color> pixels(width_, Color{0, 0, 0});
+                AccumulateRow(row, 0, samples, *sampler, pixels.data());
+                writer.Submit(row, std::move(pixels));
+            }
+        });
+        writer.Finish();
+    }
+
+    // Accumulates sample sums into image and the number of samples of each
+    // pixel into sampleCount, both in output order. Stops at the deadline
+    // or once every pixel has maxSamples (0 for no limit).
+    void Render(double seconds, int maxSamples, std::vector<Color>& image,
+                std::vector<int>& sampleCount) const {
+        auto pixels = static_cast<size_t>(width_) * height_;
+        image.assign(pixels, Color{0, 0, 0});
+        sampleCount.assign(pixels, 0);
+
+        auto start = Clock::now();
+        auto deadline =
+            start + std::chrono::duration_cast<Clock::duration>(
+                        std::chrono::duration<double>(seconds));
+        auto elapsed = [&]() {
+            return std::chrono::duration<double>(Clock::now() - start)
+                .count();
+        };
+
+        int passSamples = 1;
+        int totalSamples = 0;
+        while (true) {
+            if (maxSamples > 0) {
+                passSamples = std::min(passSamples, maxSamples - totalSamples);
+            }
+            if (passSamples <= 0) break;
+
+            renderPass(passSamples, deadline, image, sampleCount);
+            auto passEnd = elapsed();
+            if (Clock::now() >= deadline) {
+                std::cerr << "\rPass of " << passSamples
+                          << " spp cut off by the deadline\n";
+                break;
+            }
+            totalSamples += passSamples;
+            std::cerr << "\rPass of " << std::setw(4) << passSamples
+                      << " spp done at " << std::fixed << std::setprecision(2)
+                      << passEnd << "s, " << totalSamples << " spp total"
+                      << std::flush;
+
+            // 用所有已完成的pass估计每帧一个样本的时间，比单个pass稳定
+            auto perSample = passEnd / totalSamples;
+            auto remaining = seconds - passEnd;
+            // 留5%余量给估计误差
+            auto fits = static_cast<int>(0.95 * remaining / perSample);
+            if (fits < 1) break;
+            passSamples = std::min(2 * passSamples, fits);
+        }
+        std::cerr << "\n";
+    }
+};
+
+// 每个像素的样本数写成文本PGM，灰度值就是样本数本身
+inline void WriteSampleCounts(std::ostream& out,
+                              const std::vector<int>& sampleCount, int width,
+                              int height) {
+    auto maxCount = 1;
+    for (auto n : sampleCount) maxCount = std::max(maxCount, n);
+    out << "P2\n" << width << ' ' << height << '\n'
+        << std::min(maxCount, 65535) << '\n';
+    for (size_t p = 0; p < sampleCount.size(); p++) {
+        out << std::min(sampleCount[p], 65535)
+            << ((p + 1) % width == 0 ? '\n' : ' ');
+    }
+}
@@ -0,0 +1,443 @@
+#pragma once
+
+#include "aarec.hpp"
+#include "box.hpp"
+#include "bvh.hpp"
+#include "camera.hpp"
+#include "color.hpp"
+#include "constant_medium.hpp"
+#include "hittable_list.hpp"
+#include "material.hpp"
+#include "moving_sphere.hpp"
+#include "perlin.hpp"
+#include "rtweekend.hpp"
+#include "sphere.hpp"
+#include "texture.hpp"
+
+// 内置场景和渲染它时默认的相机与图像设置
+struct Scene {
+    HittableList world;
+    Color background{0, 0, 0};
+    Point3 lookFrom;
+    Point3 lookAt;
+    double vfov = 40.0;
+    double aperture = 0.0;
+    double aspectRatio = 16.0 / 9.0;
+    int imageWidth = 400;
+    int samplesPerPixel = 100;
+
+    int ImageHeight(int width) const {
+        return static_cast<int>(width / aspectRatio);
+    }
+
+    // orbit把相机绕过lookAt的竖直轴转过的角度(度)，用于动画
+    Camera MakeCamera(int imageHeight, double time0 = 0.0,
+                      double time1 = 1.0, double orbit = 0.0) const {
+        Vec3 vup = Vec3(0, 1, 0);
+        auto distToFocus = 10.0;
+        auto radians = degrees_to_radians(orbit);
+        auto offset = lookFrom - lookAt;
+        Point3 from = lookAt + Vec3(cos(radians) * offset.X() +
+                                        sin(radians) * offset.Z(),
+                                    offset.Y(),
+                                    -sin(radians) * offset.X() +
+                                        cos(radians) * offset.Z());
+        Camera camera(from, lookAt, vup, vfov, aspectRatio, aperture,
+                      distToFocus, time0, time1);
+        camera.SetImageHeight(imageHeight);
+        return camera;
+    }
+};
+
+HittableList RandomScene();
+HittableList TwoSpheres();
+HittableList TwoPerlinSpheres();
+HittableList Earth();
+HittableList SimpleLight();
+HittableList CornellBox();
+HittableList CornellSmoke();
+HittableList FinalScene();
+HittableList ManyLights();
+
+// Builds scene 1-9; any other id gives the final scene. Objects are made
+// with MakeShared, so they go to the current SceneArena if there is one.
+Scene LoadScene(int id) {
+    Scene scene;
+    switch (id) {
+        case 1:
+            scene.world = RandomScene();
+            scene.background = Color{0.7, 0.8, 1.0};
+            scene.lookFrom = Point3(13, 2, 3);
+            scene.lookAt = Point3(0, 0, 0);
+            scene.vfov = 20.0;
+            scene.aperture = 0.1;
+            break;
+
+        case 2:
+            scene.world = TwoSpheres();
+            scene.background = Color{0.7, 0.8, 1.0};
+            scene.lookFrom = Point3(13, 2, 3);
+            scene.lookAt = Point3(0, 0, 0);
+            scene.vfov = 20.0;
+
+            break;
+
+        case 3:
+            scene.world = TwoPerlinSpheres();
+            scene.background = Color{0.7, 0.8, 1.0};
+            scene.lookFrom = Point3(13, 2, 3);
+            scene.lookAt = Point3(0, 0, 0);
+            scene.vfov = 20.0;
+            break;
+
+        case 4:
+            scene.world = Earth();
+            scene.background = Color{0.7, 0.8, 1.0};
+            scene.lookFrom = Point3(13, 2, 3);
+            scene.lookAt = Point3(0, 0, 0);
+            scene.vfov = 20.0;
+            break;
+
+        case 5:
+            scene.world = SimpleLight();
+            scene.samplesPerPixel = 400;
+            scene.background = Color{0.0, 0.0, 0.0};
+            scene.lookFrom = Point3(26, 3, 6);
+            scene.lookAt = Point3(0, 2, 0);
+            scene.vfov = 20.0;
+            break;
+
+        case 6:
+            scene.world = CornellBox();
+            scene.aspectRatio = 1.0;
+            scene.imageWidth = 600;
+            scene.samplesPerPixel = 200;
+            scene.background = Color(0, 0, 0);
+            scene.lookFrom = Point3(278, 278, -800);
+            scene.lookAt = Point3(278, 278, 0);
+            scene.vfov = 40.0;
+            break;
+
+        case 7:
+            scene.world = CornellSmoke();
+            scene.aspectRatio = 1.0;
+            scene.imageWidth = 600;
+            scene.samplesPerPixel = 200;
+            scene.lookFrom = Point3(278, 278, -800);
+            scene.lookAt = Point3(278, 278, 0);
+            scene.vfov = 40.0;
+            break;
+
+        case 9:
+            scene.world = ManyLights();
+            scene.samplesPerPixel = 64;
+            scene.background = Color(0, 0, 0);
+            scene.lookFrom = Point3(0, 7, 24);
+            scene.lookAt = Point3(0, 1, 0);
+            scene.vfov = 40.0;
+            break;
+
+        default:
+        case 8:
+            scene.world = FinalScene();
+            scene.aspectRatio = 1.0;
+            scene.imageWidth = 800;
+            scene.samplesPerPixel = 10000;
+            scene.background = Color(0, 0, 0);
+            scene.lookFrom = Point3(478, 278, -600);
+            scene.lookAt = Point3(278, 278, 0);
+            scene.vfov = 40.0;
+            break;
+    }
+    return scene;
+}
+
+HittableList RandomScene() {
+    HittableList world;
+
+    auto checker = MakeShared<CheckerTexture>(Color(0.2, 0.3, 0.1),
+                                              Color(0.9, 0.9, 0.9));
+    world.add(MakeShared<Sphere>(Point3(0, -1000, 0), 1000,
+                                 MakeMaterial<Lambertian>(checker)));
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto chooseMat = RandomDouble();
+            Point3 center(a + 0.9 * RandomDouble(), 0.2,
+                          b + 0.9 * RandomDouble());
+
+            if ((center - Point3(4, 0.2, 0)).Length() > 0.9) {
+                std::shared_ptr<Material> sphereMaterial;
+
+                if (chooseMat < 0.8) {
+                    // diffuse
+                    auto albedo = Color::Random() * Color::Random();
+                    sphereMaterial = MakeMaterial<Lambertian>(albedo);
+                    auto center2 = center + Vec3(0, RandomDouble(0, 0.5), 0);
+                    world.add(MakeShared<MovingSphere>(
+                        center, center2, 0.0, 1.0, 0.2, sphereMaterial));
+                } else if (chooseMat < 0.95) {
+                    // metal
+                    auto albedo = Color::Random(0.5, 1);
+                    auto fuzz = RandomDouble(0, 0.5);
+                    sphereMaterial = MakeMaterial<Metal>(albedo, fuzz);
+                    world.add(
+                        MakeShared<Sphere>(center, 0.2, sphereMaterial));
+                } else {
+                    // glass
+                    sphereMaterial = MakeMaterial<Dielectric>(1.5);
+                    world.add(
+                        MakeShared<Sphere>(center, 0.2, sphereMaterial));
+                }
+            }
+        }
+    }
+
+    auto material1 = MakeMaterial<Dielectric>(1.5);
+    world.add(MakeShared<Sphere>(Point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = MakeMaterial<Lambertian>(Color(0.4, 0.2, 0.1));
+    world.add(MakeShared<Sphere>(Point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = MakeMaterial<Metal>(Color(0.7, 0.6, 0.5), 0.0);
+    world.add(MakeShared<Sphere>(Point3(4, 1, 0), 1.0, material3));
+
+    return world;
+}
+
+HittableList TwoSpheres() {
+    HittableList objects;
+
+    auto checker = MakeShared<CheckerTexture>(Color(0.2, 0.3, 0.1),
+                                              Color(0.9, 0.9, 0.9));
+    objects.add(MakeShared<Sphere>(
+        Point3(0, -10, 0), 10, MakeMaterial<Lambertian>(checker)));
+    objects.add(MakeShared<Sphere>(
+        Point3(0, 10, 0), 10, MakeMaterial<Lambertian>(checker)));
+    return objects;
+}
+
+HittableList TwoPerlinSpheres() {
+    HittableList objects;
+
+    auto pertext = MakeShared<NoiseTexture>(4);
+    objects.add(MakeShared<Sphere>(
+        Point3(0, -1000, 0), 1000, MakeMaterial<Lambertian>(pertext)));
+    objects.add(MakeShared<Sphere>(
+        Point3(0, 2, 0), 2, MakeMaterial<Lambertian>(pertext)));
+    return objects;
+}
+
+HittableList Earth() {
+    auto earthTexture =
+        MakeShared<ImageTexture>("resources/earthmap.jpg");
+    auto earthSurface = MakeMaterial<Lambertian>(earthTexture);
+    auto globe = MakeShared<Sphere>(Point3{0, 0, 0}, 2, earthSurface);
+
+    return HittableList(globe);
+}
+
+HittableList SimpleLight() {
+    HittableList objects;
+
+    auto pertext = MakeShared<NoiseTexture>(4);
+    objects.add(MakeShared<Sphere>(
+        Point3(0, -1000, 0), 1000, MakeMaterial<Lambertian>(pertext)));
+    objects.add(MakeShared<Sphere>(
+        Point3(0, 2, 0), 2, MakeMaterial<Lambertian>(pertext)));
+
+    // ? 颜色值超出范围
+    auto diffLight = MakeMaterial<DiffuseLight>(Color{4, 4, 4});
+    objects.add(MakeShared<XYRect>(3, 5, 1, 3, -2, diffLight));
+    return objects;
+}
+
+HittableList CornellBox() {
+    HittableList objects;
+    auto red = MakeMaterial<Lambertian>(Color{0.65, 0.05, 0.05});
+    auto white = MakeMaterial<Lambertian>(Color{0.73, 0.73, 0.73});
+    auto green = MakeMaterial<Lambertian>(Color{.12, .45, .15});
+    auto light = MakeMaterial<DiffuseLight>(Color{15, 15, 15});
+
+    objects.add(MakeShared<YZRect>(0, 555, 0, 555, 555, green));
+    objects.add(MakeShared<YZRect>(0, 555, 0, 555, 0, red));
+    objects.add(MakeShared<XZRect>(213, 343, 227, 332, 554, light));
+    objects.add(MakeShared<XZRect>(0, 555, 0, 555, 0, white));
+    objects.add(MakeShared<XZRect>(0, 555, 0, 555, 555, white));
+    objects.add(MakeShared<XYRect>(0, 555, 0, 555, 555, white));
+
+    std::shared_ptr<Hittable> box1 =
+        MakeShared<Box>(Point3(0, 0, 0), Point3(165, 330, 165), white);
+    box1 = MakeShared<RotateY>(box1, 15);
+    box1 = MakeShared<Translate>(box1, Vec3{256, 0, 295});
+    objects.add(box1);
+
+    std::shared_ptr<Hittable> box2 =
+        MakeShared<Box>(Point3(0, 0, 0), Point3(165, 165, 165), white);
+    box2 = MakeShared<RotateY>(box2, -18);
+    box2 = MakeShared<Translate>(box2, Vec3{130, 0, 65});
+    objects.add(box2);
+    return objects;
+}
+
+HittableList CornellSmoke() {
+    HittableList objects;
+
+    auto red = MakeMaterial<Lambertian>(Color(.65, .05, .05));
+    auto white = MakeMaterial<Lambertian>(Color(.73, .73, .73));
+    auto green = MakeMaterial<Lambertian>(Color(.12, .45, .15));
+    auto light = MakeMaterial<DiffuseLight>(Color(7, 7, 7));
+
+    objects.add(MakeShared<YZRect>(0, 555, 0, 555, 555, green));
+    objects.add(MakeShared<YZRect>(0, 555, 0, 555, 0, red));
+    objects.add(MakeShared<XZRect>(113, 443, 127, 432, 554, light));
+    objects.add(MakeShared<XZRect>(0, 555, 0, 555, 555, white));
+    objects.add(MakeShared<XZRect>(0, 555, 0, 555, 0, white));
+    objects.add(MakeShared<XYRect>(0, 555, 0, 555, 555, white));
+
+    std::shared_ptr<Hittable> box1 =
+        MakeShared<Box>(Point3(0, 0, 0), Point3(165, 330, 165), white);
+    box1 = MakeShared<RotateY>(box1, 15);
+    box1 = MakeShared<Translate>(box1, Vec3(265, 0, 295));
+
+    std::shared_ptr<Hittable> box2 =
+        MakeShared<Box>(Point3(0, 0, 0), Point3(165, 165, 165), white);
+    box2 = MakeShared<RotateY>(box2, -18);
+    box2 = MakeShared<Translate>(box2, Vec3(130, 0, 65));
+
+    objects.add(MakeShared<ConstantMedium>(box1, 0.01, Color(0, 0, 0)));
+    objects.add(MakeShared<ConstantMedium>(box2, 0.01, Color(1, 1, 1)));
+
+    return objects;
+}
+
+HittableList FinalScene() {
+    HittableList objects;
+
+    // 地板
+    HittableList boxes1;
+    auto ground = MakeMaterial<Lambertian>(Color{0.48, 0.83, 0.53});
+
+    const int boxesPerSize = 20;
+    for (int i = 0; i < boxesPerSize; i++) {
+        for (int j = 0; j < boxesPerSize; j++) {
+            auto w = 100.0;
+            auto x0 = -1000.0 + i * w;
+            auto z0 = -1000.0 + j * w;
+            auto y0 = 0.0;
+            auto x1 = x0 + w;
+            auto y1 = RandomDouble(1, 101);
+            auto z1 = z0 + w;
+            boxes1.add(MakeShared<Box>(Point3(x0, y0, z0),
+                                       Point3(x1, y1, z1), ground));
+        }
+    }
+    objects.add(MakeShared<BVHNode>(boxes1, 0, 1));
+
+    // 光源
+    auto light = MakeMaterial<DiffuseLight>(Color{7, 7, 7});
+    objects.add(MakeShared<XZRect>(123, 423, 147, 412, 554, light));
+
+    // 移动的球
+    auto center1 = Point3(400, 400, 200);
+    auto center2 = center1 + Vec3(30, 0, 0);
+    auto moving_sphere_material =
+        MakeMaterial<Lambertian>(Color(0.7, 0.3, 0.1));
+    objects.add(MakeShared<MovingSphere>(center1, center2, 0, 1, 50,
+                                         moving_sphere_material));
+
+    // 玻璃球
+    objects.add(MakeShared<Sphere>(Point3(260, 150, 45), 50,
+                                   MakeMaterial<Dielectric>(1.5)));
+    // 金属球
+    objects.add(MakeShared<Sphere>(
+        Point3(0, 150, 145), 50,
+        MakeMaterial<Metal>(Color(0.8, 0.8, 0.9), 1.0)));
+
+    // 有色玻璃球，藏青
+    auto boundary = MakeShared<Sphere>(Point3(360, 150, 145), 70,
+                                       MakeMaterial<Dielectric>(1.5));
+    objects.add(boundary);
+    objects.add(
+        MakeShared<ConstantMedium>(boundary, 0.2, Color(0.2, 0.4, 0.9)));
+    // 全局白色烟雾
+    boundary = MakeShared<Sphere>(Point3(0, 0, 0), 5000,
+                                  MakeMaterial<Dielectric>(1.5));
+    objects.add(
+        MakeShared<ConstantMedium>(boundary, .0001, Color(1, 1, 1)));
+
+    // 地球
+    auto earthTexture =
+        MakeShared<ImageTexture>("resources/earthmap.jpg");
+    auto earthSurface = MakeMaterial<Lambertian>(earthTexture);
+    auto earth =
+        MakeShared<Sphere>(Point3{400, 200, 400}, 100, earthSurface);
+    objects.add(earth);
+    // 柏林噪音球
+    auto pertext = MakeShared<NoiseTexture>(0.1);
+    objects.add(MakeShared<Sphere>(
+        Point3(220, 280, 300), 80, MakeMaterial<Lambertian>(pertext)));
+
+    // 盒中众球
+    HittableList boxes2;
+    auto white = MakeMaterial<Lambertian>(Color(.73, .73, .73));
+    int ns = 1000;
+    for (int j = 0; j < ns; j++) {
+        boxes2.add(MakeShared<Sphere>(Point3::Random(0, 165), 10, white));
+    }
+    objects.add(MakeShared<Translate>(
+        MakeShared<RotateY>(MakeShared<BVHNode>(boxes2, 0.0, 1.0),
+                            15),
+        Vec3(-100, 270, 395)));
+    return objects;
+}
+
+// Thousands of small emissive spheres scattered over a ground plane
+// between a few large diffuse and metal spheres. Each point is lit by the
+// few lights near it, so picking lights uniformly almost always picks one
+// too far away to matter.
+HittableList ManyLights() {
+    HittableList objects;
+
+    auto ground = MakeMaterial<Lambertian>(Color(0.5, 0.5, 0.5));
+    objects.add(MakeShared<Sphere>(Point3(0, -1000, 0), 1000, ground));
+
+    std::vector<Point3> centers;
+    for (int a = -2; a <= 2; a++) {
+        for (int b = -2; b <= 2; b++) {
+            Point3 center(6 * a, 1.2, 6 * b);
+            centers.push_back(center);
+            std::shared_ptr<Material> material;
+            if ((a + b) % 3 == 0) {
+                material = MakeMaterial<Metal>(Color(0.8, 0.8, 0.8), 0.1);
+            } else {
+                material = MakeMaterial<Lambertian>(Color::Random(0.3, 0.9));
+            }
+            objects.add(MakeShared<Sphere>(center, 1.2, material));
+        }
+    }
+
+    // 64 x 64的网格上抖动摆放，和大球重叠的位置跳过
+    HittableList lights;
+    const int grid = 64;
+    const double extent = 32;
+    for (int i = 0; i < grid; i++) {
+        for (int j = 0; j < grid; j++) {
+            Point3 center(extent * ((i + RandomDouble()) / grid - 0.5),
+                          RandomDouble(0.15, 3),
+                          extent * ((j + RandomDouble()) / grid - 0.5));
+            auto radius = RandomDouble(0.05, 0.1);
+            bool overlaps = false;
+            for (const auto& c : centers) {
+                overlaps |= (center - c).Length() < 1.2 + radius;
+            }
+            if (overlaps) continue;
+            // 暖色为主，亮度相差十倍左右
+            Color color(1, RandomDouble(0.4, 0.9), RandomDouble(0.1, 0.6));
+            auto emit = RandomDouble(0.5, 5) * color;
+            auto light = MakeMaterial<DiffuseLight>(emit);
+            lights.add(MakeShared<Sphere>(center, radius, light));
+        }
+    }
+    objects.add(MakeShared<BVHNode>(lights, 0, 1));
+    return objects;
+}
@@ -1,6 +1,10 @@
 #pragma once
 
+#include "color.hpp"
+#include "fast_math.hpp"
 #include "hittable.hpp"
+#include "material.hpp"
+#include "onb.hpp"
 #include "vec3.hpp"
 
 class Sphere : public Hittable {
@@ -13,30 +17,60 @@ class Sphere : public Hittable {
         //     <0 1 0> yields <0.50 1.00>       < 0 -1  0> yields <0.50 0.00>
         //     <0 0 1> yields <0.25 0.50>       < 0  0 -1> yields <0.75 0.50>
 
-        auto theta = acos(-p.Y());
-        auto phi = atan2(-p.Z(), p.X()) + pi;
+        auto theta = Acos(-p.Y());
+        auto phi = Atan2(-p.Z(), p.X()) + pi;
 
         u = phi / (2 * pi);
         v = theta / pi;
     }
 
+    // [tMin, tMax]内最近的交点，Hit和Occluded共用
+    bool nearestRoot(const Ray& r, Real tMin, Real tMax, Real& root) const;
+
+    // 在球对origin张成的圆锥内均匀采样的pdf，origin在球内时无法采样
+    double conePdf(const Point3& origin) const {
+        auto distanceSquared = (center - origin).LengthSquared();
+        if (distanceSquared <= radius * radius) return 0;
+        auto cosThetaMax = sqrt(1 - radius * radius / distanceSquared);
+        return 1 / (2 * pi * (1 - cosThetaMax));
+    }
+
    public:
     Point3 center;
-    double radius;
+    Real radius;
     std::shared_ptr<Material> matPtr;
 
     Sphere() {}
-    Sphere(Point3 cen, double r, std::shared_ptr<Material> m)
+    Sphere(Point3 cen, Real r, std::shared_ptr<Material> m)
         : center(cen), radius(r), matPtr(m) {}
 
-    virtual bool Hit(const Ray& r, double t_min, double t_max,
+    virtual bool Hit(const Ray& r, Real t_min, Real t_max,
                      HitRecord& rec) const override;
+    virtual bool Occluded(const Ray& r, Real tMin, Real tMax) const override {
+        Real root;
+        return nearestRoot(r, tMin, tMax, root);
+    }
+    virtual void SurfaceInteraction(const Ray& r,
+                                    HitRecord& rec) const override;
+    virtual void CollectLights(LightList& lights) const override {
+        if (matPtr->IsEmissive()) lights.add(this);
+    }
+    virtual bool SampleLight(const Point3& origin, double time,
+                             const Point2& u,
+                             LightSample& sample) const override;
+    virtual bool EmitterBounds(LightBounds& bounds) const override;
     virtual bool BoundingBox(double time0, double time1,
                              AABB& outputBox) const override;
+
+    virtual bool IsConvex() const override { return true; }
+
+    virtual bool Interval(const Ray& r, Real& tEnter,
+                          Real& tExit) const override;
 };
 
-bool Sphere::Hit(const Ray& r, double t_min, double t_max,
-                 HitRecord& rec) const {
+bool Sphere::nearestRoot(const Ray& r, Real tMin, Real tMax,
+                         Real& root) const {
+    RTW_STAT_PRIMITIVE(PrimitiveType::Sphere);
     Vec3 oc = r.Origin() - center;
     auto a = r.Direction().LengthSquared();
     auto half_b = Dot(oc, r.Direction());
@@ -47,24 +81,109 @@ bool Sphere::Hit(const Ray& r, double t_min, double t_max,
     auto sqrtd = sqrt(discriminant);
 
     // Find the nearest root that lies in the acceptable range.
-    auto root = (-half_b - sqrtd) / a;
-    if (root < t_min || t_max < root) {
+    root = (-half_b - sqrtd) / a;
+    if (root < tMin || tMax < root) {
         root = (-half_b + sqrtd) / a;
-        if (root < t_min || t_max < root) return false;
+        if (root < tMin || tMax < root) return false;
     }
+    return true;
+}
+
+bool Sphere::Hit(const Ray& r, Real t_min, Real t_max,
+                 HitRecord& rec) const {
+    Real root;
+    if (!nearestRoot(r, t_min, t_max, root)) return false;
 
     rec.t = root;
-    rec.p = r.at(rec.t);
-    Vec3 outwardNormal = (rec.p - center) / radius;
+    rec.object = this;
+
+    return true;
+}
+
+void Sphere::SurfaceInteraction(const Ray& r, HitRecord& rec) const {
+    // 把r.at(t)投影回球面，误差只剩投影和加上球心时的舍入，与t的误差无关。
+    // 半径为负(空心玻璃球)时只有法线反向，投影用半径的绝对值
+    auto local = r.at(rec.t) - center;
+    local *= fabs(radius) / local.Length();
+    rec.p = center + local;
+    rec.pError = Gamma(5) * Abs(local) + Gamma(1) * Abs(rec.p);
+    Vec3 outwardNormal = local / radius;
     rec.SetFaceNormal(r, outwardNormal);
-    getSphereUV(outwardNormal, rec.u, rec.v);
     rec.matPtr = matPtr;
+    if (matPtr->IsEmissive()) {
+        rec.lightPdf = conePdf(r.Origin());
+        rec.light = this;
+    }
+    // acos/atan2只在材质真的需要uv时计算
+    if (matPtr->NeedsUV()) {
+        getSphereUV(outwardNormal, rec.u, rec.v);
+        // v = θ/π，沿经线每单位长度变化1/(πr)
+        rec.SetUVFootprint(r, 1 / (pi * fabs(radius)));
+    }
+}
 
+bool Sphere::BoundingBox(double time0, double time1, AABB& outputBox) const {
+    auto r = fabs(radius);
+    outputBox = AABB{center - Vec3{r, r, r}, center + Vec3{r, r, r}};
     return true;
 }
 
-bool Sphere::BoundingBox(double time0, double time1, AABB& outputBox) const {
-    outputBox = AABB{center - Vec3{radius, radius, radius},
-                     center + Vec3{radius, radius, radius}};
+bool Sphere::SampleLight(const Point3& origin, double time,
+                         const Point2& u, LightSample& sample) const {
+    // 在球对origin张成的圆锥内均匀采样方向
+    auto direction = center - origin;
+    auto distanceSquared = direction.LengthSquared();
+    if (distanceSquared <= radius * radius) return false;
+
+    auto cosThetaMax = sqrt(1 - radius * radius / distanceSquared);
+    auto z = 1 + u.y * (cosThetaMax - 1);
+    auto phi = 2 * pi * u.x;
+    auto sinTheta = sqrt(1 - z * z);
+    ONB uvw(direction);
+    auto w = uvw.Local(cos(phi) * sinTheta, sin(phi) * sinTheta, z);
+
+    // 求方向与球面的交点(取近的一侧)
+    Vec3 oc = origin - center;
+    auto halfB = Dot(oc, w);
+    auto c = oc.LengthSquared() - radius * radius;
+    auto discriminant = fmax(halfB * halfB - c, 0.0);
+    auto t = -halfB - sqrt(discriminant);
+
+    auto point = origin + t * w;
+    sample.direction = point - origin;
+    sample.pdf = conePdf(origin);
+
+    double pointU = 0, pointV = 0;
+    if (matPtr->NeedsUV()) {
+        getSphereUV((point - center) / radius, pointU, pointV);
+    }
+    sample.emitted = matPtr->Emitted(pointU, pointV, point);
+    return true;
+}
+
+bool Sphere::EmitterBounds(LightBounds& bounds) const {
+    if (!matPtr->IsEmissive()) return false;
+    BoundingBox(0, 0, bounds.box);
+    // 法线朝向所有方向；功率按球心处的发光估计，只影响选择概率
+    auto emitted = matPtr->Emitted(0.5, 0.5, center);
+    bounds.phi = Luminance(emitted) * 4 * pi * radius * radius;
+    bounds.cosThetaO = -1;
+    bounds.cosThetaE = 0;
+    bounds.twoSided = false;
+    return true;
+}
+
+bool Sphere::Interval(const Ray& r, Real& tEnter, Real& tExit) const {
+    Vec3 oc = r.Origin() - center;
+    auto a = r.Direction().LengthSquared();
+    auto halfB = Dot(oc, r.Direction());
+    auto c = oc.LengthSquared() - radius * radius;
+
+    auto discriminant = halfB * halfB - a * c;
+    if (discriminant < 0) return false;
+    auto sqrtd = sqrt(discriminant);
+
+    tEnter = (-halfB - sqrtd) / a;
+    tExit = (-halfB + sqrtd) / a;
     return true;
-}
\ No newline at end of file
+}
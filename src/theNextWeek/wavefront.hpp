@@ -0,0 +1,363 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "camera.hpp"
+#include "hittable.hpp"
+#include "material.hpp"
+#include "parallel.hpp"
+#include "rtweekend.hpp"
+
+// 路径状态，按分量分开存放(SoA)，下标是批次内的样本槽位
+struct PathStates {
+    std::vector<Ray> ray;
+    std::vector<Color> throughput;
+    std::vector<Color> radiance;
+    std::vector<HitRecord> hit;
+    std::vector<int> pixel;
+    std::vector<int> depth;
+    // 样本在整幅图像里的编号，随机数的种子由它得到
+    std::vector<uint64_t> sample;
+    // 路径累计的遍历开销，只在RTW_STATS下统计
+    std::vector<uint64_t> cost;
+
+    void Resize(size_t n) {
+        ray.resize(n);
+        throughput.resize(n);
+        radiance.resize(n);
+        hit.resize(n);
+        pixel.resize(n);
+        depth.resize(n);
+        sample.resize(n);
+        cost.resize(n);
+    }
+};
+
+// Wavefront path tracer: instead of running RayColor() to completion one
+// sample at a time, a batch of paths advances one stage at a time (camera
+// generation, closest hit, background for escaped rays, shading grouped by
+// material type), and every stage is a flat loop over a queue of path slots.
+// Computes the same estimator as RayColor().
+class WavefrontIntegrator {
+   private:
+    static const int materialTypeCount =
+        static_cast<int>(MaterialType::Isotropic) + 1;
+
+    const Hittable& world_;
+    const Camera& camera_;
+    Color background_;
+    int width_, height_;
+    int samplesPerPixel_;
+    int maxDepth_;
+    int threadCount_;
+    size_t batchSize_;
+    bool sortRays_;
+    // 活跃光线起点的包围盒，排序时的网格建在它上面
+    Point3 originMin_, originMax_;
+    size_t raysTraced_ = 0;
+
+    PathStates paths_;
+    std::vector<int> active_;
+    std::vector<int> escaped_;
+    std::vector<int> shadeQueues_[materialTypeCount];
+    std::vector<char> hitFlags_;
+    std::vector<uint32_t> sortKeys_, sortedKeys_;
+    std::vector<int> sorted_;
+    // gatherPaths的暂存区，每次排序都复用
+    PathStates gathered_;
+
+    static const size_t grain = 256;
+
+    enum class Stage { Generate, Intersect, Shade };
+
+    // 每条路径在每次弹射的每个阶段都从自己的种子开始取随机数，结果与
+    // 线程、批次里的槽位和光线排序都无关
+    static void seedPath(uint64_t sample, int depth, Stage stage) {
+        SeedRandom((sample << 16) + 4 * static_cast<uint64_t>(depth) +
+                   static_cast<uint64_t>(stage));
+    }
+
+    void generate(size_t firstSample, size_t count) {
+        ParallelFor(count, grain, threadCount_, [&](size_t begin, size_t end) {
+            for (size_t slot = begin; slot < end; slot++) {
+                auto sample = firstSample + slot;
+                auto pixel = static_cast<int>(sample / samplesPerPixel_);
+                // 输出从最上面一行开始
+                auto i = pixel % width_;
+                auto j = height_ - 1 - pixel / width_;
+                seedPath(sample, maxDepth_, Stage::Generate);
+                auto u = (i + RandomDouble()) / (width_ - 1);
+                auto v = (j + RandomDouble()) / (height_ - 1);
+
+                paths_.ray[slot] = camera_.GetRay(u, v);
+                paths_.throughput[slot] = Color{1, 1, 1};
+                paths_.radiance[slot] = Color{0, 0, 0};
+                paths_.pixel[slot] = pixel;
+                paths_.depth[slot] = maxDepth_;
+                paths_.sample[slot] = sample;
+                paths_.cost[slot] = 0;
+            }
+        });
+
+        active_.clear();
+        for (size_t slot = 0; slot < count; slot++) {
+            active_.push_back(static_cast<int>(slot));
+        }
+    }
+
+    // 把6位的整数展开，每位之间插入两个0
+    static uint32_t spreadBits(uint32_t x) {
+        x &= 0x3f;
+        x = (x | (x << 8)) & 0x300f;
+        x = (x | (x << 4)) & 0x30c3;
+        x = (x | (x << 2)) & 0x9249;
+        return x;
+    }
+
+    // 方向的卦限放在最高位，其次是起点所在格子(64^3)的Morton码，共21位
+    uint32_t rayKey(const Ray& r) const {
+        const auto& d = r.Direction();
+        uint32_t octant = (d.X() < 0 ? 1 : 0) | (d.Y() < 0 ? 2 : 0) |
+                          (d.Z() < 0 ? 4 : 0);
+        uint32_t cell = 0;
+        for (int a = 0; a < 3; a++) {
+            // 所有起点在这个轴上重合时格子坐标都是0
+            auto extent = originMax_[a] - originMin_[a];
+            auto x = extent > 0 ? (r.Origin()[a] - originMin_[a]) / extent : 0;
+            auto q = static_cast<uint32_t>(Clamp(x, 0.0, 1.0) * 63);
+            cell |= spreadBits(q) << a;
+        }
+        return (octant << 18) | cell;
+    }
+
+    // Reorders the active queue so that rays starting close to each other and
+    // heading the same way are traced back to back. LSD radix sort on the
+    // 21-bit key, three passes of 7 bits.
+    void sortActive() {
+        const int bits = 7;
+        const int buckets = 1 << bits;
+        auto n = active_.size();
+        sortKeys_.resize(n);
+        sortedKeys_.resize(n);
+        sorted_.resize(n);
+
+        // 网格只覆盖光线实际所在的范围：场景的包围盒可能大得多(比如
+        // FinalScene里半径5000的雾)，那样所有光线都落在同一个格子里
+        originMin_ = Point3(infinity, infinity, infinity);
+        originMax_ = Point3(-infinity, -infinity, -infinity);
+        for (auto slot : active_) {
+            const auto& o = paths_.ray[slot].Origin();
+            for (int a = 0; a < 3; a++) {
+                originMin_[a] = std::min(originMin_[a], o[a]);
+                originMax_[a] = std::max(originMax_[a], o[a]);
+            }
+        }
+
+        ParallelFor(n, grain, threadCount_, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                sortKeys_[i] = rayKey(paths_.ray[active_[i]]);
+            }
+        });
+
+        for (int shift = 0; shift < 3 * bits; shift += bits) {
+            size_t count[buckets + 1] = {};
+            for (auto key : sortKeys_) {
+                count[((key >> shift) & (buckets - 1)) + 1]++;
+            }
+            for (int b = 0; b < buckets; b++) count[b + 1] += count[b];
+            for (size_t i = 0; i < n; i++) {
+                auto dst = count[(sortKeys_[i] >> shift) & (buckets - 1)]++;
+                sortedKeys_[dst] = sortKeys_[i];
+                sorted_[dst] = active_[i];
+            }
+            sortKeys_.swap(sortedKeys_);
+            active_.swap(sorted_);
+        }
+
+        // 只排下标的话后续阶段对路径数据的访问是乱序的，所以把活跃路径的数据
+        // 按排序结果搬到它们原先占用的槽位里(升序)，让后续阶段顺序访问内存
+        sorted_ = active_;
+        std::sort(sorted_.begin(), sorted_.end());
+        gatherPaths(active_, sorted_);
+        active_.swap(sorted_);
+    }
+
+    // 把from[i]槽位的路径搬到to[i]，经过gathered_中转。hit不用搬，下一次
+    // 求交会重新写，所以gathered_也不分配它
+    void gatherPaths(const std::vector<int>& from, const std::vector<int>& to) {
+        auto n = from.size();
+        if (gathered_.ray.size() < n) {
+            gathered_.ray.resize(n);
+            gathered_.throughput.resize(n);
+            gathered_.radiance.resize(n);
+            gathered_.pixel.resize(n);
+            gathered_.depth.resize(n);
+            gathered_.sample.resize(n);
+            gathered_.cost.resize(n);
+        }
+        for (size_t i = 0; i < n; i++) {
+            gathered_.ray[i] = paths_.ray[from[i]];
+            gathered_.throughput[i] = paths_.throughput[from[i]];
+            gathered_.radiance[i] = paths_.radiance[from[i]];
+            gathered_.pixel[i] = paths_.pixel[from[i]];
+            gathered_.depth[i] = paths_.depth[from[i]];
+            gathered_.sample[i] = paths_.sample[from[i]];
+            gathered_.cost[i] = paths_.cost[from[i]];
+        }
+        for (size_t i = 0; i < n; i++) {
+            paths_.ray[to[i]] = gathered_.ray[i];
+            paths_.throughput[to[i]] = gathered_.throughput[i];
+            paths_.radiance[to[i]] = gathered_.radiance[i];
+            paths_.pixel[to[i]] = gathered_.pixel[i];
+            paths_.depth[to[i]] = gathered_.depth[i];
+            paths_.sample[to[i]] = gathered_.sample[i];
+            paths_.cost[to[i]] = gathered_.cost[i];
+        }
+    }
+
+    void intersect() {
+        ParallelFor(active_.size(), grain, threadCount_,
+                    [&](size_t begin, size_t end) {
+                        for (size_t n = begin; n < end; n++) {
+                            intersectSlot(active_[n]);
+                        }
+                    });
+
+        // 按结果把路径分到背景队列和各材质的着色队列
+        escaped_.clear();
+        for (auto& queue : shadeQueues_) queue.clear();
+        for (auto slot : active_) {
+            if (!hitFlags_[slot]) {
+                escaped_.push_back(slot);
+            } else {
+                auto type = paths_.hit[slot].matPtr->Type();
+                shadeQueues_[static_cast<int>(type)].push_back(slot);
+            }
+        }
+    }
+
+    void intersectSlot(int slot) {
+        const auto& r = paths_.ray[slot];
+        auto& rec = paths_.hit[slot];
+        RTW_STAT_RAY(paths_.depth[slot]);
+        // 介质的散射距离是随机的
+        seedPath(paths_.sample[slot], paths_.depth[slot], Stage::Intersect);
+#ifdef RTW_STATS
+        auto costBefore = Stats::Thread().traversalCost;
+#endif
+        // 防止浮点数近似为0
+        hitFlags_[slot] = world_.Hit(r, 0, infinity, rec);
+#ifdef RTW_STATS
+        paths_.cost[slot] += Stats::Thread().traversalCost - costBefore;
+#endif
+        if (hitFlags_[slot]) rec.Resolve(r);
+    }
+
+    void shadeEscaped() {
+        for (auto slot : escaped_) {
+            paths_.radiance[slot] += paths_.throughput[slot] * background_;
+        }
+    }
+
+    void shade(const std::vector<int>& queue) {
+        ParallelFor(queue.size(), grain, threadCount_,
+                    [&](size_t begin, size_t end) {
+                        for (size_t n = begin; n < end; n++) {
+                            shadeSlot(queue[n]);
+                        }
+                    });
+    }
+
+    void shadeSlot(int slot) {
+        const auto& rec = paths_.hit[slot];
+        auto& throughput = paths_.throughput[slot];
+        seedPath(paths_.sample[slot], paths_.depth[slot], Stage::Shade);
+        paths_.radiance[slot] +=
+            throughput * rec.matPtr->Emitted(rec.u, rec.v, rec.p);
+
+        Ray scattered;
+        Color attenuation;
+        if (!rec.matPtr->Scatter(paths_.ray[slot], rec, attenuation,
+                                 scattered)) {
+            paths_.depth[slot] = 0;
+            return;
+        }
+
+        // 对应RayColor的depth - 1递归
+        paths_.ray[slot] = scattered;
+        throughput = throughput * attenuation;
+        if (--paths_.depth[slot] == 0) RTW_STAT_DEPTH_TERMINATED();
+    }
+
+    void compact() {
+        std::vector<int> next;
+        next.reserve(active_.size());
+        for (const auto& queue : shadeQueues_) {
+            for (auto slot : queue) {
+                if (paths_.depth[slot] > 0) next.push_back(slot);
+            }
+        }
+        active_.swap(next);
+    }
+
+   public:
+    WavefrontIntegrator(const Hittable& world, const Camera& camera,
+                        const Color& background, int width, int height,
+                        int samplesPerPixel, int maxDepth, int threadCount,
+                        size_t batchSize = 1 << 16, bool sortRays = false)
+        : world_(world),
+          camera_(camera),
+          background_(background),
+          width_(width),
+          height_(height),
+          samplesPerPixel_(samplesPerPixel),
+          maxDepth_(maxDepth),
+          threadCount_(threadCount),
+          batchSize_(batchSize),
+          sortRays_(sortRays) {}
+
+    size_t RaysTraced() const { return raysTraced_; }
+
+    // Accumulates the sum of all samples of each pixel into image, in
+    // output (top to bottom) order. With RTW_STATS, cost (if given) gets
+    // the traversal cost of each pixel summed over its samples.
+    void Render(std::vector<Color>& image,
+                std::vector<double>* cost = nullptr) {
+        image.assign(static_cast<size_t>(width_) * height_, Color{0, 0, 0});
+        if (cost != nullptr) cost->assign(image.size(), 0);
+
+        auto totalSamples = image.size() * samplesPerPixel_;
+        auto batch = std::min(batchSize_, totalSamples);
+        paths_.Resize(batch);
+        hitFlags_.resize(batch);
+
+        for (size_t first = 0; first < totalSamples; first += batch) {
+            auto count = std::min(batch, totalSamples - first);
+            std::cerr << "\rSamples remaining: " << totalSamples - first
+                      << "   " << std::flush;
+
+            generate(first, count);
+            for (bool primary = true; !active_.empty(); primary = false) {
+                // 相机光线本来就是相干的，只对次级光线排序
+                if (sortRays_ && !primary) sortActive();
+                raysTraced_ += active_.size();
+                intersect();
+                shadeEscaped();
+                for (const auto& queue : shadeQueues_) shade(queue);
+                compact();
+            }
+
+            for (size_t slot = 0; slot < count; slot++) {
+                image[paths_.pixel[slot]] += paths_.radiance[slot];
+            }
+            if (cost != nullptr) {
+                for (size_t slot = 0; slot < count; slot++) {
+                    (*cost)[paths_.pixel[slot]] += paths_.cost[slot];
+                }
+            }
+        }
+    }
+};